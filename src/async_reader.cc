@@ -0,0 +1,340 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "async_reader.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>       // for memset
+#include <sys/mman.h>     // for mmap
+#include <sys/stat.h>     // for fstat
+#include <sys/syscall.h>  // for __NR_io_uring_*
+#include <sys/uio.h>      // for iovec
+#include <unistd.h>       // for pread, syscall
+
+#include <algorithm>
+
+AsyncReader::AsyncReader()
+    : ring_(NULL),
+      fd_(-1),
+      block_size_(0),
+      depth_(0),
+      backend_(ASYNC_BACKEND_AUTO),
+      base_offset_(0),
+      submit_pos_(0),
+      head_(0),
+      count_(0),
+      uring_fd_(-1),
+      uring_fixed_(false),
+      sq_map_(NULL),
+      sq_map_size_(0),
+      cq_map_(NULL),
+      cq_map_size_(0),
+      sqes_(NULL),
+      sqes_size_(0),
+      quit_(false) {}
+
+AsyncReader::~AsyncReader() { Stop(); }
+
+int AsyncReader::Init(int fd, int64_t offset, RingBuffer *ring,
+                      int block_size, int depth, AsyncBackend backend) {
+  Stop();
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      !ring->IsMirrored() || depth <= 0) {
+    return -1;
+  }
+  fd_ = fd;
+  block_size_ = block_size;
+  depth_ = depth;
+  base_offset_ = offset - ring->WritePos();
+  submit_pos_ = ring->WritePos();
+  requests_.assign(depth_, Request());
+  head_ = 0;
+  count_ = 0;
+  ring_ = ring;
+
+  if (backend != ASYNC_BACKEND_THREADS && UringInit() == 0) {
+    backend_ = ASYNC_BACKEND_URING;
+    return 0;
+  }
+  if (backend != ASYNC_BACKEND_URING && ThreadsInit() == 0) {
+    backend_ = ASYNC_BACKEND_THREADS;
+    return 0;
+  }
+  ring_ = NULL;
+  return -1;
+}
+
+void AsyncReader::Stop() {
+  if (ring_ == NULL) {
+    return;
+  }
+  Drain();
+  if (backend_ == ASYNC_BACKEND_URING) {
+    UringRelease();
+  } else {
+    ThreadsRelease();
+  }
+  ring_ = NULL;
+}
+
+int64_t AsyncReader::Offset() const {
+  return base_offset_ + ((ring_ != NULL) ? ring_->WritePos() : 0);
+}
+
+const char *AsyncReader::BackendName() const {
+  if (ring_ == NULL) {
+    return "none";
+  }
+  if (backend_ == ASYNC_BACKEND_URING) {
+    return uring_fixed_ ? "io_uring (registered buffers)" : "io_uring";
+  }
+  return "threads";
+}
+
+void AsyncReader::Submit() {
+  while (count_ < depth_) {
+    // read up to the next block boundary, without overwriting the
+    // data that has not been consumed yet
+    int64_t block_len = block_size_ - (submit_pos_ % block_size_);
+    int64_t free_len = ring_->ReadPos() + ring_->Size() - submit_pos_;
+    int len = (int)std::min(block_len, free_len);
+    if (len <= 0 || (len < block_len && count_ > 0)) {
+      break;
+    }
+    int slot = (head_ + count_) % depth_;
+    Request &req = requests_[slot];
+    req.pos = submit_pos_;
+    req.len = len;
+    req.done = false;
+    req.res = 0;
+    if (backend_ == ASYNC_BACKEND_URING) {
+      if (UringSubmit(slot) < 0) {
+        break;
+      }
+    } else {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(slot);
+      job_cv_.notify_one();
+    }
+    submit_pos_ += len;
+    ++count_;
+  }
+}
+
+void AsyncReader::WaitFront() {
+  if (backend_ == ASYNC_BACKEND_URING) {
+    while (!requests_[head_].done) {
+      UringWait();
+    }
+  } else {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return requests_[head_].done; });
+  }
+}
+
+void AsyncReader::Drain() {
+  while (count_ > 0) {
+    WaitFront();
+    head_ = (head_ + 1) % depth_;
+    --count_;
+  }
+}
+
+ssize_t AsyncReader::Read() {
+  if (ring_ == NULL) {
+    return -1;
+  }
+  Submit();
+  if (count_ == 0) {
+    // the ring is full
+    return -1;
+  }
+  WaitFront();
+  Request req = requests_[head_];
+  head_ = (head_ + 1) % depth_;
+  --count_;
+  if (req.res > 0) {
+    ring_->Produce(req.res);
+  }
+  if (req.res != req.len) {
+    // short read (or error): the reads queued after this one are at
+    // the wrong ring positions. Drop them, and restart at the write
+    // cursor on the next call.
+    Drain();
+    submit_pos_ = ring_->WritePos();
+  }
+  return (req.res < 0) ? -1 : req.res;
+}
+
+// io_uring backend
+
+int AsyncReader::UringInit() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  uring_fd_ = syscall(__NR_io_uring_setup, depth_, &params);
+  if (uring_fd_ < 0) {
+    return -1;
+  }
+  sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_map) {
+    sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sq_map_ = mmap(NULL, sq_map_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, uring_fd_, IORING_OFF_SQ_RING);
+  cq_map_ = single_map ? sq_map_
+                       : mmap(NULL, cq_map_size_, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, uring_fd_,
+                              IORING_OFF_CQ_RING);
+  sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, uring_fd_, IORING_OFF_SQES);
+  if (sq_map_ == MAP_FAILED || cq_map_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+    UringRelease();
+    return -1;
+  }
+  uint8_t *sq = reinterpret_cast<uint8_t *>(sq_map_);
+  uint8_t *cq = reinterpret_cast<uint8_t *>(cq_map_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  // register the ring memory, so the kernel does not need to map the
+  // buffers on every read
+  struct iovec iov;
+  iov.iov_base = ring_->Base();
+  iov.iov_len = ring_->MappedSize();
+  uring_fixed_ = syscall(__NR_io_uring_register, uring_fd_,
+                         IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+  return 0;
+}
+
+int AsyncReader::UringSubmit(int slot) {
+  const Request &req = requests_[slot];
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  struct io_uring_sqe *sqe =
+      reinterpret_cast<struct io_uring_sqe *>(sqes_) + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = uring_fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd_;
+  sqe->off = base_offset_ + req.pos;
+  sqe->addr = (uint64_t)(uintptr_t)ring_->PosPtr(req.pos);
+  sqe->len = req.len;
+  sqe->buf_index = 0;
+  sqe->user_data = slot;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  int res;
+  do {
+    res = syscall(__NR_io_uring_enter, uring_fd_, 1, 0, 0, NULL, 0);
+  } while (res < 0 && errno == EINTR);
+  if (res < 0) {
+    // take the entry back
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    return -1;
+  }
+  return 0;
+}
+
+void AsyncReader::UringWait() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    int res = syscall(__NR_io_uring_enter, uring_fd_, 0, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    if (res < 0 && errno != EINTR) {
+      // fail the oldest request instead of waiting forever
+      requests_[head_].res = -1;
+      requests_[head_].done = true;
+      return;
+    }
+    tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe *cqe =
+        reinterpret_cast<const struct io_uring_cqe *>(cqes_) +
+        (head & *cq_mask_);
+    Request &req = requests_[cqe->user_data];
+    req.res = cqe->res;
+    req.done = true;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void AsyncReader::UringRelease() {
+  if (sqes_ != NULL && sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_map_ != NULL && cq_map_ != MAP_FAILED && cq_map_ != sq_map_) {
+    munmap(cq_map_, cq_map_size_);
+  }
+  if (sq_map_ != NULL && sq_map_ != MAP_FAILED) {
+    munmap(sq_map_, sq_map_size_);
+  }
+  sqes_ = cq_map_ = sq_map_ = NULL;
+  if (uring_fd_ >= 0) {
+    close(uring_fd_);
+    uring_fd_ = -1;
+  }
+  uring_fixed_ = false;
+}
+
+// thread pool backend
+
+int AsyncReader::ThreadsInit() {
+  quit_ = false;
+  jobs_.clear();
+  for (int i = 0; i < depth_; ++i) {
+    workers_.push_back(std::thread(&AsyncReader::ThreadsWorker, this));
+  }
+  return 0;
+}
+
+void AsyncReader::ThreadsWorker() {
+  while (true) {
+    int slot;
+    Request req;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_cv_.wait(lock, [this] { return quit_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      slot = jobs_.front();
+      jobs_.pop_front();
+      req = requests_[slot];
+    }
+    ssize_t res;
+    do {
+      res = pread(fd_, ring_->PosPtr(req.pos), req.len,
+                  base_offset_ + req.pos);
+    } while (res < 0 && errno == EINTR);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_[slot].res = res;
+      requests_[slot].done = true;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+void AsyncReader::ThreadsRelease() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  job_cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
@@ -0,0 +1,136 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef ASYNC_READER_H_
+#define ASYNC_READER_H_
+
+#include <stdint.h>     // for uint8_t, int64_t
+#include <sys/types.h>  // for ssize_t
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+
+#define DEFAULT_ASYNC_QUEUE_DEPTH 4
+
+// async read backends
+typedef enum {
+  // io_uring, falling back to the thread pool
+  ASYNC_BACKEND_AUTO = 0,
+  ASYNC_BACKEND_URING = 1,
+  ASYNC_BACKEND_THREADS = 2,
+} AsyncBackend;
+
+// An asynchronous reader that keeps several block reads in flight
+// ahead of the consumer.
+//
+// Reads go straight into the free space of a (mirrored) RingBuffer,
+// one block per read, so the ring blocks are the (fixed) buffer pool:
+// a block is recycled once the consumer moves the ring read cursor
+// past it. Reads complete in any order, but Read() only appends them
+// to the ring in file order.
+//
+// The io_uring backend uses the raw system calls (no liburing), and
+// registers the ring memory as a fixed buffer when the kernel allows
+// it. The thread pool backend issues pread() calls from <depth>
+// worker threads.
+//
+// Only regular files are supported (reads need a file offset).
+class AsyncReader {
+ public:
+  AsyncReader();
+  ~AsyncReader();
+
+  // Start reading <fd> at file offset <offset> into <ring>, which must
+  // be mirrored. Returns 0 if successful, -1 otherwise.
+  int Init(int fd, int64_t offset, RingBuffer *ring, int block_size,
+           int depth, AsyncBackend backend);
+
+  // Wait for all the reads in flight, and stop the backend
+  void Stop();
+
+  bool Running() const { return ring_ != NULL; }
+
+  // Queue as many reads as the ring free space allows, then wait for
+  // the next one (in file order) and append it to the ring. Returns
+  // the number of bytes appended, 0 at the end of the file, -1 on
+  // error.
+  ssize_t Read();
+
+  // file offset of the ring write cursor
+  int64_t Offset() const;
+
+  // Returns the name of the backend in use
+  const char *BackendName() const;
+
+ private:
+  struct Request {
+    // absolute ring position and length
+    int64_t pos;
+    int len;
+    bool done;
+    ssize_t res;
+  };
+
+  void Submit();
+  // wait until the oldest request is done
+  void WaitFront();
+  // wait for (and drop) all the requests in flight
+  void Drain();
+
+  // io_uring backend
+  int UringInit();
+  int UringSubmit(int slot);
+  void UringWait();
+  void UringRelease();
+
+  // thread pool backend
+  int ThreadsInit();
+  void ThreadsWorker();
+  void ThreadsRelease();
+
+  RingBuffer *ring_;
+  int fd_;
+  int block_size_;
+  int depth_;
+  AsyncBackend backend_;
+  // file offset of ring position 0
+  int64_t base_offset_;
+  // next ring position to read into
+  int64_t submit_pos_;
+  // requests in flight (a circular array of <depth> slots)
+  std::vector<Request> requests_;
+  int head_;
+  int count_;
+
+  // io_uring state
+  int uring_fd_;
+  bool uring_fixed_;
+  void *sq_map_;
+  size_t sq_map_size_;
+  void *cq_map_;
+  size_t cq_map_size_;
+  void *sqes_;
+  size_t sqes_size_;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  void *cqes_;
+
+  // thread pool state
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable job_cv_;
+  std::condition_variable done_cv_;
+  std::deque<int> jobs_;
+  bool quit_;
+};
+
+#endif  // ASYNC_READER_H_
@@ -0,0 +1,392 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "decompressor.h"
+
+#include <errno.h>
+#include <string.h>    // for memcpy
+#include <sys/stat.h>  // for fstat
+#include <unistd.h>    // for read, pread
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+
+// seekable zstd format (see zstd's contrib/seekable_format)
+#define ZSTD_SEEKABLE_MAGIC 0x8f92eab1
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+#define ZSTD_SEEKABLE_CHECKSUM_FLAG 0x80
+
+static uint32_t ReadLe32(const uint8_t *buf) {
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+Decompressor::Decompressor()
+    : fd_(-1),
+      format_(COMPRESSION_NONE),
+      in_offset_(0),
+      in_len_(0),
+      in_eof_(false),
+      decoder_(NULL),
+      decoder_done_(false),
+      quit_(false),
+      done_(false),
+      error_(DECOMPRESSOR_OK),
+      decoded_(0),
+      base_(0) {}
+
+Decompressor::~Decompressor() { Stop(); }
+
+CompressionFormat Decompressor::Detect(const uint8_t *buf, int len) {
+  if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b) {
+    return COMPRESSION_GZIP;
+  }
+  if (len >= 4 && ReadLe32(buf) == 0xfd2fb528) {
+    return COMPRESSION_ZSTD;
+  }
+  return COMPRESSION_NONE;
+}
+
+bool Decompressor::Supported(CompressionFormat format) {
+  switch (format) {
+    case COMPRESSION_GZIP:
+      return true;
+    case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+const char *Decompressor::ErrorName(DecompressorError error) {
+  switch (error) {
+    case DECOMPRESSOR_CORRUPT:
+      return "corrupt";
+    case DECOMPRESSOR_TRUNCATED:
+      return "truncated";
+    case DECOMPRESSOR_READ_ERROR:
+      return "unreadable";
+    default:
+      return "ok";
+  }
+}
+
+const char *Decompressor::FormatName(CompressionFormat format) {
+  switch (format) {
+    case COMPRESSION_GZIP:
+      return "gzip";
+    case COMPRESSION_ZSTD:
+      return "zstd";
+    default:
+      return "none";
+  }
+}
+
+int Decompressor::Start(int fd, CompressionFormat format,
+                        const uint8_t *prefix, int prefix_len) {
+  Stop();
+  fd_ = fd;
+  format_ = format;
+  in_.resize(std::max(DECOMPRESSOR_INPUT_SIZE, prefix_len));
+  if (prefix_len > 0) {
+    memcpy(in_.data(), prefix, prefix_len);
+  }
+  in_offset_ = 0;
+  in_len_ = prefix_len;
+  in_eof_ = false;
+  if (InitDecoder() < 0) {
+    return -1;
+  }
+  blocks_.resize(DECOMPRESSOR_QUEUE_DEPTH);
+  full_.clear();
+  free_.clear();
+  for (auto &block : blocks_) {
+    block.data.resize(DECOMPRESSOR_BLOCK_SIZE);
+    free_.push_back(&block);
+  }
+  quit_ = false;
+  done_ = false;
+  error_ = DECOMPRESSOR_OK;
+  decoded_ = 0;
+  base_ = 0;
+  thread_ = std::thread(&Decompressor::Run, this);
+  return 0;
+}
+
+void Decompressor::Stop() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+  ReleaseDecoder();
+}
+
+void Decompressor::Run() {
+  while (true) {
+    Block *block;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return quit_ || !free_.empty(); });
+      if (quit_) {
+        return;
+      }
+      block = free_.front();
+      free_.pop_front();
+    }
+    DecompressorError error;
+    int len = Decompress(block, &error);
+    bool done = (len == 0 || error != DECOMPRESSOR_OK);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // the bytes decoded before an error are still returned
+      if (len > 0) {
+        block->len = len;
+        block->offset = 0;
+        full_.push_back(block);
+        decoded_ += len;
+      } else {
+        free_.push_back(block);
+      }
+      if (done) {
+        done_ = true;
+        error_ = error;
+      }
+    }
+    cv_.notify_all();
+    if (done) {
+      return;
+    }
+  }
+}
+
+ssize_t Decompressor::Read(uint8_t *buf, int len) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !full_.empty() || done_; });
+  if (full_.empty()) {
+    return (error_ != DECOMPRESSOR_OK) ? -1 : 0;
+  }
+  // the front block belongs to the consumer until it is returned
+  Block *block = full_.front();
+  lock.unlock();
+  int n = std::min(len, block->len - block->offset);
+  memcpy(buf, block->data.data() + block->offset, n);
+  block->offset += n;
+  if (block->offset == block->len) {
+    lock.lock();
+    full_.pop_front();
+    free_.push_back(block);
+    lock.unlock();
+    cv_.notify_all();
+  }
+  return n;
+}
+
+DecompressorError Decompressor::Error() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return error_;
+}
+
+int64_t Decompressor::ErrorOffset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return base_ + decoded_;
+}
+
+ssize_t Decompressor::ReadCompressed() {
+  if (in_offset_ == in_len_) {
+    in_offset_ = 0;
+    in_len_ = 0;
+  }
+  ssize_t res;
+  do {
+    res = read(fd_, in_.data() + in_len_, in_.size() - in_len_);
+  } while (res < 0 && errno == EINTR);
+  if (res <= 0) {
+    in_eof_ = true;
+    return res;
+  }
+  in_len_ += res;
+  return res;
+}
+
+int Decompressor::InitDecoder() {
+  ReleaseDecoder();
+  decoder_done_ = false;
+  if (format_ == COMPRESSION_GZIP) {
+    z_stream *zs = new z_stream();
+    memset(zs, 0, sizeof(*zs));
+    // 15 + 32: any window size, and automatic gzip/zlib header detection
+    if (inflateInit2(zs, 15 + 32) != Z_OK) {
+      delete zs;
+      return -1;
+    }
+    decoder_ = zs;
+    return 0;
+  }
+#ifdef HAVE_ZSTD
+  if (format_ == COMPRESSION_ZSTD) {
+    ZSTD_DStream *zds = ZSTD_createDStream();
+    if (zds == NULL || ZSTD_isError(ZSTD_initDStream(zds))) {
+      ZSTD_freeDStream(zds);
+      return -1;
+    }
+    decoder_ = zds;
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+void Decompressor::ReleaseDecoder() {
+  if (decoder_ == NULL) {
+    return;
+  }
+  if (format_ == COMPRESSION_GZIP) {
+    z_stream *zs = reinterpret_cast<z_stream *>(decoder_);
+    inflateEnd(zs);
+    delete zs;
+  }
+#ifdef HAVE_ZSTD
+  if (format_ == COMPRESSION_ZSTD) {
+    ZSTD_freeDStream(reinterpret_cast<ZSTD_DStream *>(decoder_));
+  }
+#endif
+  decoder_ = NULL;
+}
+
+int Decompressor::Decompress(Block *block, DecompressorError *error) {
+  *error = DECOMPRESSOR_OK;
+  int out = 0;
+  while (out < DECOMPRESSOR_BLOCK_SIZE) {
+    if (in_offset_ == in_len_) {
+      if (in_eof_) {
+        // the input must end between gzip members or zstd frames
+        if (!decoder_done_) {
+          *error = DECOMPRESSOR_TRUNCATED;
+        }
+        break;
+      }
+      if (ReadCompressed() < 0) {
+        *error = DECOMPRESSOR_READ_ERROR;
+        break;
+      }
+      continue;
+    }
+    if (format_ == COMPRESSION_GZIP) {
+      z_stream *zs = reinterpret_cast<z_stream *>(decoder_);
+      if (decoder_done_) {
+        // concatenated gzip members
+        inflateReset(zs);
+        decoder_done_ = false;
+      }
+      zs->next_in = in_.data() + in_offset_;
+      zs->avail_in = in_len_ - in_offset_;
+      zs->next_out = block->data.data() + out;
+      zs->avail_out = DECOMPRESSOR_BLOCK_SIZE - out;
+      int res = inflate(zs, Z_NO_FLUSH);
+      in_offset_ = in_len_ - zs->avail_in;
+      out = DECOMPRESSOR_BLOCK_SIZE - zs->avail_out;
+      if (res == Z_STREAM_END) {
+        decoder_done_ = true;
+      } else if (res != Z_OK && res != Z_BUF_ERROR) {
+        *error = DECOMPRESSOR_CORRUPT;
+        break;
+      }
+    }
+#ifdef HAVE_ZSTD
+    if (format_ == COMPRESSION_ZSTD) {
+      ZSTD_inBuffer in = {in_.data(), (size_t)in_len_, (size_t)in_offset_};
+      ZSTD_outBuffer outb = {block->data.data(), DECOMPRESSOR_BLOCK_SIZE,
+                             (size_t)out};
+      size_t res = ZSTD_decompressStream(
+          reinterpret_cast<ZSTD_DStream *>(decoder_), &outb, &in);
+      if (ZSTD_isError(res)) {
+        *error = DECOMPRESSOR_CORRUPT;
+        break;
+      }
+      in_offset_ = in.pos;
+      out = outb.pos;
+      // 0 once a frame is fully decoded (and flushed)
+      decoder_done_ = (res == 0);
+    }
+#endif
+  }
+  return out;
+}
+
+int Decompressor::LoadSeekTable(int fd) {
+  frames_.clear();
+#ifdef HAVE_ZSTD
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < ZSTD_SEEKABLE_FOOTER_SIZE || lseek(fd, 0, SEEK_CUR) != 0) {
+    return -1;
+  }
+  // footer: number of frames, descriptor, magic number
+  uint8_t footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+  if (pread(fd, footer, sizeof(footer),
+            st.st_size - ZSTD_SEEKABLE_FOOTER_SIZE) != sizeof(footer) ||
+      ReadLe32(footer + 5) != ZSTD_SEEKABLE_MAGIC) {
+    return -1;
+  }
+  int64_t num_frames = ReadLe32(footer);
+  int entry_size = (footer[4] & ZSTD_SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+  int64_t table_size = num_frames * entry_size;
+  if (table_size + ZSTD_SEEKABLE_FOOTER_SIZE > st.st_size) {
+    return -1;
+  }
+  std::vector<uint8_t> table(table_size);
+  if (pread(fd, table.data(), table_size,
+            st.st_size - ZSTD_SEEKABLE_FOOTER_SIZE - table_size) !=
+      table_size) {
+    return -1;
+  }
+  // entries: compressed size, decompressed size (, checksum)
+  int64_t compressed_offset = 0;
+  int64_t decompressed_offset = 0;
+  for (int64_t i = 0; i < num_frames; ++i) {
+    const uint8_t *entry = table.data() + i * entry_size;
+    frames_.push_back({compressed_offset, decompressed_offset});
+    compressed_offset += ReadLe32(entry);
+    decompressed_offset += ReadLe32(entry + 4);
+  }
+  // end of the last frame
+  frames_.push_back({compressed_offset, decompressed_offset});
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int64_t Decompressor::DecompressedSize() const {
+  return Seekable() ? frames_.back().decompressed_offset : -1;
+}
+
+int64_t Decompressor::SeekFrame(int64_t pos) {
+  if (!Seekable()) {
+    return -1;
+  }
+  // last frame starting at (or before) pos
+  auto iter = std::upper_bound(
+      frames_.begin(), frames_.end() - 1, pos,
+      [](int64_t p, const Frame &f) { return p < f.decompressed_offset; });
+  const Frame &frame = *(iter - 1);
+  Stop();
+  if (lseek(fd_, frame.compressed_offset, SEEK_SET) < 0 ||
+      Start(fd_, format_, NULL, 0) < 0) {
+    return -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    base_ = frame.decompressed_offset;
+  }
+  return frame.decompressed_offset;
+}
@@ -0,0 +1,163 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef DECOMPRESSOR_H_
+#define DECOMPRESSOR_H_
+
+#include <stdint.h>     // for uint8_t, int64_t
+#include <sys/types.h>  // for ssize_t
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DECOMPRESSOR_BLOCK_SIZE (1 << 20)
+#define DECOMPRESSOR_QUEUE_DEPTH 4
+#define DECOMPRESSOR_INPUT_SIZE (1 << 17)
+
+// number of bytes needed to detect the compression format
+#define COMPRESSION_MAGIC_SIZE 4
+
+typedef enum {
+  COMPRESSION_NONE = 0,
+  COMPRESSION_GZIP = 1,
+  // only available if built with zstd support (HAVE_ZSTD)
+  COMPRESSION_ZSTD = 2,
+} CompressionFormat;
+
+typedef enum {
+  DECOMPRESSOR_OK = 0,
+  // the input is not a valid gzip or zstd stream
+  DECOMPRESSOR_CORRUPT = 1,
+  // the input ends in the middle of a gzip member or zstd frame
+  DECOMPRESSOR_TRUNCATED = 2,
+  // the compressed input cannot be read
+  DECOMPRESSOR_READ_ERROR = 3,
+} DecompressorError;
+
+// A streaming decompressor (gzip or zstd) running on its own thread.
+//
+// The thread reads the compressed input, and decompresses it into a
+// bounded queue of DECOMPRESSOR_QUEUE_DEPTH blocks: it blocks when the
+// queue is full, and the consumer (Read()) blocks when it is empty.
+//
+// Errors are sticky: the bytes decoded before an error are returned
+// first, then Read() returns -1, and Error() tells what happened (and
+// ErrorOffset() where, in the decompressed stream).
+//
+// zstd files in the seekable format (independent frames, followed by a
+// seek table in a skippable frame) can be restarted at any frame.
+class Decompressor {
+ public:
+  Decompressor();
+  ~Decompressor();
+
+  // Returns the compression format of a stream starting with <buf>
+  static CompressionFormat Detect(const uint8_t *buf, int len);
+
+  // Returns the name of a compression format
+  static const char *FormatName(CompressionFormat format);
+
+  // Returns whether a compression format can be decompressed (zstd
+  // needs a build with zstd support)
+  static bool Supported(CompressionFormat format);
+
+  // Returns the compression format of the stream (see Start())
+  CompressionFormat Format() const { return format_; }
+
+  // Start decompressing <fd> (from its current position). <prefix> are
+  // compressed bytes already read from <fd> (e.g. to detect the
+  // format). Returns 0 if successful, -1 otherwise.
+  int Start(int fd, CompressionFormat format, const uint8_t *prefix,
+            int prefix_len);
+
+  // Stop the decompression thread
+  void Stop();
+
+  bool Running() const { return thread_.joinable(); }
+
+  // Copy up to <len> decompressed bytes into <buf>. Returns the number
+  // of bytes copied, 0 at the end of the stream, -1 on error.
+  ssize_t Read(uint8_t *buf, int len);
+
+  // Returns the error that ended the stream (DECOMPRESSOR_OK if none,
+  // or if the stream has not ended yet)
+  DecompressorError Error();
+
+  // Returns the decompressed offset of the error (i.e. the number of
+  // bytes decoded before it, from the start of the stream)
+  int64_t ErrorOffset();
+
+  // Returns the name of an error
+  static const char *ErrorName(DecompressorError error);
+
+  // Load the seek table of a seekable zstd file (must be called before
+  // Start()). Returns 0 if the file has one, -1 otherwise.
+  int LoadSeekTable(int fd);
+
+  // Returns whether the input can be restarted at any frame
+  bool Seekable() const { return frames_.size() > 1; }
+
+  // Returns the decompressed size (seekable inputs only, -1 otherwise)
+  int64_t DecompressedSize() const;
+
+  // Restart the decompression at the frame containing decompressed
+  // offset <pos>. Returns the decompressed offset of the frame, or -1.
+  int64_t SeekFrame(int64_t pos);
+
+ private:
+  struct Block {
+    std::vector<uint8_t> data;
+    int len;
+    // consumer read offset
+    int offset;
+  };
+
+  struct Frame {
+    int64_t compressed_offset;
+    int64_t decompressed_offset;
+  };
+
+  void Run();
+  // decompress into <block> until it is full (or the input ends).
+  // Returns the number of bytes (0 at the end of the stream), and sets
+  // <*error> if decoding stopped on an error (after those bytes).
+  int Decompress(Block *block, DecompressorError *error);
+  // read (more) compressed input
+  ssize_t ReadCompressed();
+
+  int InitDecoder();
+  void ReleaseDecoder();
+
+  int fd_;
+  CompressionFormat format_;
+  // compressed input buffer
+  std::vector<uint8_t> in_;
+  int in_offset_;
+  int in_len_;
+  bool in_eof_;
+  // decoder state (z_stream or ZSTD_DStream)
+  void *decoder_;
+  bool decoder_done_;
+
+  // block queue
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Block *> full_;
+  std::deque<Block *> free_;
+  std::vector<Block> blocks_;
+  bool quit_;
+  // set by the thread when the stream ends
+  bool done_;
+  DecompressorError error_;
+  // bytes decoded by the thread, and decompressed offset they start at
+  int64_t decoded_;
+  int64_t base_;
+
+  // seekable zstd: frame offsets (plus the end of the last frame)
+  std::vector<Frame> frames_;
+};
+
+#endif  // DECOMPRESSOR_H_
@@ -4,26 +4,42 @@
 
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>  // for splice
 #include <getopt.h>
+#include <glob.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/text_format.h>
 #include <inttypes.h>  // for PRId64
+#include <limits.h>    // for IOV_MAX
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>  // for fstat
 #include <sys/types.h>
-#include <unistd.h>
+#include <sys/uio.h>  // for writev
+#include <unistd.h>   // for copy_file_range
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "ac3_utils.h"
 #include "h264_utils.h"
 #include "mpeg2ts.pb.h"
+#include "mpeg2ts_headers.h"
+#include "mpeg2ts_packet_view.h"
 #include "mpeg2ts_parser.h"
 #include "mpeg2ts_reader.h"
+#include "mpeg2ts_sync.h"
+#include "pes_assembler.h"
+#include "pid_filter.h"
 #include "protobuf_utils.h"
 #include "pts_utils.h"
 
@@ -34,6 +50,9 @@ typedef enum {
   PROC_TOBIN = 2,
   PROC_TEST = 3,
   PROC_DUMP = 3,
+  PROC_COPY = 4,
+  PROC_SUMMARY = 5,
+  PROC_PES = 6,
 } ProcEnum;
 
 /* default values */
@@ -49,22 +68,126 @@ std::map<std::string, std::string> ACCESSOR_SHORTCUT_MAP = {
 std::list<std::string> ACCESSOR_EXTRA_LIST = {
     "type",
     "syncframe",
+    "file",
+    "file_index",
 };
 
+// dump fields that can be read from a Mpeg2TsPacketView (without
+// parsing the packet into a protobuf)
+std::list<std::string> ACCESSOR_VIEW_LIST = {
+    "packet",
+    "byte",
+    "copy_permission_indicator",
+    "arrival_timestamp",
+    "parsed.header.transport_error_indicator",
+    "parsed.header.payload_unit_start_indicator",
+    "parsed.header.transport_priority",
+    "parsed.header.pid",
+    "parsed.header.transport_scrambling_control",
+    "parsed.header.adaptation_field_exists",
+    "parsed.header.payload_exists",
+    "parsed.header.continuity_counter",
+    "parsed.adaptation_field.adaptation_field_length",
+    "parsed.adaptation_field.discontinuity_indicator",
+    "parsed.adaptation_field.random_access_indicator",
+    "parsed.adaptation_field.pcr.base",
+    "parsed.adaptation_field.pcr.extension",
+    "parsed.pes_packet.stream_id",
+    "parsed.pes_packet.pes_packet_length",
+    "parsed.pes_packet.pts",
+    "parsed.pes_packet.dts",
+    "type",
+    "syncframe",
+    "file",
+    "file_index",
+};
+
+// summary proc: per-PID statistics
+typedef struct pid_summary_t {
+  int64_t packets;
+  // "PAT", "PMT", "video", "audio", etc.
+  const char *type;
+  // stream type (from the PMT), or -1
+  int stream_type;
+  int64_t first_pts;
+  int64_t last_pts;
+} pid_summary_t;
+
+typedef struct summary_t {
+  std::map<int, pid_summary_t> pids;
+  int64_t packets;
+  int64_t bytes;
+  // bytes in non-parseable chunks
+  int64_t unsynced_bytes;
+  int64_t first_pts;
+  int64_t last_pts;
+  // sampling windows read (0 if not sampled)
+  int64_t windows;
+} summary_t;
+
+// the last PMT packet of a PID: the program_number, version_number and
+// CRC_32 of its sections, its raw bytes (see mpegts_pmt_bytes()), and
+// the audio PIDs it gives
+typedef struct pmt_cache_t {
+  std::vector<int64_t> key;
+  std::string bytes;
+  std::list<int> audio_pid_l;
+} pmt_cache_t;
+
 typedef struct status_t {
   int sync_gap;
+  ReaderMode reader_mode;
+  int packet_size;
+  // packet range (-1 if unset)
+  int64_t start_byte;
+  int64_t end_byte;
+  int64_t start_packet;
+  int64_t end_packet;
+  int64_t start_pts;
+  int64_t end_pts;
   ProcEnum proc;
   int debug;
   int ignore_pts_delta;
   int allow_raw_packets;
+  int follow;
+  // number of threads (parallel shards)
+  int jobs;
+  // sampling: read <sample_packets> packets every <sample_stride>
+  // bytes (0 to read everything)
+  int64_t sample_packets;
+  int64_t sample_stride;
+  // whether the packet indices are estimated (after a sampling seek),
+  // in which case they are marked as such in the output
+  bool pi_estimated;
   int64_t pts_delta;
   int64_t pts_delta_audio;
   int64_t pts_delta_video;
   std::list<int> video_pid_l;
   std::list<int> audio_pid_l;
   std::list<std::string> dump_fields;
+  // how deep the packets are parsed (a Mpeg2TsPacket::ParseDepth, or 0
+  // to pick it from the proc and the dump fields)
+  int parse_depth;
+  // what is kept of the payloads (a Mpeg2TsPacket::PayloadMode, or 0 to
+  // pick it from the proc and the dump fields)
+  int payload_mode;
+  // whether the packets can be processed using a Mpeg2TsPacketView
+  // (the protobuf is only needed for the packets it does not support)
+  bool use_view;
+  // whether the dump fields need the PMT state (video and audio PIDs)
+  bool need_pmt;
+  // PMTs seen, per PID (repeated PMTs do not change the PIDs)
+  std::map<int, pmt_cache_t> pmt_cache;
+  // PIDs processed (--pids)
+  PidFilter pid_filter;
+  // PES packets in progress (pes proc)
+  PesAssembler pes_assembler;
+  summary_t summary;
   char *infile;
   char *outfile;
+  // binary inputs (read one after another), and current one
+  std::vector<std::string> infile_l;
+  int infile_index;
   // args-only
   int nrem;
   char **rem;
@@ -75,12 +198,54 @@ extern int optind, opterr, optopt;
 
 void usage(char *name) {
   fprintf(stderr,
-          "usage: %s [options] -p <proc> -i [infile.ts] -o [outfile.ts]\n",
+          "usage: %s [options] -p <proc> -i [infile.ts] -o [outfile.ts] "
+          "[infile.ts ...]\n",
           name);
   fprintf(stderr, "where options are:\n");
   fprintf(stderr, "\t-s <sync_gap>:\t\tMaximum sync gap (%i)\n",
           DEFAULT_MAXIMUM_SYNC_GAP);
   fprintf(stderr, "\t--no-raw:\t\tPunt on raw packets\n");
+  fprintf(stderr,
+          "\t-i <infile>:\t\tInput file (can be repeated, or a glob "
+          "pattern)\n");
+  fprintf(stderr,
+          "\t--input-list <file>:\t\tFile with a list of input files (one "
+          "per line)\n");
+  fprintf(stderr, "\t--reader <mode>:\t\tInput mode (auto, stream, mmap, "
+                  "async, async-threads, direct, prefetch)\n");
+  fprintf(stderr, "\t--direct-io:\t\t\tSame as --reader direct\n");
+  fprintf(stderr,
+          "\t--follow:\t\t\tWait for more data at the end of the input "
+          "file (tail -f)\n");
+  fprintf(stderr,
+          "\t--input-packet-size <size>:\t\tPacket size (188, 192, 204, or 0 "
+          "for auto-detect)\n");
+  fprintf(stderr,
+          "\t--start-byte <bi>, --end-byte <bi>:\tOnly process the packets "
+          "in [start, end) (byte index)\n");
+  fprintf(stderr,
+          "\t--start-packet <pi>, --end-packet <pi>:\tOnly process the "
+          "packets in [start, end) (packet index)\n");
+  fprintf(stderr,
+          "\t--start-pts <pts>, --end-pts <pts>:\tOnly process the packets "
+          "in [start, end) (PTS)\n");
+  fprintf(stderr,
+          "\t--sample <packets>[,<stride>]:\tOnly read <packets> packets "
+          "every <stride> bytes (%i)\n",
+          DEFAULT_SAMPLE_STRIDE);
+  fprintf(stderr,
+          "\t-j <jobs>, --jobs <jobs>:\tProcess a single input file in "
+          "<jobs> parallel shards\n");
+  fprintf(stderr,
+          "\t--pids <pid|program:<n>>[,...]:\tOnly process these PIDs, or "
+          "the PIDs of these programs (\"-\" excludes them)\n");
+  fprintf(stderr,
+          "\t--parse-depth <depth>:\tParse the packets up to header, "
+          "adaptation, pes, or full (default: as needed by the dump "
+          "fields)\n");
+  fprintf(stderr,
+          "\t--payload <mode>:\tKeep none, the length, the hash, or the full "
+          "payload (default: as needed by the dump fields)\n");
   fprintf(stderr, "\t--ignore-pts-delta:\t\tIgnore pts delta values\n");
   fprintf(stderr, "\t-d:\t\tIncrease debug verbosity\n");
   fprintf(stderr, "\t-q:\t\tQuiet mode (zero debug verbosity)\n");
@@ -99,6 +264,15 @@ void usage(char *name) {
   }
   fprintf(stderr, "\n");
   fprintf(stderr, "\ttest: test a binary file (binary->protobuf->binary)\n");
+  fprintf(stderr,
+          "\tcopy: copy the packets in the range (binary->binary)\n");
+  fprintf(stderr, "\t\t--keep-pid <pid>[,<pid>...]: same as --pids\n");
+  fprintf(stderr,
+          "\tsummary: print the PIDs, stream types, bitrate, and PTS "
+          "range\n");
+  fprintf(stderr,
+          "\tpes: print the PES packets (PTS/DTS, length, frame type, and "
+          "syncframe)\n");
   fprintf(stderr, "\thelp: this usage\n");
 }
 
@@ -113,10 +287,107 @@ ProcEnum GetProc(char *cmd) {
     return PROC_TEST;
   else if (strcmp(cmd, "dump") == 0)
     return PROC_DUMP;
+  else if (strcmp(cmd, "copy") == 0)
+    return PROC_COPY;
+  else if (strcmp(cmd, "summary") == 0)
+    return PROC_SUMMARY;
+  else if (strcmp(cmd, "pes") == 0)
+    return PROC_PES;
   else
     return PROC_INVALID;
 }
 
+// Returns a Mpeg2TsPacket::ParseDepth, or -1
+int GetParseDepth(char *depth) {
+  if (strcmp(depth, "header") == 0)
+    return Mpeg2TsPacket::PARSE_DEPTH_HEADER;
+  else if (strcmp(depth, "adaptation") == 0)
+    return Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD;
+  else if (strcmp(depth, "pes") == 0)
+    return Mpeg2TsPacket::PARSE_DEPTH_PES;
+  else if (strcmp(depth, "full") == 0)
+    return Mpeg2TsPacket::PARSE_DEPTH_FULL;
+  else
+    return -1;
+}
+
+// Returns a Mpeg2TsPacket::PayloadMode, or -1
+int GetPayloadMode(char *mode) {
+  if (strcmp(mode, "none") == 0)
+    return Mpeg2TsPacket::PAYLOAD_NONE;
+  else if (strcmp(mode, "length") == 0)
+    return Mpeg2TsPacket::PAYLOAD_LENGTH;
+  else if (strcmp(mode, "hash") == 0)
+    return Mpeg2TsPacket::PAYLOAD_HASH;
+  else if (strcmp(mode, "full") == 0)
+    return Mpeg2TsPacket::PAYLOAD_FULL;
+  else
+    return -1;
+}
+
+ReaderMode GetReaderMode(char *mode) {
+  if (strcmp(mode, "auto") == 0)
+    return READER_MODE_AUTO;
+  else if (strcmp(mode, "stream") == 0)
+    return READER_MODE_STREAM;
+  else if (strcmp(mode, "mmap") == 0)
+    return READER_MODE_MMAP;
+  else if (strcmp(mode, "async") == 0)
+    return READER_MODE_ASYNC;
+  else if (strcmp(mode, "async-threads") == 0)
+    return READER_MODE_ASYNC_THREADS;
+  else if (strcmp(mode, "direct") == 0)
+    return READER_MODE_DIRECT;
+  else if (strcmp(mode, "prefetch") == 0)
+    return READER_MODE_PREFETCH;
+  else
+    return READER_MODE_INVALID;
+}
+
+// Add an input file, expanding glob patterns
+int AddInput(const char *infile, status_t *status) {
+  if (strpbrk(infile, "*?[") == NULL) {
+    status->infile_l.push_back(infile);
+    return 0;
+  }
+  glob_t globbuf;
+  if (glob(infile, 0, NULL, &globbuf) != 0) {
+    fprintf(stderr, "error: no input file matches \"%s\"\n", infile);
+    return -1;
+  }
+  for (size_t i = 0; i < globbuf.gl_pathc; ++i) {
+    status->infile_l.push_back(globbuf.gl_pathv[i]);
+  }
+  globfree(&globbuf);
+  return 0;
+}
+
+// Add the input files listed in a file (one per line)
+int AddInputList(const char *listfile, status_t *status) {
+  FILE *fin = fopen(listfile, "r");
+  if (fin == NULL) {
+    fprintf(stderr, "error: cannot open input list: %s\n", listfile);
+    return -1;
+  }
+  char *line = NULL;
+  size_t blen = 0;
+  ssize_t slen;
+  while ((slen = getline(&line, &blen, fin)) != -1) {
+    // remove trailing whitespace, and skip empty lines
+    while (slen > 0 && isspace(line[slen - 1])) {
+      line[--slen] = '\0';
+    }
+    if (slen > 0 && AddInput(line, status) < 0) {
+      free(line);
+      fclose(fin);
+      return -1;
+    }
+  }
+  free(line);
+  fclose(fin);
+  return 0;
+}
+
 status_t *parse_args(int argc, char **argv) {
   int arg;
   int optindex = 0;
@@ -125,33 +396,81 @@ status_t *parse_args(int argc, char **argv) {
 
   // default status values
   status.sync_gap = DEFAULT_MAXIMUM_SYNC_GAP;
+  status.reader_mode = READER_MODE_AUTO;
+  status.packet_size = 0;
   status.proc = PROC_INVALID;
   status.infile = NULL;
+  status.infile_l.clear();
+  status.infile_index = 0;
   status.outfile = NULL;
   status.debug = DEFAULT_DEBUG;
   status.ignore_pts_delta = 0;
   status.allow_raw_packets = 1;
+  status.follow = 0;
+  status.jobs = 1;
+  status.sample_packets = 0;
+  status.sample_stride = DEFAULT_SAMPLE_STRIDE;
+  status.pi_estimated = false;
   status.pts_delta = 0;
+  status.start_byte = -1;
+  status.end_byte = -1;
+  status.start_packet = -1;
+  status.end_packet = -1;
+  status.start_pts = -1;
+  status.end_pts = -1;
   status.pts_delta_video = 0;
   status.pts_delta_audio = 0;
   status.dump_fields.clear();
+  status.parse_depth = 0;
+  status.payload_mode = 0;
+  status.need_pmt = false;
+  status.pid_filter = PidFilter();
+  status.pes_assembler = PesAssembler();
+  status.use_view = false;
+  status.summary.pids.clear();
+  status.summary.packets = 0;
+  status.summary.bytes = 0;
+  status.summary.unsynced_bytes = 0;
+  status.summary.first_pts = -1;
+  status.summary.last_pts = -1;
+  status.summary.windows = 0;
 
   struct option longopts[] = {
       // options with no argument
       {"debug", no_argument, NULL, 'd'},
       {"ignore-pts-delta", no_argument, &status.ignore_pts_delta, 1},
       {"no-raw", no_argument, &status.allow_raw_packets, 0},
+      {"follow", no_argument, &status.follow, 1},
       // matching options to short options
       {"sync-gap", required_argument, NULL, 's'},
       {"proc", required_argument, NULL, 'p'},
       {"infile", required_argument, NULL, 'i'},
       {"outfile", required_argument, NULL, 'o'},
+      {"reader", required_argument, NULL, 'r'},
+      {"direct-io", no_argument, NULL, 'D'},
+      {"input-packet-size", required_argument, NULL, 'S'},
+      {"input-list", required_argument, NULL, 'L'},
+      {"start-byte", required_argument, NULL, 'b'},
+      {"end-byte", required_argument, NULL, 'B'},
+      {"start-packet", required_argument, NULL, 'k'},
+      {"end-packet", required_argument, NULL, 'K'},
+      {"start-pts", required_argument, NULL, 't'},
+      {"end-pts", required_argument, NULL, 'T'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"keep-pid", required_argument, NULL, 'P'},
+      {"pids", required_argument, NULL, 'P'},
+      // the "pid" dump field (otherwise taken as an abbreviation of
+      // "--pids")
+      {"pid", no_argument, NULL, 'I'},
+      {"sample", required_argument, NULL, 'm'},
+      {"parse-depth", required_argument, NULL, 'E'},
+      {"payload", required_argument, NULL, 'Y'},
       {"help", no_argument, NULL, 'h'},
       {"quiet", no_argument, NULL, 'q'},
       {NULL, 0, NULL, 0},
   };
 
-  while ((arg = getopt_long(argc, argv, ":dqs:p:i:o:", longopts, &optindex)) !=
+  while ((arg = getopt_long(argc, argv, ":dqs:p:i:o:j:", longopts, &optindex)) !=
          -1) {
     switch (arg) {
       case 0:  // long options
@@ -186,9 +505,135 @@ status_t *parse_args(int argc, char **argv) {
         }
         break;
 
+      case 'r':
+        /* reader mode */
+        status.reader_mode = GetReaderMode(optarg);
+        if (status.reader_mode == READER_MODE_INVALID) {
+          fprintf(stderr, "error: invalid reader mode: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'D':
+        /* direct reader */
+        status.reader_mode = READER_MODE_DIRECT;
+        break;
+
+      case 'b':
+      case 'B':
+      case 'k':
+      case 'K':
+      case 't':
+      case 'T': {
+        /* packet range */
+        int64_t value = strtoll(optarg, &endptr, 0);
+        if (*endptr != '\0' || value < 0) {
+          fprintf(stderr, "error: invalid range bound: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        if (arg == 'b')
+          status.start_byte = value;
+        else if (arg == 'B')
+          status.end_byte = value;
+        else if (arg == 'k')
+          status.start_packet = value;
+        else if (arg == 'K')
+          status.end_packet = value;
+        else if (arg == 't')
+          status.start_pts = value;
+        else
+          status.end_pts = value;
+        break;
+      }
+
+      case 'j':
+        /* parallel jobs */
+        status.jobs = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || status.jobs < 1) {
+          fprintf(stderr, "error: invalid number of jobs: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'P':
+        /* PID filter */
+        if (status.pid_filter.AddSpec(optarg) < 0) {
+          fprintf(stderr, "error: invalid pid: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'm':
+        /* sampling: <packets>[,<stride>] */
+        status.sample_packets = strtoll(optarg, &endptr, 0);
+        if (*endptr == ',') {
+          status.sample_stride = strtoll(endptr + 1, &endptr, 0);
+        }
+        if (*endptr != '\0' || status.sample_packets <= 0 ||
+            status.sample_stride <= 0) {
+          fprintf(stderr, "error: invalid sampling: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'I':
+        /* pid dump field */
+        status.dump_fields.push_back(ACCESSOR_SHORTCUT_MAP["pid"]);
+        break;
+
+      case 'E':
+        /* parse depth */
+        status.parse_depth = GetParseDepth(optarg);
+        if (status.parse_depth < 0) {
+          fprintf(stderr, "error: invalid parse depth: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'Y':
+        /* payload mode */
+        status.payload_mode = GetPayloadMode(optarg);
+        if (status.payload_mode < 0) {
+          fprintf(stderr, "error: invalid payload mode: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
+      case 'S':
+        /* packet size */
+        status.packet_size = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || (status.packet_size != 0 &&
+                                 status.packet_size != MPEG_TS_PACKET_SIZE &&
+                                 status.packet_size != M2TS_PACKET_SIZE &&
+                                 status.packet_size != FEC_PACKET_SIZE)) {
+          fprintf(stderr, "error: invalid packet size: \"%s\"\n", optarg);
+          usage(argv[0]);
+          exit(-1);
+        }
+        break;
+
       case 'i':
         /* infile */
-        status.infile = optarg;
+        if (status.infile == NULL) {
+          status.infile = optarg;
+        }
+        if (AddInput(optarg, &status) < 0) {
+          exit(-1);
+        }
+        break;
+
+      case 'L':
+        /* input list */
+        if (AddInputList(optarg, &status) < 0) {
+          exit(-1);
+        }
         break;
 
       case 'o':
@@ -245,6 +690,16 @@ status_t *parse_args(int argc, char **argv) {
   status.nrem = argc - optind;
   status.rem = argv + optind;
 
+  /* remaining arguments are more input files */
+  for (int i = 0; i < status.nrem; ++i) {
+    if (AddInput(status.rem[i], &status) < 0) {
+      exit(-1);
+    }
+  }
+  if (status.infile == NULL && !status.infile_l.empty()) {
+    status.infile = const_cast<char *>(status.infile_l[0].c_str());
+  }
+
   return &status;
 }
 
@@ -301,64 +756,99 @@ int CheckTestResults(const uint8_t *inbuf, const int inlen,
   return res;
 }
 
-void DumpLine(const Mpeg2Ts &mpeg2ts, status_t *status, FILE *fout) {
+// Returns the "type" dump field of a packet: the frame type of video
+// packets, and the audio stream of audio PES packet starts
+char mpegts_packet_type(int pid, bool has_pts, const uint8_t *data, int len,
+                        status_t *status) {
+  char stype = ' ';
+  if (std::find(status->video_pid_l.begin(), status->video_pid_l.end(), pid) !=
+      status->video_pid_l.end()) {
+    // video
+    int frame_type = -1;
+    if (len > 0) {
+      frame_type = h264_frame_type(data, len);
+      stype = (frame_type == 1)
+                  ? 'I'
+                  : ((frame_type == 2)
+                         ? 'P'
+                         : ((frame_type == 3)
+                                ? 'B'
+                                : ((frame_type == 4) ? 'V' : 'X')));
+    }
+  } else if (std::find(status->audio_pid_l.begin(), status->audio_pid_l.end(),
+                       pid) != status->audio_pid_l.end()) {
+    if (has_pts) {
+      auto iter =
+          std::find(status->audio_pid_l.begin(), status->audio_pid_l.end(), pid);
+      int position = distance(status->audio_pid_l.begin(), iter);
+      stype = '1' + position;
+    }
+  }
+  return stype;
+}
+
+// Returns the "syncframe" dump field of a packet (the distance to the
+// first AC-3 syncframe in audio packets), or -1
+int mpegts_packet_syncframe(int pid, const uint8_t *data, int len,
+                            status_t *status) {
+  if (len > 0 &&
+      std::find(status->audio_pid_l.begin(), status->audio_pid_l.end(), pid) !=
+          status->audio_pid_l.end()) {
+    // audio
+    return ac3_syncframe_distance(data, len);
+  }
+  return -1;
+}
+
+// Print the dump fields of a packet (parsed from <packet_len> bytes at
+// <packet>)
+void DumpLine(const Mpeg2Ts &mpeg2ts, const uint8_t *packet, int packet_len,
+              status_t *status, FILE *fout) {
   char buf[1024] = {0};
   int bi = 0;
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(
+      mpeg2ts.parsed().data_bytes().c_str());
+  int len = mpeg2ts.parsed().data_bytes().length();
+  if (mpeg2ts.parsed().has_payload_length() &&
+      !mpeg2ts.parsed().has_parse_depth()) {
+    // elided data bytes: they are the end of the original packet
+    int ts_end = packet_len - (mpeg2ts.has_fec_trailer() ? FEC_TRAILER_SIZE : 0);
+    len = mpeg2ts.parsed().payload_length();
+    data = packet + ts_end - len;
+  }
   for (auto &s : status->dump_fields) {
     // implement the extra accessors
     if (s == "type") {
       char stype = ' ';
       if (mpeg2ts.parsed().header().has_pid()) {
-        int pid = mpeg2ts.parsed().header().pid();
-        if (std::find(status->video_pid_l.begin(), status->video_pid_l.end(),
-                      pid) != status->video_pid_l.end()) {
-          // video
-          int frame_type = -1;
-          if (mpeg2ts.parsed().has_data_bytes()) {
-            const uint8_t *data = reinterpret_cast<const uint8_t *>(
-                mpeg2ts.parsed().data_bytes().c_str());
-            int len = mpeg2ts.parsed().data_bytes().length();
-            frame_type = h264_frame_type(data, len);
-            stype = (frame_type == 1)
-                        ? 'I'
-                        : ((frame_type == 2)
-                               ? 'P'
-                               : ((frame_type == 3)
-                                      ? 'B'
-                                      : ((frame_type == 4) ? 'V' : 'X')));
-          }
-        } else if (std::find(status->audio_pid_l.begin(),
-                             status->audio_pid_l.end(),
-                             pid) != status->audio_pid_l.end()) {
-          if (mpeg2ts.parsed().pes_packet().has_pts()) {
-            auto iter = std::find(status->audio_pid_l.begin(),
-                                  status->audio_pid_l.end(), pid);
-            int position = distance(status->audio_pid_l.begin(), iter);
-            stype = '1' + position;
-          }
-        }
+        stype = mpegts_packet_type(mpeg2ts.parsed().header().pid(),
+                                   mpeg2ts.parsed().pes_packet().has_pts(),
+                                   data, len, status);
       }
       bi += snprintf(buf + bi, sizeof(buf) - bi, "%c,", stype);
     } else if (s == "syncframe") {
       int syncframe_distance = -1;
       if (mpeg2ts.parsed().header().has_pid()) {
-        int pid = mpeg2ts.parsed().header().pid();
-        if (std::find(status->audio_pid_l.begin(), status->audio_pid_l.end(),
-                      pid) != status->audio_pid_l.end()) {
-          // audio
-          if (mpeg2ts.parsed().has_data_bytes()) {
-            const uint8_t *data = reinterpret_cast<const uint8_t *>(
-                mpeg2ts.parsed().data_bytes().c_str());
-            int len = mpeg2ts.parsed().data_bytes().length();
-            syncframe_distance = ac3_syncframe_distance(data, len);
-          }
-        }
+        syncframe_distance = mpegts_packet_syncframe(
+            mpeg2ts.parsed().header().pid(), data, len, status);
       }
       if (syncframe_distance != -1) {
         bi += snprintf(buf + bi, sizeof(buf) - bi, "%i,", syncframe_distance);
       } else {
         bi += snprintf(buf + bi, sizeof(buf) - bi, ",");
       }
+    } else if (s == "file") {
+      const char *infile =
+          status->infile_l.empty()
+              ? "stdin"
+              : status->infile_l[status->infile_index].c_str();
+      bi += snprintf(buf + bi, sizeof(buf) - bi, "%s,", infile);
+    } else if (s == "file_index") {
+      bi += snprintf(buf + bi, sizeof(buf) - bi, "%i,", status->infile_index);
+    } else if (s == "packet" && status->pi_estimated) {
+      // estimated packet index (see status_t)
+      bi += snprintf(buf + bi, sizeof(buf) - bi, "~%" PRId64 ",",
+                     mpeg2ts.packet());
     } else {
       // known protobuf field
       std::string value;
@@ -376,6 +866,155 @@ void DumpLine(const Mpeg2Ts &mpeg2ts, status_t *status, FILE *fout) {
   return;
 }
 
+// Returns the value of a dump field from a Mpeg2TsPacketView (which
+// must be supported), or false if the packet has no such field
+bool GetViewField(Mpeg2TsPacketView *view, int64_t pi, int64_t bi,
+                  const std::string &s, int64_t *value) {
+  if (s == "packet") {
+    *value = pi;
+  } else if (s == "byte") {
+    *value = bi;
+  } else if (s == "copy_permission_indicator") {
+    *value = view->CopyPermissionIndicator();
+    return view->HasTpExtraHeader();
+  } else if (s == "arrival_timestamp") {
+    *value = view->ArrivalTimestamp();
+    return view->HasTpExtraHeader();
+  } else if (s == "parsed.header.transport_error_indicator") {
+    *value = view->TransportErrorIndicator();
+  } else if (s == "parsed.header.payload_unit_start_indicator") {
+    *value = view->PayloadUnitStartIndicator();
+  } else if (s == "parsed.header.transport_priority") {
+    *value = view->TransportPriority();
+  } else if (s == "parsed.header.pid") {
+    *value = view->Pid();
+  } else if (s == "parsed.header.transport_scrambling_control") {
+    *value = view->TransportScramblingControl();
+  } else if (s == "parsed.header.adaptation_field_exists") {
+    *value = view->AdaptationFieldExists();
+  } else if (s == "parsed.header.payload_exists") {
+    *value = view->PayloadExists();
+  } else if (s == "parsed.header.continuity_counter") {
+    *value = view->ContinuityCounter();
+  } else if (s == "parsed.adaptation_field.adaptation_field_length") {
+    *value = view->AdaptationFieldLength();
+    return view->AdaptationFieldExists();
+  } else if (s == "parsed.adaptation_field.discontinuity_indicator") {
+    *value = view->DiscontinuityIndicator();
+    return view->HasAdaptationFieldFlags();
+  } else if (s == "parsed.adaptation_field.random_access_indicator") {
+    *value = view->RandomAccessIndicator();
+    return view->HasAdaptationFieldFlags();
+  } else if (s == "parsed.adaptation_field.pcr.base") {
+    *value = view->PcrBase();
+    return view->HasPcr();
+  } else if (s == "parsed.adaptation_field.pcr.extension") {
+    *value = view->PcrExtension();
+    return view->HasPcr();
+  } else if (s == "parsed.pes_packet.stream_id") {
+    *value = view->StreamId();
+    return view->IsPes();
+  } else if (s == "parsed.pes_packet.pes_packet_length") {
+    *value = view->PesPacketLength();
+    return view->IsPes();
+  } else if (s == "parsed.pes_packet.pts") {
+    *value = view->Pts();
+    return view->HasPts();
+  } else if (s == "parsed.pes_packet.dts") {
+    *value = view->Dts();
+    return view->HasDts();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Same as DumpLine(), but reading the packet from a (supported)
+// Mpeg2TsPacketView
+void DumpViewLine(Mpeg2TsPacketView *view, int64_t pi, int64_t bi,
+                  status_t *status, FILE *fout) {
+  char buf[1024] = {0};
+  int oi = 0;
+  const uint8_t *data = NULL;
+  int len = view->DataBytes(&data);
+  for (auto &s : status->dump_fields) {
+    int64_t value;
+    if (s == "type") {
+      char stype =
+          mpegts_packet_type(view->Pid(), view->HasPts(), data, len, status);
+      oi += snprintf(buf + oi, sizeof(buf) - oi, "%c,", stype);
+    } else if (s == "syncframe") {
+      int syncframe_distance =
+          mpegts_packet_syncframe(view->Pid(), data, len, status);
+      if (syncframe_distance != -1) {
+        oi += snprintf(buf + oi, sizeof(buf) - oi, "%i,", syncframe_distance);
+      } else {
+        oi += snprintf(buf + oi, sizeof(buf) - oi, ",");
+      }
+    } else if (s == "file") {
+      const char *infile =
+          status->infile_l.empty()
+              ? "stdin"
+              : status->infile_l[status->infile_index].c_str();
+      oi += snprintf(buf + oi, sizeof(buf) - oi, "%s,", infile);
+    } else if (s == "file_index") {
+      oi += snprintf(buf + oi, sizeof(buf) - oi, "%i,", status->infile_index);
+    } else if (s == "packet" && status->pi_estimated) {
+      // estimated packet index (see status_t)
+      oi += snprintf(buf + oi, sizeof(buf) - oi, "~%" PRId64 ",", pi);
+    } else if (GetViewField(view, pi, bi, s, &value)) {
+      oi += snprintf(buf + oi, sizeof(buf) - oi, "%" PRId64 ",", value);
+    } else {
+      oi += snprintf(buf + oi, sizeof(buf) - oi, ",");
+    }
+  }
+
+  // remove last comma
+  buf[oi - 1] = '\0';
+  fprintf(fout, "%s\n", buf);
+}
+
+// pes proc
+
+#define PES_LINE_HEADER "packet,byte,pid,stream_id,pts,dts,length,type,syncframe"
+
+// Print a PES packet. The frame type and syncframe are analyzed once on
+// the whole PES packet (instead of on the data bytes of each of its
+// packets), so they see what straddles packets.
+void PesLine(const PesUnit &unit, status_t *status, FILE *fout) {
+  char buf[1024] = {0};
+  int oi = 0;
+  oi += snprintf(buf + oi, sizeof(buf) - oi, "%s%" PRId64 ",%" PRId64 ",%i,%i,",
+                 status->pi_estimated ? "~" : "", unit.pi, unit.bi, unit.pid,
+                 unit.stream_id);
+  if (unit.pts >= 0) {
+    oi += snprintf(buf + oi, sizeof(buf) - oi, "%" PRId64, unit.pts);
+  }
+  oi += snprintf(buf + oi, sizeof(buf) - oi, ",");
+  if (unit.dts >= 0) {
+    oi += snprintf(buf + oi, sizeof(buf) - oi, "%" PRId64, unit.dts);
+  }
+  char stype = mpegts_packet_type(unit.pid, unit.pts >= 0, unit.data,
+                                  unit.data_len, status);
+  oi += snprintf(buf + oi, sizeof(buf) - oi, ",%i,%c,", unit.len, stype);
+  int syncframe_distance =
+      mpegts_packet_syncframe(unit.pid, unit.data, unit.data_len, status);
+  if (syncframe_distance != -1) {
+    oi += snprintf(buf + oi, sizeof(buf) - oi, "%i", syncframe_distance);
+  }
+  fprintf(fout, "%s\n", buf);
+}
+
+// Print the PES packets still in progress (end of an input), and forget
+// them
+void mpegts_pes_flush(status_t *status, FILE *fout) {
+  PesUnit unit;
+  while (status->pes_assembler.Flush(&unit)) {
+    PesLine(unit, status, fout);
+  }
+  status->pes_assembler.Reset();
+}
+
 std::list<int> MPEGTS_VIDEO_STREAM_TYPE = {
     // ISO/IEC 11172 Video
     0x01,
@@ -402,11 +1041,75 @@ std::list<int> MPEGTS_AUDIO_STREAM_TYPE = {
     0x81,
 };
 
-void mpegts_process_packet(const Mpeg2Ts &mpeg2ts, status_t *status) {
+// Add <pid> to <pid_l> (unless it is already there)
+void mpegts_add_pid(int pid, std::list<int> *pid_l) {
+  if (std::find(pid_l->begin(), pid_l->end(), pid) == pid_l->end()) {
+    pid_l->push_back(pid);
+  }
+}
+
+// Get the bytes that identify a (synced) <len>-byte PMT packet: the
+// header flags (but the continuity counter), and the rest of the packet.
+// Returns its PID, or -1 if it is too short.
+int mpegts_pmt_bytes(const uint8_t *buf, int len, std::string *bytes) {
+  int sync_offset = Mpeg2TsParser::SyncOffset(len);
+  if (len < sync_offset + 4) {
+    return -1;
+  }
+  const uint8_t *ts = buf + sync_offset;
+  bytes->assign(1, (char)(ts[3] & 0xf0));
+  bytes->append((const char *)ts + 4, len - sync_offset - 4);
+  return ((ts[1] & 0x1f) << 8) | ts[2];
+}
+
+// Check a (synced) packet with payload_unit_start_indicator against the
+// last PMT packet of its PID, before parsing it: a packet repeating it
+// byte for byte gives the same PIDs (see mpegts_process_packet()), so
+// it only sets the audio PIDs again. Returns whether the packet was such
+// a repeat.
+bool mpegts_pmt_repeated(const uint8_t *buf, int len, status_t *status) {
+  int sync_offset = Mpeg2TsParser::SyncOffset(len);
+  if (len < sync_offset + 4) {
+    return false;
+  }
+  const uint8_t *ts = buf + sync_offset;
+  auto iter = status->pmt_cache.find(((ts[1] & 0x1f) << 8) | ts[2]);
+  if (iter == status->pmt_cache.end()) {
+    return false;
+  }
+  // (same layout as mpegts_pmt_bytes())
+  const std::string &bytes = iter->second.bytes;
+  int rest = len - sync_offset - 4;
+  if ((int)bytes.size() != 1 + rest || bytes[0] != (char)(ts[3] & 0xf0) ||
+      memcmp(bytes.data() + 1, ts + 4, rest) != 0) {
+    return false;
+  }
+  status->audio_pid_l = iter->second.audio_pid_l;
+  return true;
+}
+
+// Update the video and audio PIDs from a PMT packet (parsed from the
+// <len> bytes at <buf>)
+void mpegts_process_packet(const Mpeg2Ts &mpeg2ts, const uint8_t *buf,
+                           int len, status_t *status) {
   // look for PMT packets
   if (mpeg2ts.parsed().psi_packet().program_map_section_size() == 0) {
     return;
   }
+  // a PMT repeated on its PID (same sections, versions, and CRCs) adds no
+  // video PID, and gives the same audio PIDs
+  std::vector<int64_t> key;
+  for (auto &pms : mpeg2ts.parsed().psi_packet().program_map_section()) {
+    key.push_back(pms.program_number());
+    key.push_back(pms.version_number());
+    key.push_back((uint32_t)pms.crc_32());
+  }
+  pmt_cache_t &pmt_cache = status->pmt_cache[mpeg2ts.parsed().header().pid()];
+  mpegts_pmt_bytes(buf, len, &pmt_cache.bytes);
+  if (pmt_cache.key == key) {
+    status->audio_pid_l = pmt_cache.audio_pid_l;
+    return;
+  }
   status->audio_pid_l.clear();
   for (int i = 0; i < mpeg2ts.parsed().psi_packet().program_map_section_size();
        ++i) {
@@ -419,7 +1122,8 @@ void mpegts_process_packet(const Mpeg2Ts &mpeg2ts, status_t *status) {
                     MPEGTS_VIDEO_STREAM_TYPE.end(),
                     stream_description.stream_type()) !=
           MPEGTS_VIDEO_STREAM_TYPE.end()) {
-        status->video_pid_l.push_back(stream_description.elementary_pid());
+        mpegts_add_pid(stream_description.elementary_pid(),
+                       &status->video_pid_l);
       } else if (std::find(MPEGTS_AUDIO_STREAM_TYPE.begin(),
                            MPEGTS_AUDIO_STREAM_TYPE.end(),
                            stream_description.stream_type()) !=
@@ -428,78 +1132,1459 @@ void mpegts_process_packet(const Mpeg2Ts &mpeg2ts, status_t *status) {
       }
     }
   }
+  pmt_cache.key = key;
+  pmt_cache.audio_pid_l = status->audio_pid_l;
 }
 
-int mpegts_read_binary(status_t *status) {
-  FILE *fin = stdin;
-  if (status->infile != NULL && (strcmp(status->infile, "-") != 0)) {
-    /* open infile */
-    fin = fopen(status->infile, "r");
-    if (fin == NULL) {
-      fprintf(stderr, "error: cannot open infile: %s\n", status->infile);
-      return -1;
+// Returns the PTS of a packet (or, if allow_pcr is set and there is no
+// PTS, its PCR base), or -1 if there is none
+int64_t mpegts_packet_pts(const Mpeg2Ts &mpeg2ts, bool allow_pcr) {
+  if (mpeg2ts.parsed().pes_packet().has_pts()) {
+    return mpeg2ts.parsed().pes_packet().pts();
+  }
+  if (allow_pcr && mpeg2ts.parsed().adaptation_field().has_pcr()) {
+    return mpeg2ts.parsed().adaptation_field().pcr().base();
+  }
+  return -1;
+}
+
+// Same as mpegts_packet_pts(), for a (supported) Mpeg2TsPacketView
+int64_t mpegts_view_pts(Mpeg2TsPacketView *view, bool allow_pcr) {
+  if (view->HasPts()) {
+    return view->Pts();
+  }
+  if (allow_pcr && view->HasPcr()) {
+    return view->PcrBase();
+  }
+  return -1;
+}
+
+// Returns the PTS of a packet (see mpegts_packet_pts()), using the view
+// when it supports the packet, and the parser otherwise
+int64_t mpegts_any_pts(Mpeg2TsPacketView *view, Mpeg2TsParser *mpeg2ts_parser,
+                       int64_t pi, int64_t bi, const uint8_t *buf, int len,
+                       Mpeg2Ts *mpeg2ts, bool allow_pcr) {
+  view->Reset(buf, len);
+  if (view->Supported()) {
+    return mpegts_view_pts(view, allow_pcr);
+  }
+  mpeg2ts_parser->ParsePacket(pi, bi, buf, len, mpeg2ts);
+  return mpegts_packet_pts(*mpeg2ts, allow_pcr);
+}
+
+// Returns the shallowest parse depth that gives all the dump fields
+int mpegts_dump_parse_depth(status_t *status) {
+  int parse_depth = Mpeg2TsPacket::PARSE_DEPTH_HEADER;
+  for (auto &s : status->dump_fields) {
+    int field_depth = Mpeg2TsPacket::PARSE_DEPTH_FULL;
+    if (s == "packet" || s == "byte" || s == "copy_permission_indicator" ||
+        s == "arrival_timestamp" || s == "fec_trailer" || s == "file" ||
+        s == "file_index" || s.compare(0, 14, "parsed.header.") == 0) {
+      field_depth = Mpeg2TsPacket::PARSE_DEPTH_HEADER;
+    } else if (s.compare(0, 24, "parsed.adaptation_field.") == 0) {
+      field_depth = Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD;
+    } else if (s.compare(0, 18, "parsed.pes_packet.") == 0) {
+      field_depth = Mpeg2TsPacket::PARSE_DEPTH_PES;
     }
+    // everything else (PSI sections, data bytes, raw packets, and the
+    // type and syncframe fields, which need the PMT) needs a full parse
+    parse_depth = std::max(parse_depth, field_depth);
   }
+  return parse_depth;
+}
 
-  FILE *fout = stdout;
-  if (status->outfile != NULL && (strcmp(status->outfile, "-") != 0)) {
-    /* open outfile */
-    fout = fopen(status->outfile, "w+");
-    if (fout == NULL) {
-      fprintf(stderr, "error: cannot open outfile: %s\n", status->outfile);
-      return -1;
+// Returns how deep the packets must be parsed. Only the protobuf and
+// dump outputs accept a partial parse.
+int mpegts_parse_depth(status_t *status) {
+  if (status->proc != PROC_TOTXT && status->proc != PROC_DUMP) {
+    return Mpeg2TsPacket::PARSE_DEPTH_FULL;
+  }
+  int parse_depth = status->parse_depth;
+  if (parse_depth == 0) {
+    parse_depth = (status->proc == PROC_DUMP)
+                      ? mpegts_dump_parse_depth(status)
+                      : Mpeg2TsPacket::PARSE_DEPTH_FULL;
+  }
+  // PTS bounds need the PES headers
+  if (status->start_pts >= 0 || status->end_pts >= 0) {
+    parse_depth = std::max(parse_depth, (int)Mpeg2TsPacket::PARSE_DEPTH_PES);
+  }
+  return parse_depth;
+}
+
+// Returns the least payload mode that gives all the dump fields
+int mpegts_dump_payload_mode(status_t *status) {
+  int payload_mode = Mpeg2TsPacket::PAYLOAD_NONE;
+  for (auto &s : status->dump_fields) {
+    int field_mode = Mpeg2TsPacket::PAYLOAD_NONE;
+    if (s == "parsed.data_bytes" || s == "parsed.unparsed") {
+      field_mode = Mpeg2TsPacket::PAYLOAD_FULL;
+    } else if (s == "parsed.payload_hash") {
+      field_mode = Mpeg2TsPacket::PAYLOAD_HASH;
+    } else if (s == "parsed.payload_length" || s == "type" ||
+               s == "syncframe") {
+      // the type and syncframe fields read the data bytes from the
+      // original packet
+      field_mode = Mpeg2TsPacket::PAYLOAD_LENGTH;
     }
+    payload_mode = std::max(payload_mode, field_mode);
   }
+  return payload_mode;
+}
 
-  /* create mpeg2ts objects */
-  Mpeg2TsReader mpeg2ts_reader(fin, status->debug);
-  Mpeg2TsParser mpeg2ts_parser(true);
-  Mpeg2Ts mpeg2ts;
+// Returns what must be kept of the payloads. Only the protobuf, dump,
+// and summary outputs accept elided payloads.
+int mpegts_payload_mode(status_t *status) {
+  if (status->proc == PROC_SUMMARY) {
+    return Mpeg2TsPacket::PAYLOAD_NONE;
+  }
+  if (status->proc == PROC_TOTXT && status->payload_mode != 0) {
+    return status->payload_mode;
+  }
+  if (status->proc != PROC_DUMP) {
+    return Mpeg2TsPacket::PAYLOAD_FULL;
+  }
+  return std::max(status->payload_mode, mpegts_dump_payload_mode(status));
+}
 
-  // write output header
-  if (status->proc == PROC_DUMP) {
-    char buf[1024] = {0};
-    int bi = 0;
-    for (auto &s : status->dump_fields) {
-      bi += snprintf(buf + bi, sizeof(buf) - bi, "%s,", s.c_str());
+// summary proc
+
+pid_summary_t *mpegts_summary_pid(summary_t *summary, int pid) {
+  auto iter = summary->pids.find(pid);
+  if (iter == summary->pids.end()) {
+    pid_summary_t pid_summary = {0, (pid == MPEG_TS_PID_MAX) ? "null" : "-",
+                                 -1, -1, -1};
+    iter = summary->pids.emplace(pid, pid_summary).first;
+  }
+  return &iter->second;
+}
+
+// Add a (valid) packet of PID <pid> and PTS <pts> (or -1) to the summary
+pid_summary_t *mpegts_summary_add_packet(int pid, int64_t pts, int len,
+                                         summary_t *summary) {
+  summary->bytes += len;
+  summary->packets += 1;
+  pid_summary_t *pid_summary = mpegts_summary_pid(summary, pid);
+  pid_summary->packets += 1;
+  if (pts >= 0) {
+    if (pid_summary->first_pts < 0) {
+      pid_summary->first_pts = pts;
     }
-    // remove last comma
-    buf[bi - 1] = '\0';
-    fprintf(fout, "%s\n", buf);
+    pid_summary->last_pts = pts;
+    if (summary->first_pts < 0) {
+      summary->first_pts = pts;
+    }
+    summary->last_pts = pts;
   }
-  uint8_t *buf;
-  int len;
-  int64_t pi;
-  int64_t bi;
-  while ((len = mpeg2ts_reader.GetChunk(&buf, &pi, &bi)) > 0) {
-    len = mpeg2ts_parser.ParsePacket(pi, bi, buf, len, &mpeg2ts);
-    // check whether the packet is interesting
-    mpegts_process_packet(mpeg2ts, status);
-    if (status->proc == PROC_TOTXT)
-      fprintf(fout, "%s\n", mpeg2ts.ShortDebugString().c_str());
-    else if (status->proc == PROC_DUMP)
-      DumpLine(mpeg2ts, status, fout);
-    else if (status->proc == PROC_TEST) {
-      uint8_t out[MPEG_TS_PACKET_SIZE];
-      int outlen = mpeg2ts_parser.DumpPacket(mpeg2ts, out, sizeof(out));
-      if (CheckTestResults(buf, len, out, outlen, mpeg2ts, status)) {
-        return -1;
+  return pid_summary;
+}
+
+void mpegts_summary_add(const Mpeg2Ts &mpeg2ts, int len, summary_t *summary) {
+  if (!mpeg2ts.has_parsed()) {
+    summary->bytes += len;
+    summary->unsynced_bytes += len;
+    return;
+  }
+  pid_summary_t *pid_summary = mpegts_summary_add_packet(
+      mpeg2ts.parsed().header().pid(), mpegts_packet_pts(mpeg2ts, false), len,
+      summary);
+  // PSI tables tell the PID types
+  auto &psi_packet = mpeg2ts.parsed().psi_packet();
+  for (auto &pas : psi_packet.program_association_section()) {
+    pid_summary->type = "PAT";
+    for (auto &program_information : pas.program_information()) {
+      if (program_information.program_number() != 0) {
+        mpegts_summary_pid(summary, program_information.program_map_pid())
+            ->type = "PMT";
+      }
+    }
+  }
+  for (auto &pms : psi_packet.program_map_section()) {
+    for (auto &stream_description : pms.stream_description()) {
+      int stream_type = stream_description.stream_type();
+      pid_summary_t *es_summary =
+          mpegts_summary_pid(summary, stream_description.elementary_pid());
+      es_summary->stream_type = stream_type;
+      if (std::find(MPEGTS_VIDEO_STREAM_TYPE.begin(),
+                    MPEGTS_VIDEO_STREAM_TYPE.end(),
+                    stream_type) != MPEGTS_VIDEO_STREAM_TYPE.end()) {
+        es_summary->type = "video";
+      } else if (std::find(MPEGTS_AUDIO_STREAM_TYPE.begin(),
+                           MPEGTS_AUDIO_STREAM_TYPE.end(),
+                           stream_type) != MPEGTS_AUDIO_STREAM_TYPE.end()) {
+        es_summary->type = "audio";
+      } else {
+        es_summary->type = "other";
       }
     }
-    mpeg2ts_reader.Next(len);
   }
+}
 
-  /* close in/out files */
-  fclose(fin);
-  fclose(fout);
+// Print the summary. Sampled counts are scaled by the ratio between
+// the input size (<size>, or -1 if unknown) and the bytes read.
+void mpegts_summary_print(const summary_t &summary, int64_t size,
+                          int packet_size, status_t *status, FILE *fout) {
+  double weight = 1.0;
+  if (summary.windows > 0) {
+    fprintf(fout,
+            "sampled: yes (%" PRId64 " windows of %" PRId64
+            " packets, every %" PRId64 " bytes)\n",
+            summary.windows, status->sample_packets, status->sample_stride);
+    if (size > 0 && summary.bytes > 0) {
+      weight = (double)size / summary.bytes;
+      fprintf(fout, "read: %" PRId64 " bytes (%.2f%%)\n", summary.bytes,
+              100.0 / weight);
+    }
+  } else {
+    fprintf(fout, "sampled: no\n");
+    size = summary.bytes;
+  }
+  if (size >= 0) {
+    fprintf(fout, "size: %" PRId64 " bytes\n", size);
+  } else {
+    fprintf(fout, "size: -\n");
+  }
+  fprintf(fout, "packets: %" PRId64 "\n",
+          (int64_t)(summary.packets * weight + 0.5));
+  fprintf(fout, "packet_size: %i\n", packet_size);
+  fprintf(fout, "unsynced: %" PRId64 " bytes\n",
+          (int64_t)(summary.unsynced_bytes * weight + 0.5));
+  // the duration goes from the first to the last PTS (plus a wrap)
+  int64_t duration = PtsDiff(summary.last_pts, summary.first_pts);
+  double bitrate = 0.0;
+  if (duration > 0 && size >= 0) {
+    bitrate = (double)size * 8 * kPtsPerSecond / duration;
+    fprintf(fout,
+            "duration: %.3f s (pts %" PRId64 " to %" PRId64 ")\n"
+            "bitrate: %.0f bps\n",
+            (double)duration / kPtsPerSecond, summary.first_pts,
+            summary.last_pts, bitrate);
+  } else {
+    fprintf(fout, "duration: -\nbitrate: -\n");
+  }
+  fprintf(fout, "pid,type,stream_type,packets,first_pts,last_pts,bitrate\n");
+  for (auto &iter : summary.pids) {
+    const pid_summary_t &pid_summary = iter.second;
+    // each PID gets its share of the total bitrate
+    double pid_bitrate = (summary.packets > 0)
+                             ? bitrate * pid_summary.packets / summary.packets
+                             : 0.0;
+    char stream_type[8] = "";
+    if (pid_summary.stream_type >= 0) {
+      snprintf(stream_type, sizeof(stream_type), "0x%02x",
+               pid_summary.stream_type);
+    }
+    fprintf(fout, "0x%04x,%s,%s,%" PRId64 ",%" PRId64 ",%" PRId64 ",%.0f\n",
+            iter.first, pid_summary.type, stream_type,
+            (int64_t)(pid_summary.packets * weight + 0.5),
+            pid_summary.first_pts, pid_summary.last_pts, pid_bitrate);
+  }
+}
 
-  if (len < 0) {
-    // lost sync
-    fprintf(stderr, "error: lost sync of %s at byte %" PRId64 "\n",
-            status->infile != NULL ? status->infile : "stdin", bi);
+// Returns the first PTS/PCR sample at (or after) byte <bi>, or -1
+int64_t mpegts_sample_pts(Mpeg2TsReader *mpeg2ts_reader,
+                          Mpeg2TsParser *mpeg2ts_parser, int64_t bi) {
+  // (only the PTS matters: the packet index can be estimated)
+  if (mpeg2ts_reader->SeekByte(bi, false) < 0) {
     return -1;
   }
-  return 0;
+  int packet_size = mpeg2ts_reader->PacketSize();
+  mpeg2ts_parser->SetPacketSize(packet_size);
+  Mpeg2TsPacketView view;
+  view.SetPacketSize(packet_size);
+  Mpeg2Ts mpeg2ts;
+  Mpeg2TsChunk chunk;
+  int num_packets = 0;
+  while (num_packets < PTS_PROBE_PACKETS &&
+         mpeg2ts_reader->GetPackets(PACKET_BATCH_SIZE, &chunk) > 0) {
+    for (int i = 0; chunk.synced && i < chunk.count; ++i) {
+      int64_t pts = mpegts_any_pts(
+          &view, mpeg2ts_parser, chunk.pi + i, chunk.bi + (i * packet_size),
+          chunk.buf + (i * packet_size), packet_size, &mpeg2ts, true);
+      if (pts >= 0) {
+        return pts;
+      }
+    }
+    num_packets += chunk.count;
+    mpeg2ts_reader->Next(chunk);
+  }
+  return -1;
+}
+
+// Move the reader to the start of the packet range. PTS bounds bisect
+// the input on PTS/PCR samples, and land a bit before the target: the
+// packets before it are skipped while processing. Byte and PTS bounds
+// seek straight to the start (the packet indices are then estimated),
+// while packet bounds count the packets from the start of the input
+// (sync only), so the reader lands on the first chunk of a full read
+// in the range.
+int mpegts_seek(Mpeg2TsReader *mpeg2ts_reader, Mpeg2TsParser *mpeg2ts_parser,
+                status_t *status) {
+  int64_t lo = 0;
+  if (status->start_byte > 0) {
+    lo = status->start_byte;
+  }
+  int64_t hi = mpeg2ts_reader->InputSize();
+  bool moved = false;
+  if (status->start_pts > 0 && hi > lo) {
+    int64_t target = status->start_pts - PTS_SEEK_MARGIN;
+    while (hi - lo > PTS_BISECT_WINDOW) {
+      int64_t mid = lo + (hi - lo) / 2;
+      int64_t pts = mpegts_sample_pts(mpeg2ts_reader, mpeg2ts_parser, mid);
+      moved = true;
+      if (status->debug > 1) {
+        printf("pts bisect: [%" PRId64 ", %" PRId64 "]: pts at %" PRId64
+               ": %" PRId64 "\n",
+               lo, hi, mid, pts);
+      }
+      if (pts < 0 || pts >= target) {
+        hi = mid;
+      } else {
+        lo = mid;
+      }
+    }
+  }
+  bool packet_bounds = status->start_packet > 0 || status->end_packet >= 0;
+  if (lo == 0 && !moved && !packet_bounds) {
+    // nothing to skip
+    return 0;
+  }
+  if (lo > 0 && !packet_bounds) {
+    // counting the packets before the start would read them all:
+    // estimate the packet indices
+    status->pi_estimated = true;
+    return mpeg2ts_reader->SeekByte(lo, false);
+  }
+  return mpeg2ts_reader->SeekTo(
+      lo, (status->start_packet > 0) ? status->start_packet : -1);
+}
+
+// Returns the name of the current binary input
+const char *mpegts_input_name(status_t *status) {
+  if (status->infile_l.empty()) {
+    return "stdin";
+  }
+  return status->infile_l[status->infile_index].c_str();
+}
+
+// Report an input that could not be read completely (e.g. a corrupt or
+// truncated compressed file). Returns -1 if there was one, 0 otherwise.
+int mpegts_check_input(const Mpeg2TsReader &mpeg2ts_reader,
+                       status_t *status) {
+  if (mpeg2ts_reader.Error() == NULL) {
+    return 0;
+  }
+  fprintf(stderr, "error: %s (%s)\n", mpeg2ts_reader.Error(),
+          mpegts_input_name(status));
+  return -1;
+}
+
+// Open binary input <index> ("-" or no input is stdin)
+FILE *mpegts_open_input(status_t *status, int index) {
+  status->infile_index = index;
+  if (status->infile_l.empty() || status->infile_l[index] == "-") {
+    return stdin;
+  }
+  FILE *fin = fopen(status->infile_l[index].c_str(), "r");
+  if (fin == NULL) {
+    fprintf(stderr, "error: cannot open infile: %s\n",
+            status->infile_l[index].c_str());
+  }
+  return fin;
+}
+
+// Print a packet in short text format (same as ShortDebugString()),
+// reusing the printer and its output buffer
+void mpegts_print_text(const Mpeg2Ts &mpeg2ts, FILE *fout) {
+  static thread_local google::protobuf::TextFormat::Printer printer;
+  static thread_local bool printer_init = false;
+  static thread_local std::string text;
+  if (!printer_init) {
+    printer.SetSingleLineMode(true);
+    printer.SetExpandAny(true);
+    printer_init = true;
+  }
+  printer.PrintToString(mpeg2ts, &text);
+  // remove the trailing space
+  if (!text.empty() && text.back() == ' ') {
+    text.pop_back();
+  }
+  fprintf(fout, "%s\n", text.c_str());
+}
+
+// Account for a packet skipped by the PID filter: it is not processed,
+// but it still counts in the summary, and the PMT packets still update
+// the video and audio PIDs
+void mpegts_skip_packet(int64_t pi, int64_t bi, const uint8_t *buf, int len,
+                        bool synced, Mpeg2TsParser *mpeg2ts_parser,
+                        Mpeg2Ts *mpeg2ts, status_t *status) {
+  if (status->proc == PROC_SUMMARY) {
+    status->summary.packets += synced ? 1 : 0;
+    status->summary.bytes += len;
+    status->summary.unsynced_bytes += synced ? 0 : len;
+  }
+  // PSI sections start in packets with payload_unit_start_indicator
+  int sync_offset = Mpeg2TsParser::SyncOffset(len);
+  if (status->need_pmt && synced && (buf[sync_offset + 1] & 0x40) != 0 &&
+      !mpegts_pmt_repeated(buf, len, status)) {
+    mpeg2ts_parser->ParsePacket(pi, bi, buf, len, mpeg2ts);
+    mpegts_process_packet(*mpeg2ts, buf, len, status);
+  }
+}
+
+// Process the packets in <chunk> (with their packet indices shifted by
+// <pi_delta>). Returns 1 at the end of the packet range, -1 on error,
+// and 0 otherwise.
+int mpegts_process_chunk(const Mpeg2TsChunk &chunk, int packet_size,
+                         int64_t pi_delta, Mpeg2TsParser *mpeg2ts_parser,
+                         Mpeg2Ts *mpeg2ts, bool *before_start_pts,
+                         status_t *status, FILE *fout) {
+  Mpeg2TsPacketView view;
+  view.SetPacketSize(packet_size);
+  // the summary only needs the PID of the packets that cannot carry a
+  // PTS (no payload_unit_start_indicator) nor fail to parse (no
+  // adaptation field): batch-decode the headers, and count those
+  // straight from them
+  uint16_t pid_arr[PACKET_BATCH_SIZE];
+  uint8_t cc_arr[PACKET_BATCH_SIZE];
+  uint8_t flags_arr[PACKET_BATCH_SIZE];
+  bool use_headers = status->proc == PROC_SUMMARY && status->use_view &&
+                     chunk.synced && chunk.count <= PACKET_BATCH_SIZE;
+  if (use_headers) {
+    int sync_offset = Mpeg2TsParser::SyncOffset(packet_size);
+    decode_headers(chunk.buf + sync_offset, chunk.count, packet_size, pid_arr,
+                   cc_arr, flags_arr);
+  }
+  for (int i = 0; i < chunk.count; ++i) {
+    int64_t pi = chunk.pi + pi_delta + i;
+    int64_t bi = chunk.bi + (i * packet_size);
+    const uint8_t *buf = chunk.buf + (i * packet_size);
+    // check the packet range
+    if ((status->end_byte >= 0 && bi >= status->end_byte) ||
+        (status->end_packet >= 0 && pi >= status->end_packet)) {
+      return 1;
+    }
+    if (bi < status->start_byte || pi < status->start_packet) {
+      continue;
+    }
+    int len = chunk.synced ? packet_size : chunk.len;
+    // skip the filtered-out PIDs before parsing (non-parseable chunks
+    // have no PID)
+    if (!status->pid_filter.Empty() &&
+        (!chunk.synced || !status->pid_filter.Select(buf, len))) {
+      mpegts_skip_packet(pi, bi, buf, len, chunk.synced, mpeg2ts_parser,
+                         mpeg2ts, status);
+      continue;
+    }
+    if (use_headers && !*before_start_pts &&
+        (flags_arr[i] &
+         (MPEG_TS_HEADER_FLAG_PUSI | MPEG_TS_HEADER_FLAG_ADAPTATION_FIELD |
+          MPEG_TS_HEADER_FLAG_NO_SYNC)) == 0) {
+      mpegts_summary_add_packet(pid_arr[i], -1, len, &status->summary);
+      continue;
+    }
+    // only parse the packets the view does not support (e.g. PSI)
+    view.Reset(buf, len);
+    bool use_view = status->use_view && view.Supported();
+    if (!use_view) {
+      int parsed_len = mpeg2ts_parser->ParsePacket(pi, bi, buf, len, mpeg2ts);
+      // check whether the packet is interesting
+      mpegts_process_packet(*mpeg2ts, buf, len, status);
+      len = parsed_len;
+    }
+    if (*before_start_pts || status->end_pts >= 0) {
+      int64_t pts = use_view ? mpegts_view_pts(&view, false)
+                             : mpegts_packet_pts(*mpeg2ts, false);
+      if (status->end_pts >= 0 && pts >= status->end_pts) {
+        return 1;
+      }
+      if (*before_start_pts) {
+        // skip the packets before the first PTS in the range
+        if (pts < status->start_pts) {
+          continue;
+        }
+        *before_start_pts = false;
+      }
+    }
+    if (status->proc == PROC_TOTXT && status->pi_estimated) {
+      // no packet index rather than an estimated one
+      mpeg2ts->clear_packet();
+      mpegts_print_text(*mpeg2ts, fout);
+    } else if (status->proc == PROC_TOTXT)
+      mpegts_print_text(*mpeg2ts, fout);
+    else if (status->proc == PROC_DUMP && use_view)
+      DumpViewLine(&view, pi, bi, status, fout);
+    else if (status->proc == PROC_DUMP)
+      DumpLine(*mpeg2ts, buf, len, status, fout);
+    else if (status->proc == PROC_TEST) {
+      uint8_t out[MPEG_TS_MAX_PACKET_SIZE];
+      int outlen = mpeg2ts_parser->DumpPacket(*mpeg2ts, out, sizeof(out));
+      if (CheckTestResults(buf, len, out, outlen, *mpeg2ts, status)) {
+        return -1;
+      }
+    } else if (status->proc == PROC_SUMMARY && use_view)
+      mpegts_summary_add_packet(view.Pid(), mpegts_view_pts(&view, false), len,
+                                &status->summary);
+    else if (status->proc == PROC_SUMMARY)
+      mpegts_summary_add(*mpeg2ts, len, &status->summary);
+    else if (status->proc == PROC_PES) {
+      // (<len> may have been changed by the parser)
+      PesUnit unit;
+      if (chunk.synced && status->pes_assembler.Push(pi, bi, buf, packet_size,
+                                                     &unit) > 0) {
+        PesLine(unit, status, fout);
+      }
+    }
+  }
+  return 0;
+}
+
+// parallel processing (--jobs)
+//
+// The input is split in shards of (about) the same size. Each shard
+// starts at the first sync point after its nominal start, which may not
+// be a packet boundary of the serial run (e.g. after garbage, or on
+// payload bytes that look like sync bytes). Reader chunking only depends
+// on the position, so two readers that reach the same chunk boundary
+// return the same chunks from there on: each shard scans its chunks
+// until they meet the chunks of the next shard, and that boundary is
+// where the next shard takes over. The shard scans (sync only) also
+// count the packets, which give the global packet index of each shard
+// before it is parsed. The shards are parsed in parallel, and their
+// output is written in order.
+
+#define SHARD_END INT64_MAX
+
+// a PMT packet, and its effect on the status PID lists
+typedef struct pmt_event_t {
+  int64_t bi;
+  // added video PIDs, and new audio PIDs
+  std::list<int> video_pid_l;
+  std::list<int> audio_pid_l;
+} pmt_event_t;
+
+typedef struct shard_t {
+  // nominal start, and first sync point at (or after) it (-1 if none)
+  int64_t start;
+  int64_t sync_byte;
+  // scan results: chunk boundary where the next shard takes over
+  // (SHARD_END if this shard runs to the end of the stream), packets
+  // from sync_byte to it, and packets of the next shard (from its
+  // sync_byte) before it
+  bool scanned;
+  int64_t end;
+  int64_t count;
+  int64_t next_skip;
+  std::vector<pmt_event_t> pmt_events;
+  // first byte and packet index in the serial run (first_byte is
+  // SHARD_END if the shard is empty), packets of this shard before
+  // first_byte, and status at first_byte
+  bool linked;
+  int64_t first_byte;
+  int64_t first_packet;
+  int64_t skip;
+  status_t status;
+  // output (res: 0, 1 at the end of the packet range, -1 on error)
+  bool finished;
+  char *out;
+  size_t out_len;
+  int res;
+  int64_t lost_sync_byte;
+  // input error (see Mpeg2TsReader::Error())
+  std::string input_error;
+} shard_t;
+
+typedef struct parallel_t {
+  char path[64];
+  int packet_size;
+  // whether the dump fields need the PMT state
+  bool need_pmt;
+  std::vector<shard_t> shards;
+  std::mutex mutex;
+  std::condition_variable cv;
+  // next shard to process, shards written, and last shard to process
+  int next_shard;
+  int written;
+  std::atomic<int> last_shard;
+} parallel_t;
+
+// Returns the byte and packet index of the next chunk of <reader>
+int64_t mpegts_shard_position(Mpeg2TsReader *reader, int64_t *pi) {
+  Mpeg2TsChunk chunk;
+  reader->GetChunk(&chunk);
+  if (pi != NULL) {
+    *pi = chunk.pi;
+  }
+  return chunk.bi;
+}
+
+// Open a reader (on its own file description) at the first sync point
+// of shard <k>. Returns the byte index of the sync point, or -1.
+int64_t mpegts_shard_open(parallel_t *parallel, int k, FILE **fin,
+                          Mpeg2TsReader **reader) {
+  const shard_t &shard = parallel->shards[k];
+  *fin = fopen(parallel->path, "r");
+  *reader = NULL;
+  if (*fin == NULL) {
+    return -1;
+  }
+  *reader = new Mpeg2TsReader(*fin, shard.status.debug,
+                              shard.status.reader_mode);
+  (*reader)->SetSyncGap(shard.status.sync_gap);
+  (*reader)->SetPacketSize(parallel->packet_size);
+  if (k == 0) {
+    // the first shard starts where the serial run starts (a chunk
+    // boundary, which is not the start of the input if the serial run
+    // moved to the packet range)
+    if (shard.sync_byte > 0 &&
+        (*reader)->SeekChunk(shard.sync_byte, shard.first_packet) < 0) {
+      return -1;
+    }
+    return shard.sync_byte;
+  }
+  // (the packet indices of the shard are reconciled after the scans)
+  if ((*reader)->SeekByte(shard.start, false) < 0) {
+    return -1;
+  }
+  return mpegts_shard_position(*reader, NULL);
+}
+
+void mpegts_shard_close(FILE *fin, Mpeg2TsReader *reader) {
+  delete reader;
+  if (fin != NULL) {
+    fclose(fin);
+  }
+}
+
+// Store the PMT packets among the first <count> packets of <chunk>.
+// <pmt_status> keeps the PMTs of the scan (only repeated PMT packets
+// are not parsed again).
+void mpegts_shard_pmt(const Mpeg2TsChunk &chunk, int count, int packet_size,
+                      Mpeg2TsParser *mpeg2ts_parser, status_t *pmt_status,
+                      std::vector<pmt_event_t> *pmt_events) {
+  int sync_offset = Mpeg2TsParser::SyncOffset(packet_size);
+  Mpeg2Ts mpeg2ts;
+  for (int i = 0; i < count; ++i) {
+    const uint8_t *buf = chunk.buf + (i * packet_size);
+    // PSI sections start in packets with payload_unit_start_indicator
+    if ((buf[sync_offset + 1] & 0x40) == 0) {
+      continue;
+    }
+    int64_t bi = chunk.bi + (i * packet_size);
+    // (events only list the video PIDs a PMT adds)
+    pmt_status->video_pid_l.clear();
+    if (!mpegts_pmt_repeated(buf, packet_size, pmt_status)) {
+      mpeg2ts_parser->ParsePacket(0, bi, buf, packet_size, &mpeg2ts);
+      if (mpeg2ts.parsed().psi_packet().program_map_section_size() == 0) {
+        continue;
+      }
+      mpegts_process_packet(mpeg2ts, buf, packet_size, pmt_status);
+    }
+    pmt_events->push_back(
+        {bi, pmt_status->video_pid_l, pmt_status->audio_pid_l});
+  }
+}
+
+// Move <reader> to the first chunk boundary at (or after) byte <end>,
+// adding the packets skipped to <count> (and the PMT packets to
+// <pmt_events>, if not NULL, with <pmt_status>). Returns the byte index
+// of the boundary, or -1 if the stream ends (or loses sync) before it.
+int64_t mpegts_shard_scan(Mpeg2TsReader *reader, int64_t end, int64_t *count,
+                          Mpeg2TsParser *mpeg2ts_parser, status_t *pmt_status,
+                          std::vector<pmt_event_t> *pmt_events) {
+  int packet_size = reader->PacketSize();
+  Mpeg2TsChunk chunk;
+  while (reader->GetPackets(PACKET_BATCH_SIZE, &chunk) > 0) {
+    if (chunk.bi >= end) {
+      return chunk.bi;
+    }
+    int n = chunk.count;
+    if (chunk.synced) {
+      // stop at the first packet at (or after) end
+      n = std::min((int64_t)n, (end - chunk.bi + packet_size - 1) / packet_size);
+      if (pmt_events != NULL) {
+        mpegts_shard_pmt(chunk, n, packet_size, mpeg2ts_parser, pmt_status,
+                         pmt_events);
+      }
+    }
+    *count += n;
+    if (n == chunk.count) {
+      reader->Next(chunk);
+    } else {
+      for (int i = 0; i < n; ++i) {
+        reader->Next(packet_size);
+      }
+    }
+  }
+  return -1;
+}
+
+// Scan shard <k>: find where the next shard takes over
+void mpegts_shard_scan_all(parallel_t *parallel, int k, Mpeg2TsReader *reader,
+                           Mpeg2TsParser *mpeg2ts_parser) {
+  shard_t &shard = parallel->shards[k];
+  std::vector<pmt_event_t> *pmt_events =
+      parallel->need_pmt ? &shard.pmt_events : NULL;
+  shard.end = SHARD_END;
+  shard.count = 0;
+  shard.next_skip = 0;
+  int num_shards = parallel->shards.size();
+  if (shard.sync_byte < 0 || k + 1 >= num_shards) {
+    return;
+  }
+  // follow the chunks of the next shard (from its first sync point)
+  FILE *next_fin;
+  Mpeg2TsReader *next_reader;
+  int64_t next_pos = mpegts_shard_open(parallel, k + 1, &next_fin,
+                                       &next_reader);
+  // the two chunk sequences must meet before the shard after the next
+  // one (otherwise, this shard runs to the end of the stream)
+  int64_t limit =
+      (k + 2 < num_shards) ? parallel->shards[k + 2].start : SHARD_END;
+  int64_t pos = -1;
+  int64_t count = 0;
+  int64_t next_skip = 0;
+  status_t pmt_status;
+  if (next_pos >= 0) {
+    pos = mpegts_shard_scan(reader, next_pos, &count, mpeg2ts_parser,
+                            &pmt_status, pmt_events);
+  }
+  while (pos >= 0 && next_pos >= 0 && pos != next_pos && pos < limit &&
+         next_pos < limit) {
+    if (pos < next_pos) {
+      pos = mpegts_shard_scan(reader, next_pos, &count, mpeg2ts_parser,
+                              &pmt_status, pmt_events);
+    } else {
+      next_pos = mpegts_shard_scan(next_reader, pos, &next_skip,
+                                   mpeg2ts_parser, NULL, NULL);
+    }
+  }
+  if (pos >= 0 && pos == next_pos && pos < limit) {
+    shard.end = pos;
+    shard.count = count;
+    shard.next_skip = next_skip;
+  }
+  mpegts_shard_close(next_fin, next_reader);
+}
+
+// Link shard <k> to the previous one: get its first byte and packet
+// index, and its status (once the previous shard is linked)
+void mpegts_shard_link(parallel_t *parallel, int k) {
+  shard_t &shard = parallel->shards[k];
+  if (k == 0) {
+    // the first shard starts where the serial run starts
+    shard.first_byte = shard.sync_byte;
+    shard.skip = 0;
+    return;
+  }
+  const shard_t &prev = parallel->shards[k - 1];
+  shard.first_byte = (prev.first_byte == SHARD_END) ? SHARD_END : prev.end;
+  shard.skip = prev.next_skip;
+  if (shard.first_byte == SHARD_END) {
+    return;
+  }
+  shard.first_packet = prev.first_packet + (prev.count - prev.skip);
+  // replay the PMT packets of the previous shard
+  shard.status.video_pid_l = prev.status.video_pid_l;
+  shard.status.audio_pid_l = prev.status.audio_pid_l;
+  for (const auto &pmt_event : prev.pmt_events) {
+    if (pmt_event.bi >= prev.first_byte && pmt_event.bi < prev.end) {
+      for (int pid : pmt_event.video_pid_l) {
+        mpegts_add_pid(pid, &shard.status.video_pid_l);
+      }
+      shard.status.audio_pid_l = pmt_event.audio_pid_l;
+    }
+  }
+}
+
+// Parse shard <k> into its output buffer
+void mpegts_shard_parse(parallel_t *parallel, int k,
+                        Mpeg2TsParser *mpeg2ts_parser) {
+  shard_t &shard = parallel->shards[k];
+  FILE *fout = open_memstream(&shard.out, &shard.out_len);
+  if (fout == NULL) {
+    shard.res = -1;
+    return;
+  }
+  int packet_size = parallel->packet_size;
+  FILE *fin;
+  Mpeg2TsReader *reader;
+  if (mpegts_shard_open(parallel, k, &fin, &reader) < 0) {
+    fprintf(stderr, "error: cannot open shard %i\n", k);
+    shard.res = -1;
+    mpegts_shard_close(fin, reader);
+    fclose(fout);
+    return;
+  }
+  // move to the first byte (the shard chunks meet the serial ones
+  // there)
+  int64_t count = 0;
+  int64_t pos = mpegts_shard_scan(reader, shard.first_byte, &count,
+                                  mpeg2ts_parser, NULL, NULL);
+  Mpeg2TsChunk chunk;
+  int len;
+  if (pos < 0 && count == shard.skip) {
+    // the stream ends (or loses sync) at the first byte: nothing to parse
+    if ((len = reader->GetPackets(PACKET_BATCH_SIZE, &chunk)) < 0) {
+      shard.res = -1;
+      if (reader->Error() == NULL) {
+        shard.lost_sync_byte = chunk.bi;
+      }
+    }
+  } else if (pos != shard.first_byte || count != shard.skip) {
+    fprintf(stderr, "error: cannot find the start of shard %i\n", k);
+    shard.res = -1;
+  }
+  if (pos != shard.first_byte || count != shard.skip) {
+    if (reader->Error() != NULL) {
+      shard.res = -1;
+      shard.input_error = reader->Error();
+    }
+    mpegts_shard_close(fin, reader);
+    fclose(fout);
+    return;
+  }
+  int64_t pi;
+  mpegts_shard_position(reader, &pi);
+  int64_t pi_delta = shard.first_packet - pi;
+  bool before_start_pts = false;
+  shard.status.pid_filter.SetPacketSize(packet_size);
+  mpeg2ts_parser->SetParseDepth(
+      (Mpeg2TsPacket::ParseDepth)shard.status.parse_depth);
+  mpeg2ts_parser->SetPayloadMode(
+      (Mpeg2TsPacket::PayloadMode)shard.status.payload_mode);
+  Mpeg2Ts mpeg2ts;
+  while (shard.res == 0 &&
+         (len = reader->GetPackets(PACKET_BATCH_SIZE, &chunk)) != 0) {
+    if (len < 0) {
+      shard.res = -1;
+      if (reader->Error() == NULL) {
+        shard.lost_sync_byte = chunk.bi;
+      }
+      break;
+    }
+    if (chunk.bi >= shard.end || parallel->last_shard < k) {
+      break;
+    }
+    if (chunk.synced && chunk.bi + chunk.len > shard.end) {
+      chunk.count = (shard.end - chunk.bi + packet_size - 1) / packet_size;
+    }
+    shard.res = mpegts_process_chunk(chunk, packet_size, pi_delta,
+                                     mpeg2ts_parser, &mpeg2ts,
+                                     &before_start_pts, &shard.status, fout);
+    reader->Next(chunk);
+  }
+  if (reader->Error() != NULL) {
+    shard.res = -1;
+    shard.input_error = reader->Error();
+  }
+  mpegts_shard_close(fin, reader);
+  fclose(fout);
+}
+
+void mpegts_shard_run(parallel_t *parallel, int k) {
+  shard_t &shard = parallel->shards[k];
+  Mpeg2TsParser mpeg2ts_parser(true);
+  mpeg2ts_parser.SetPacketSize(parallel->packet_size);
+  FILE *fin;
+  Mpeg2TsReader *reader;
+  shard.sync_byte = mpegts_shard_open(parallel, k, &fin, &reader);
+  mpegts_shard_scan_all(parallel, k, reader, &mpeg2ts_parser);
+  mpegts_shard_close(fin, reader);
+  {
+    std::unique_lock<std::mutex> lock(parallel->mutex);
+    shard.scanned = true;
+    // wait for the previous shard
+    parallel->cv.wait(lock, [parallel, k] {
+      return k == 0 || parallel->shards[k - 1].linked;
+    });
+    mpegts_shard_link(parallel, k);
+    shard.linked = true;
+  }
+  parallel->cv.notify_all();
+  if (shard.first_byte != SHARD_END && parallel->last_shard >= k) {
+    if (shard.status.debug > 1) {
+      printf("shard %i: bytes [%" PRId64 ", %" PRId64 ") from packet %" PRId64
+             "\n",
+             k, shard.first_byte, shard.end, shard.first_packet);
+    }
+    mpegts_shard_parse(parallel, k, &mpeg2ts_parser);
+  }
+  {
+    std::lock_guard<std::mutex> lock(parallel->mutex);
+    shard.finished = true;
+  }
+  parallel->cv.notify_all();
+}
+
+void mpegts_shard_worker(parallel_t *parallel, int jobs) {
+  while (true) {
+    int k;
+    {
+      // limit the number of shards (and buffered outputs) in flight
+      std::unique_lock<std::mutex> lock(parallel->mutex);
+      parallel->cv.wait(lock, [parallel, jobs] {
+        return parallel->next_shard > parallel->last_shard ||
+               parallel->next_shard <
+                   parallel->written + jobs * PARALLEL_SHARDS_PER_JOB;
+      });
+      k = parallel->next_shard;
+      if (k > parallel->last_shard) {
+        return;
+      }
+      parallel->next_shard++;
+    }
+    mpegts_shard_run(parallel, k);
+  }
+}
+
+// Process the rest of the input (a seekable file of <size> bytes) in
+// parallel shards, starting at the current position of <mpeg2ts_reader>
+int mpegts_read_shards(Mpeg2TsReader *mpeg2ts_reader, int fd, int64_t size,
+                       status_t *status, FILE *fout) {
+  parallel_t parallel;
+  snprintf(parallel.path, sizeof(parallel.path), "/proc/self/fd/%i", fd);
+  // start of the serial run (detects the packet size)
+  Mpeg2TsChunk chunk;
+  mpeg2ts_reader->GetChunk(&chunk);
+  parallel.packet_size = mpeg2ts_reader->PacketSize();
+  parallel.need_pmt = status->need_pmt;
+  int jobs = status->jobs;
+  int64_t end = (status->end_byte >= 0) ? std::min(size, status->end_byte)
+                                        : size;
+  int64_t shard_size = std::max(
+      std::min((int64_t)PARALLEL_SHARD_SIZE, (end - chunk.bi) / jobs),
+      (int64_t)PARALLEL_MIN_SHARD_SIZE);
+  int num_shards = std::max((int64_t)1, (end - chunk.bi) / shard_size);
+  parallel.shards.resize(num_shards);
+  for (int k = 0; k < num_shards; ++k) {
+    shard_t &shard = parallel.shards[k];
+    shard.start = chunk.bi + k * shard_size;
+    shard.sync_byte = chunk.bi;
+    shard.scanned = false;
+    shard.linked = false;
+    shard.first_packet = chunk.pi;
+    shard.status = *status;
+    shard.finished = false;
+    shard.out = NULL;
+    shard.out_len = 0;
+    shard.res = 0;
+    shard.lost_sync_byte = -1;
+  }
+  parallel.next_shard = 0;
+  parallel.written = 0;
+  parallel.last_shard = num_shards - 1;
+  if (status->debug > 0) {
+    printf("parallel: %i shards of %" PRId64 " bytes, %i jobs\n", num_shards,
+           shard_size, jobs);
+  }
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < std::min(jobs, num_shards); ++i) {
+    workers.push_back(std::thread(mpegts_shard_worker, &parallel, jobs));
+  }
+  // write the shard outputs in order
+  int res = 0;
+  for (int k = 0; k < num_shards; ++k) {
+    shard_t &shard = parallel.shards[k];
+    {
+      std::unique_lock<std::mutex> lock(parallel.mutex);
+      parallel.cv.wait(lock, [&shard] { return shard.finished; });
+    }
+    fwrite(shard.out, 1, shard.out_len, fout);
+    free(shard.out);
+    shard.out = NULL;
+    {
+      std::lock_guard<std::mutex> lock(parallel.mutex);
+      parallel.written = k + 1;
+      if (shard.res != 0) {
+        // end of the packet range, or error: drop the next shards
+        parallel.last_shard = k;
+      }
+    }
+    parallel.cv.notify_all();
+    if (shard.res != 0) {
+      res = (shard.res < 0) ? -1 : 0;
+      if (shard.lost_sync_byte >= 0) {
+        fflush(fout);
+        fprintf(stderr, "error: lost sync of %s at byte %" PRId64 "\n",
+                mpegts_input_name(status), shard.lost_sync_byte);
+      }
+      if (!shard.input_error.empty()) {
+        fflush(fout);
+        fprintf(stderr, "error: %s (%s)\n", shard.input_error.c_str(),
+                mpegts_input_name(status));
+      }
+      break;
+    }
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  for (auto &shard : parallel.shards) {
+    free(shard.out);
+  }
+  return res;
+}
+
+// binary copy (copy proc)
+//
+// The selected packets are written as runs of contiguous input bytes.
+// Long runs of a regular input file are copied by the kernel
+// (copy_file_range() to a file, splice() to a pipe), and the other runs
+// are written with writev(), straight from the reader buffers (the
+// mapping, or the ring).
+typedef struct copy_t {
+  int in_fd;
+  int out_fd;
+  bool use_copy_file_range;
+  bool use_splice;
+  // current run (input file offset is -1 if unknown)
+  const uint8_t *run_buf;
+  int64_t run_offset;
+  int64_t run_len;
+  // runs waiting for writev()
+  std::vector<struct iovec> iov;
+} copy_t;
+
+void mpegts_copy_init(copy_t *copy, FILE *fin, FILE *fout, status_t *status) {
+  struct stat in_st;
+  struct stat out_st;
+  copy->in_fd = fileno(fin);
+  copy->out_fd = fileno(fout);
+  bool in_file = copy->in_fd >= 0 && fstat(copy->in_fd, &in_st) == 0 &&
+                 S_ISREG(in_st.st_mode);
+  bool out_ok = copy->out_fd >= 0 && fstat(copy->out_fd, &out_st) == 0;
+  copy->use_copy_file_range = in_file && out_ok && S_ISREG(out_st.st_mode);
+  copy->use_splice = in_file && out_ok && S_ISFIFO(out_st.st_mode);
+  copy->run_buf = NULL;
+  copy->run_offset = -1;
+  copy->run_len = 0;
+  copy->iov.clear();
+}
+
+int mpegts_copy_writev(copy_t *copy) {
+  size_t i = 0;
+  while (i < copy->iov.size()) {
+    int num = std::min(copy->iov.size() - i, (size_t)IOV_MAX);
+    ssize_t res = writev(copy->out_fd, copy->iov.data() + i, num);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return -1;
+    }
+    // skip the written buffers (the last one may be partial)
+    while (res > 0 && res >= (ssize_t)copy->iov[i].iov_len) {
+      res -= copy->iov[i].iov_len;
+      ++i;
+    }
+    if (res > 0) {
+      copy->iov[i].iov_base =
+          reinterpret_cast<uint8_t *>(copy->iov[i].iov_base) + res;
+      copy->iov[i].iov_len -= res;
+    }
+  }
+  copy->iov.clear();
+  return 0;
+}
+
+// Write the current run. Returns 0 if successful, -1 otherwise.
+int mpegts_copy_flush_run(copy_t *copy) {
+  if (copy->run_len == 0) {
+    return 0;
+  }
+  int64_t done = 0;
+  if (copy->run_len >= COPY_KERNEL_MIN_SIZE && copy->run_offset >= 0 &&
+      (copy->use_copy_file_range || copy->use_splice)) {
+    // the pending writev() runs go first
+    if (mpegts_copy_writev(copy) < 0) {
+      return -1;
+    }
+    loff_t offset = copy->run_offset;
+    while (done < copy->run_len) {
+      size_t len = copy->run_len - done;
+      ssize_t res =
+          copy->use_copy_file_range
+              ? copy_file_range(copy->in_fd, &offset, copy->out_fd, NULL, len,
+                                0)
+              : splice(copy->in_fd, &offset, copy->out_fd, NULL, len,
+                       SPLICE_F_MORE);
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      if (res <= 0) {
+        // not supported (e.g. across filesystems): use writev()
+        copy->use_copy_file_range = false;
+        copy->use_splice = false;
+        break;
+      }
+      done += res;
+    }
+  }
+  if (done < copy->run_len) {
+    struct iovec iov;
+    iov.iov_base = const_cast<uint8_t *>(copy->run_buf + done);
+    iov.iov_len = copy->run_len - done;
+    copy->iov.push_back(iov);
+  }
+  copy->run_len = 0;
+  return (copy->iov.size() >= IOV_MAX) ? mpegts_copy_writev(copy) : 0;
+}
+
+// Write all the pending runs
+int mpegts_copy_flush(copy_t *copy) {
+  if (mpegts_copy_flush_run(copy) < 0 || mpegts_copy_writev(copy) < 0) {
+    fprintf(stderr, "error: cannot write output: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Add <len> bytes at <buf> (file offset <offset>, or -1) to the output
+int mpegts_copy_add(copy_t *copy, const uint8_t *buf, int64_t offset,
+                    int len) {
+  if (copy->run_len > 0 && buf == copy->run_buf + copy->run_len &&
+      (offset < 0 ? copy->run_offset < 0
+                  : offset == copy->run_offset + copy->run_len)) {
+    // contiguous: extend the run
+    copy->run_len += len;
+    return 0;
+  }
+  if (mpegts_copy_flush_run(copy) < 0) {
+    return -1;
+  }
+  copy->run_buf = buf;
+  copy->run_offset = offset;
+  copy->run_len = len;
+  return 0;
+}
+
+// Copy the selected packets in <chunk>. Returns 1 at the end of the
+// packet range, -1 on error, and 0 otherwise.
+int mpegts_copy_chunk(const Mpeg2TsChunk &chunk, int packet_size,
+                      Mpeg2TsReader *mpeg2ts_reader,
+                      Mpeg2TsParser *mpeg2ts_parser, Mpeg2Ts *mpeg2ts,
+                      bool *before_start_pts, status_t *status,
+                      copy_t *copy) {
+  int sync_offset = Mpeg2TsParser::SyncOffset(packet_size);
+  Mpeg2TsPacketView view;
+  view.SetPacketSize(packet_size);
+  for (int i = 0; i < chunk.count; ++i) {
+    int64_t pi = chunk.pi + i;
+    int64_t bi = chunk.bi + (i * packet_size);
+    const uint8_t *buf = chunk.buf + (i * packet_size);
+    // check the packet range
+    if ((status->end_byte >= 0 && bi >= status->end_byte) ||
+        (status->end_packet >= 0 && pi >= status->end_packet)) {
+      return 1;
+    }
+    if (bi < status->start_byte || pi < status->start_packet) {
+      continue;
+    }
+    int len = chunk.synced ? packet_size : chunk.len;
+    if (*before_start_pts || status->end_pts >= 0) {
+      // PTS values are only in packets starting a PES packet
+      int64_t pts = -1;
+      if (chunk.synced && (buf[sync_offset + 1] & 0x40) != 0) {
+        pts = mpegts_any_pts(&view, mpeg2ts_parser, pi, bi, buf, len, mpeg2ts,
+                             false);
+      }
+      if (status->end_pts >= 0 && pts >= status->end_pts) {
+        return 1;
+      }
+      if (*before_start_pts) {
+        if (pts < status->start_pts) {
+          continue;
+        }
+        *before_start_pts = false;
+      }
+    }
+    // non-parseable chunks have no PID
+    if (!status->pid_filter.Empty() &&
+        (!chunk.synced || !status->pid_filter.Select(buf, len))) {
+      continue;
+    }
+    if (mpegts_copy_add(copy, buf, mpeg2ts_reader->InputOffset(bi), len) <
+        0) {
+      fprintf(stderr, "error: cannot write output: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Move the reader to the next sampling window, <sample_stride> bytes
+// after the current one (starting at <window_bi>). The last window of
+// each input is moved to its end, so that the last PTS is sampled.
+// Returns 0 if successful, -1 otherwise.
+int mpegts_sample_next(Mpeg2TsReader *mpeg2ts_reader, int64_t window_bi,
+                       status_t *status) {
+  int64_t next = window_bi + status->sample_stride;
+  int64_t size = mpeg2ts_reader->InputSize();
+  if (size >= 0) {
+    int64_t tail =
+        size - status->sample_packets * mpeg2ts_reader->PacketSize();
+    if (next > tail) {
+      // the tail window, or the end of the input
+      next = (window_bi < tail) ? tail : size;
+    }
+  }
+  if (status->debug > 1) {
+    printf("sample: %" PRId64 " -> %" PRId64 "\n", window_bi, next);
+  }
+  // counting the packets in between would read them all: estimate the
+  // packet indices
+  status->pi_estimated = true;
+  return mpeg2ts_reader->SeekByte(next, false);
+}
+
+int mpegts_read_binary(status_t *status) {
+  FILE *fin = mpegts_open_input(status, 0);
+  if (fin == NULL) {
+    return -1;
+  }
+  int num_inputs = std::max((int)status->infile_l.size(), 1);
+
+  FILE *fout = stdout;
+  if (status->outfile != NULL && (strcmp(status->outfile, "-") != 0)) {
+    /* open outfile */
+    fout = fopen(status->outfile, "w+");
+    if (fout == NULL) {
+      fprintf(stderr, "error: cannot open outfile: %s\n", status->outfile);
+      return -1;
+    }
+  }
+
+  /* create mpeg2ts objects */
+  Mpeg2TsReader mpeg2ts_reader(fin, status->debug, status->reader_mode);
+  if (mpeg2ts_reader.SetSyncGap(status->sync_gap) < 0) {
+    fprintf(stderr, "error: cannot set sync gap to %i\n", status->sync_gap);
+    return -1;
+  }
+  mpeg2ts_reader.SetPacketSize(status->packet_size);
+  // only follow the last input
+  if (status->follow && num_inputs == 1 &&
+      mpeg2ts_reader.SetFollow(true) < 0) {
+    fprintf(stderr, "warning: cannot follow %s\n", mpegts_input_name(status));
+  }
+  Mpeg2TsParser mpeg2ts_parser(true);
+  Mpeg2Ts mpeg2ts;
+
+  // move to the start of the packet range (with several inputs, the
+  // packets before it are skipped instead)
+  if (num_inputs == 1 &&
+      mpegts_seek(&mpeg2ts_reader, &mpeg2ts_parser, status) < 0) {
+    fprintf(stderr, "error: cannot seek in %s\n", mpegts_input_name(status));
+    return -1;
+  }
+  bool before_start_pts = (status->start_pts >= 0);
+  // only parse the packets as deep as the output needs (after the seek,
+  // which needs the PTS)
+  status->parse_depth = mpegts_parse_depth(status);
+  mpeg2ts_parser.SetParseDepth(
+      (Mpeg2TsPacket::ParseDepth)status->parse_depth);
+  status->payload_mode = mpegts_payload_mode(status);
+  mpeg2ts_parser.SetPayloadMode(
+      (Mpeg2TsPacket::PayloadMode)status->payload_mode);
+  status->need_pmt =
+      status->proc == PROC_PES ||
+      (status->proc == PROC_DUMP &&
+       (std::find(status->dump_fields.begin(), status->dump_fields.end(),
+                  "type") != status->dump_fields.end() ||
+        std::find(status->dump_fields.begin(), status->dump_fields.end(),
+                  "syncframe") != status->dump_fields.end()));
+  // dumps of view fields, summaries, and PES packets do not need the
+  // protobuf
+  status->use_view =
+      (status->proc == PROC_SUMMARY || status->proc == PROC_PES);
+  if (status->proc == PROC_DUMP) {
+    status->use_view = true;
+    for (auto &s : status->dump_fields) {
+      if (std::find(ACCESSOR_VIEW_LIST.begin(), ACCESSOR_VIEW_LIST.end(), s) ==
+          ACCESSOR_VIEW_LIST.end()) {
+        status->use_view = false;
+      }
+    }
+  }
+  if (status->sample_packets > 0 && status->follow) {
+    fprintf(stderr, "error: cannot sample a followed input\n");
+    return -1;
+  }
+  if (status->sample_packets > 0 &&
+      (status->start_packet >= 0 || status->end_packet >= 0)) {
+    // the packet indices are estimated after the first sampling window
+    fprintf(stderr, "error: cannot use packet bounds with --sample\n");
+    return -1;
+  }
+
+  // write output header
+  if (status->proc == PROC_DUMP) {
+    char buf[1024] = {0};
+    int bi = 0;
+    for (auto &s : status->dump_fields) {
+      bi += snprintf(buf + bi, sizeof(buf) - bi, "%s,", s.c_str());
+    }
+    // remove last comma
+    buf[bi - 1] = '\0';
+    fprintf(fout, "%s\n", buf);
+  } else if (status->proc == PROC_PES) {
+    fprintf(fout, "%s\n", PES_LINE_HEADER);
+  }
+
+  // binary copy: write straight to the output descriptor
+  copy_t copy;
+  if (status->proc == PROC_COPY) {
+    fflush(fout);
+    mpegts_copy_init(&copy, fin, fout, status);
+  }
+
+  // split a single (seekable) input in shards, processed in parallel
+  if (status->jobs > 1 && num_inputs == 1 && !status->follow &&
+      status->start_pts < 0 && status->sample_packets == 0 &&
+      !status->pid_filter.HasPrograms() && status->proc != PROC_COPY &&
+      status->proc != PROC_SUMMARY && status->proc != PROC_PES) {
+    int64_t size = mpeg2ts_reader.InputSize();
+    if (size >= 0) {
+      int res = mpegts_read_shards(&mpeg2ts_reader, fileno(fin), size,
+                                   status, fout);
+      mpeg2ts_reader.Close();
+      fclose(fin);
+      fclose(fout);
+      return res;
+    }
+    if (status->debug > 0) {
+      fprintf(stderr, "warning: %s is not seekable: using 1 job\n",
+              mpegts_input_name(status));
+    }
+  }
+  // sampling: packets left in the current window, and its start
+  int64_t sample_left = status->sample_packets;
+  int64_t window_bi = -1;
+  Mpeg2TsChunk chunk;
+  int len;
+  int batch_size = PACKET_BATCH_SIZE;
+  while ((len = mpeg2ts_reader.GetPackets(batch_size, &chunk)) >= 0) {
+    if (len == 0) {
+      // end of the input: continue with the next one
+      if (status->infile_index + 1 >= num_inputs) {
+        break;
+      }
+      if (mpegts_check_input(mpeg2ts_reader, status) < 0) {
+        return -1;
+      }
+      if (status->proc == PROC_COPY && mpegts_copy_flush(&copy) < 0) {
+        return -1;
+      }
+      if (status->proc == PROC_PES) {
+        mpegts_pes_flush(status, fout);
+      }
+      // the reader threads may still read ahead from the input
+      mpeg2ts_reader.Close();
+      fclose(fin);
+      fin = mpegts_open_input(status, status->infile_index + 1);
+      if (fin == NULL || mpeg2ts_reader.SetInput(fin) < 0) {
+        return -1;
+      }
+      if (status->proc == PROC_COPY) {
+        mpegts_copy_init(&copy, fin, fout, status);
+      }
+      sample_left = status->sample_packets;
+      window_bi = -1;
+      batch_size = PACKET_BATCH_SIZE;
+      if (status->follow && status->infile_index + 1 == num_inputs &&
+          mpeg2ts_reader.SetFollow(true) < 0) {
+        fprintf(stderr, "warning: cannot follow %s\n",
+                mpegts_input_name(status));
+      }
+      continue;
+    }
+    int packet_size = mpeg2ts_reader.PacketSize();
+    mpeg2ts_parser.SetPacketSize(packet_size);
+    status->pid_filter.SetPacketSize(packet_size);
+    status->pes_assembler.SetPacketSize(packet_size);
+    // process all the packets in the chunk
+    int res;
+    if (status->proc == PROC_COPY) {
+      res = mpegts_copy_chunk(chunk, packet_size, &mpeg2ts_reader,
+                              &mpeg2ts_parser, &mpeg2ts, &before_start_pts,
+                              status, &copy);
+      // the ring data is only valid until Next()
+      if (res == 0 && !mpeg2ts_reader.IsMapped() &&
+          mpegts_copy_flush(&copy) < 0) {
+        res = -1;
+      }
+    } else {
+      res = mpegts_process_chunk(chunk, packet_size, 0, &mpeg2ts_parser,
+                                 &mpeg2ts, &before_start_pts, status, fout);
+    }
+    if (res < 0) {
+      return -1;
+    }
+    if (res > 0) {
+      break;
+    }
+    if (status->follow) {
+      // the next read may wait for more data
+      fflush(fout);
+    }
+    mpeg2ts_reader.Next(chunk);
+    if (status->sample_packets > 0) {
+      if (window_bi < 0) {
+        window_bi = chunk.bi;
+      }
+      sample_left -= chunk.count;
+      if (sample_left <= 0) {
+        status->summary.windows += 1;
+        if (mpegts_sample_next(&mpeg2ts_reader, window_bi, status) < 0) {
+          fprintf(stderr, "error: cannot seek in %s\n",
+                  mpegts_input_name(status));
+          return -1;
+        }
+        sample_left = status->sample_packets;
+        window_bi = -1;
+        // the PES packets in progress do not continue after the seek
+        status->pes_assembler.Reset();
+      }
+      batch_size = std::min((int64_t)PACKET_BATCH_SIZE, sample_left);
+    }
+  }
+
+  if (status->proc == PROC_COPY && mpegts_copy_flush(&copy) < 0) {
+    return -1;
+  }
+  if (status->proc == PROC_PES) {
+    mpegts_pes_flush(status, fout);
+  }
+  if (status->proc == PROC_SUMMARY) {
+    if (sample_left < status->sample_packets) {
+      // last (partial) window
+      status->summary.windows += 1;
+    }
+    // size of the packet range
+    int64_t size = mpeg2ts_reader.InputSize();
+    if (size >= 0 && status->end_byte >= 0) {
+      size = std::min(size, status->end_byte);
+    }
+    if (size >= 0 && status->start_byte > 0) {
+      size = std::max(size - status->start_byte, (int64_t)0);
+    }
+    mpegts_summary_print(status->summary, size, mpeg2ts_reader.PacketSize(),
+                         status, fout);
+  }
+
+  /* close in/out files (after stopping the reader threads) */
+  mpeg2ts_reader.Close();
+  fclose(fin);
+  fclose(fout);
+
+  if (len < 0 && mpeg2ts_reader.Error() == NULL) {
+    // lost sync (not after an input error, which is reported instead)
+    fprintf(stderr, "error: lost sync of %s at byte %" PRId64 "\n",
+            mpegts_input_name(status), chunk.bi);
+    return -1;
+  }
+  return mpegts_check_input(mpeg2ts_reader, status);
 }
 
 int mpegts_read_text(status_t *status) {
@@ -548,7 +2633,7 @@ int mpegts_read_text(status_t *status) {
       exit(-1);
     }
     // write binary protobuf
-    uint8_t out[MPEG_TS_PACKET_SIZE];
+    uint8_t out[MPEG_TS_MAX_PACKET_SIZE];
     int outlen = mpeg2ts_parser.DumpPacket(mpeg2ts, out, sizeof(out));
     if (outlen < 0) {
       printf("Failed to dump protobuf: \"%s\"\n",
@@ -581,15 +2666,27 @@ int main(int argc, char **argv) {
     printf("status->proc = %i\n", status->proc);
     printf("status->debug = %i\n", status->debug);
     printf("status->sync_gap = %i\n", status->sync_gap);
+    printf("status->reader_mode = %i\n", status->reader_mode);
+    printf("status->packet_size = %i\n", status->packet_size);
+    printf("sync scanner: %s\n", find_sync_point_impl());
     printf("status->ignore_pts_delta = %i\n", status->ignore_pts_delta);
     printf("status->allow_raw_packets = %i\n", status->allow_raw_packets);
+    printf("status->follow = %i\n", status->follow);
+    printf("status->jobs = %i\n", status->jobs);
+    printf("status->sample_packets = %" PRId64 "\n", status->sample_packets);
+    printf("status->sample_stride = %" PRId64 "\n", status->sample_stride);
+    printf("status->pid_filter = %s\n",
+           status->pid_filter.Empty() ? "none" : "set");
+    for (i = 0; i < (int)status->infile_l.size(); ++i)
+      printf("status->infile_l[%i] = %s\n", i, status->infile_l[i].c_str());
     printf("status->nrem = %i\n", status->nrem);
     for (i = 0; i < status->nrem; ++i)
       printf("status->rem[%i] = %s\n", i, status->rem[i]);
   }
 
   if ((status->proc == PROC_TOTXT) || (status->proc == PROC_TEST) ||
-      (status->proc == PROC_DUMP)) {
+      (status->proc == PROC_DUMP) || (status->proc == PROC_COPY) ||
+      (status->proc == PROC_SUMMARY) || (status->proc == PROC_PES)) {
     return mpegts_read_binary(status);
   }
 
@@ -5,11 +5,39 @@
 
 #define MPEG_TS_PACKET_SYNC 0x47  // 'G'
 #define MPEG_TS_PACKET_SIZE 188
+#define M2TS_PACKET_SIZE 192
+#define FEC_PACKET_SIZE 204
+#define MPEG_TS_MAX_PACKET_SIZE FEC_PACKET_SIZE
 #define MPEG_TS_SYNC_IN_A_ROW 3
+#define MPEG_TS_PID_MAX 0x1fff
 
 // synchronization parameters
 #define DEFAULT_MAXIMUM_SYNC_GAP (10 * MPEG_TS_PACKET_SIZE)
 #define SYNC_GAP_MINIMUM MPEG_TS_PACKET_SIZE
-#define SYNC_GAP_MAXIMUM (100 * MPEG_TS_PACKET_SIZE)
+#define SYNC_GAP_MAXIMUM (10000 * MPEG_TS_PACKET_SIZE)
+
+// maximum number of packets read from the reader at once
+#define PACKET_BATCH_SIZE 256
+
+// PTS seeking: bisect until the byte range is smaller than the window,
+// landing at least the margin (in 90 kHz units) before the target PTS
+#define PTS_BISECT_WINDOW (1 << 20)
+#define PTS_SEEK_MARGIN 90000
+// maximum number of packets read looking for a PTS/PCR sample
+#define PTS_PROBE_PACKETS 10000
+
+// parallel processing (--jobs): the input is split in shards of (up to)
+// PARALLEL_SHARD_SIZE bytes, with up to PARALLEL_SHARDS_PER_JOB shards
+// (and their buffered output) in flight per job
+#define PARALLEL_SHARD_SIZE (16 << 20)
+#define PARALLEL_MIN_SHARD_SIZE (1 << 20)
+#define PARALLEL_SHARDS_PER_JOB 2
+
+// binary copy: minimum run size copied by the kernel (copy_file_range
+// or splice), instead of writev
+#define COPY_KERNEL_MIN_SIZE (64 * 1024)
+
+// sampling (--sample): default distance between the windows (bytes)
+#define DEFAULT_SAMPLE_STRIDE (64 << 20)
 
 #endif  // M2PB_H_
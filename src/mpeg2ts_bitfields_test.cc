@@ -0,0 +1,142 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_bitfields.h"
+
+#include <gtest/gtest.h>
+#include <string.h>  // for memset
+
+#include "mpeg2ts.pb.h"
+#include "mpeg2ts_parser.h"
+
+// the header fields, decoded by hand from the ISO/IEC 13818-1 layout
+static void CheckHeader(const uint8_t *buf, const Mpeg2TsHeader &header) {
+  EXPECT_EQ((buf[1] & 0x80) != 0, header.transport_error_indicator());
+  EXPECT_EQ((buf[1] & 0x40) != 0, header.payload_unit_start_indicator());
+  EXPECT_EQ((buf[1] & 0x20) != 0, header.transport_priority());
+  EXPECT_EQ(((buf[1] & 0x1f) << 8) | buf[2], header.pid());
+  EXPECT_EQ(buf[3] >> 6, header.transport_scrambling_control());
+  EXPECT_EQ((buf[3] & 0x20) != 0, header.adaptation_field_exists());
+  EXPECT_EQ((buf[3] & 0x10) != 0, header.payload_exists());
+  EXPECT_EQ(buf[3] & 0x0f, header.continuity_counter());
+}
+
+TEST(Mpeg2TsBitfieldsTest, ParseHeader) {
+  const uint8_t buf[] = {0x47, 0x5f, 0xff, 0xa7};
+  Mpeg2TsHeader header;
+  EXPECT_EQ(4, ParseMpeg2TsHeaderBits(buf, sizeof(buf), &header));
+  EXPECT_FALSE(header.transport_error_indicator());
+  EXPECT_TRUE(header.payload_unit_start_indicator());
+  EXPECT_FALSE(header.transport_priority());
+  EXPECT_EQ(0x1fff, header.pid());
+  EXPECT_EQ(2, header.transport_scrambling_control());
+  EXPECT_TRUE(header.adaptation_field_exists());
+  EXPECT_FALSE(header.payload_exists());
+  EXPECT_EQ(7, header.continuity_counter());
+  // too short
+  EXPECT_EQ(-1, ParseMpeg2TsHeaderBits(buf, 3, &header));
+  // no sync byte
+  const uint8_t nosync[] = {0x46, 0x5f, 0xff, 0xa7};
+  EXPECT_EQ(-1, ParseMpeg2TsHeaderBits(nosync, sizeof(nosync), &header));
+}
+
+TEST(Mpeg2TsBitfieldsTest, DumpHeader) {
+  Mpeg2TsHeader header;
+  uint8_t buf[4];
+  memset(buf, 0xaa, sizeof(buf));
+  // all fields are required
+  header.set_transport_error_indicator(true);
+  header.set_payload_unit_start_indicator(false);
+  header.set_transport_priority(true);
+  header.set_pid(0x1234);
+  header.set_transport_scrambling_control(1);
+  header.set_adaptation_field_exists(false);
+  header.set_payload_exists(true);
+  EXPECT_EQ(-1, DumpMpeg2TsHeaderBits(header, buf, sizeof(buf)));
+  header.set_continuity_counter(0xc);
+  // too short
+  EXPECT_EQ(-1, DumpMpeg2TsHeaderBits(header, buf, 3));
+  EXPECT_EQ(4, DumpMpeg2TsHeaderBits(header, buf, sizeof(buf)));
+  // the sync byte is a marker
+  EXPECT_EQ(MPEG_TS_PACKET_SYNC, buf[0]);
+  EXPECT_EQ(0xb2, buf[1]);
+  EXPECT_EQ(0x34, buf[2]);
+  EXPECT_EQ(0x5c, buf[3]);
+  // values are truncated to their width
+  header.set_pid(0xe001);
+  header.set_continuity_counter(0x13);
+  EXPECT_EQ(4, DumpMpeg2TsHeaderBits(header, buf, sizeof(buf)));
+  EXPECT_EQ(0xa0, buf[1]);
+  EXPECT_EQ(0x01, buf[2]);
+  EXPECT_EQ(0x53, buf[3]);
+}
+
+// every header parses to the fields of the spec, and dumps back to
+// the same bytes
+TEST(Mpeg2TsBitfieldsTest, RoundTrip) {
+  Mpeg2TsHeader header;
+  for (uint32_t flags = 0; flags < (1 << 24); flags += 0xfb) {
+    const uint8_t buf[4] = {MPEG_TS_PACKET_SYNC, (uint8_t)(flags >> 16),
+                            (uint8_t)(flags >> 8), (uint8_t)flags};
+    header.Clear();
+    ASSERT_EQ(4, ParseMpeg2TsHeaderBits(buf, sizeof(buf), &header));
+    CheckHeader(buf, header);
+    uint8_t out[4] = {0, 0, 0, 0};
+    ASSERT_EQ(4, DumpMpeg2TsHeaderBits(header, out, sizeof(out)));
+    ASSERT_EQ(0, memcmp(buf, out, sizeof(buf))) << "flags: " << flags;
+  }
+}
+
+TEST(Mpeg2TsBitfieldsTest, PCR) {
+  // base 0x1abcdef01, extension 0x123
+  const uint8_t buf[] = {0xd5, 0xe6, 0xf7, 0x80, 0xff, 0x23};
+  PCR pcr;
+  EXPECT_EQ(6, ParsePCRBits(buf, sizeof(buf), &pcr));
+  EXPECT_EQ(0x1abcdef01LL, pcr.base());
+  EXPECT_EQ(0x123, pcr.extension());
+  EXPECT_EQ(-1, ParsePCRBits(buf, 5, &pcr));
+  // the reserved bits must be set
+  const uint8_t reserved[] = {0xd5, 0xe6, 0xf7, 0x80, 0xfd, 0x23};
+  EXPECT_EQ(-1, ParsePCRBits(reserved, sizeof(reserved), &pcr));
+
+  uint8_t out[6];
+  EXPECT_EQ(-1, DumpPCRBits(pcr, out, 5));
+  EXPECT_EQ(6, DumpPCRBits(pcr, out, sizeof(out)));
+  EXPECT_EQ(0, memcmp(buf, out, sizeof(buf)));
+  // full-width values
+  pcr.set_base((1LL << 33) - 1);
+  pcr.set_extension(0x1ff);
+  EXPECT_EQ(6, DumpPCRBits(pcr, out, sizeof(out)));
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(0xff, out[i]);
+  }
+  pcr.set_base(0);
+  pcr.set_extension(0);
+  EXPECT_EQ(6, DumpPCRBits(pcr, out, sizeof(out)));
+  const uint8_t zero[] = {0x00, 0x00, 0x00, 0x00, 0x7e, 0x00};
+  EXPECT_EQ(0, memcmp(zero, out, sizeof(zero)));
+  // all fields are required
+  pcr.clear_extension();
+  EXPECT_EQ(-1, DumpPCRBits(pcr, out, sizeof(out)));
+}
+
+// PCR values dump to the spec layout, and parse back
+TEST(Mpeg2TsBitfieldsTest, PCRRoundTrip) {
+  PCR pcr;
+  PCR parsed;
+  for (int64_t base = 0; base < (1LL << 33); base += 0x1234567) {
+    for (int extension = 0; extension < 300; extension += 7) {
+      pcr.set_base(base);
+      pcr.set_extension(extension);
+      uint8_t out[6];
+      ASSERT_EQ(6, DumpPCRBits(pcr, out, sizeof(out)));
+      // base[32:1], base[0], reserved, extension[8], extension[7:0]
+      EXPECT_EQ((uint8_t)(base >> 25), out[0]);
+      EXPECT_EQ((uint8_t)(base >> 1), out[3]);
+      EXPECT_EQ(((base & 1) << 7) | 0x7e | (extension >> 8), out[4]);
+      EXPECT_EQ(extension & 0xff, out[5]);
+      ASSERT_EQ(6, ParsePCRBits(out, sizeof(out), &parsed));
+      EXPECT_EQ(base, parsed.base());
+      EXPECT_EQ(extension, parsed.extension());
+    }
+  }
+}
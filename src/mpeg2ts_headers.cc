@@ -0,0 +1,121 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_headers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "mpeg2ts_parser.h"
+
+int decode_headers_scalar(const uint8_t *buf, int count, int stride,
+                          uint16_t *pid, uint8_t *cc, uint8_t *flags) {
+  int synced = 0;
+  for (int k = 0; k < count; ++k) {
+    const uint8_t *header = buf + (long)k * stride;
+    bool sync = (header[0] == MPEG_TS_PACKET_SYNC);
+    pid[k] = ((header[1] & 0x1f) << 8) | header[2];
+    cc[k] = header[3] & 0x0f;
+    flags[k] = (header[1] & 0xe0) | (sync ? 0 : MPEG_TS_HEADER_FLAG_NO_SYNC) |
+               (header[3] >> 4);
+    synced += sync;
+  }
+  return synced;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Gather the (little-endian) 32-bit header words of 8 packets at once,
+// extract the fields with shifts and masks, and narrow the 32-bit lanes
+// into the 16-bit (PID) and 8-bit (CC, flags) arrays.
+
+__attribute__((target("avx2"))) int decode_headers_avx2(const uint8_t *buf,
+                                                        int count, int stride,
+                                                        uint16_t *pid,
+                                                        uint8_t *cc,
+                                                        uint8_t *flags) {
+  const __m256i offsets =
+      _mm256_mullo_epi32(_mm256_set1_epi32(stride),
+                         _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  const __m256i byte_mask = _mm256_set1_epi32(0xff);
+  const __m256i sync = _mm256_set1_epi32(MPEG_TS_PACKET_SYNC);
+  int synced = 0;
+  int k = 0;
+  for (; k + 8 <= count; k += 8) {
+    const uint8_t *base = buf + (long)k * stride;
+    __m256i word = _mm256_i32gather_epi32(reinterpret_cast<const int *>(base),
+                                          offsets, 1);
+    // pid: (byte1 & 0x1f) << 8 | byte2
+    __m256i pid32 = _mm256_or_si256(
+        _mm256_and_si256(word, _mm256_set1_epi32(0x1f00)),
+        _mm256_and_si256(_mm256_srli_epi32(word, 16), byte_mask));
+    // cc: byte3 & 0x0f
+    __m256i cc32 =
+        _mm256_and_si256(_mm256_srli_epi32(word, 24), _mm256_set1_epi32(0x0f));
+    // flags: (byte1 & 0xe0) | no_sync | byte3 >> 4
+    __m256i is_sync =
+        _mm256_cmpeq_epi32(_mm256_and_si256(word, byte_mask), sync);
+    __m256i no_sync = _mm256_andnot_si256(
+        is_sync, _mm256_set1_epi32(MPEG_TS_HEADER_FLAG_NO_SYNC));
+    __m256i flags32 = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(word, 8),
+                             _mm256_set1_epi32(0xe0)),
+            _mm256_srli_epi32(word, 28)),
+        no_sync);
+    synced +=
+        __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(is_sync)));
+    // narrow: packus works within 128-bit lanes, so the 64-bit quarters
+    // are put back in order with a permute
+    __m256i pid16 = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(pid32, pid32), 0xd8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pid + k),
+                     _mm256_castsi256_si128(pid16));
+    __m256i ccflags16 = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(cc32, flags32), 0xd8);
+    __m128i ccflags8 =
+        _mm_packus_epi16(_mm256_castsi256_si128(ccflags16),
+                         _mm256_extracti128_si256(ccflags16, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(cc + k), ccflags8);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(flags + k),
+                     _mm_srli_si128(ccflags8, 8));
+  }
+  // tail
+  synced += decode_headers_scalar(buf + (long)k * stride, count - k, stride,
+                                  pid + k, cc + k, flags + k);
+  return synced;
+}
+
+#endif
+
+typedef int (*decode_headers_func)(const uint8_t *buf, int count, int stride,
+                                   uint16_t *pid, uint8_t *cc, uint8_t *flags);
+
+// the implementation used by decode_headers(), and its name
+typedef struct decode_headers_best_t {
+  decode_headers_func func;
+  const char *name;
+} decode_headers_best_t;
+
+static decode_headers_best_t select_decode_headers() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {decode_headers_avx2, "avx2"};
+  }
+#endif
+  return {decode_headers_scalar, "scalar"};
+}
+
+// selected on first use (see find_sync_point())
+static const decode_headers_best_t &decode_headers_best() {
+  static const decode_headers_best_t best = select_decode_headers();
+  return best;
+}
+
+int decode_headers(const uint8_t *buf, int count, int stride, uint16_t *pid,
+                   uint8_t *cc, uint8_t *flags) {
+  return decode_headers_best().func(buf, count, stride, pid, cc, flags);
+}
+
+const char *decode_headers_impl() { return decode_headers_best().name; }
@@ -0,0 +1,56 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef MPEG2TS_HEADERS_H_
+#define MPEG2TS_HEADERS_H_
+
+#include <stdint.h>  // for uint8_t, uint16_t
+
+// Batch decoding of the 4-byte mpeg-ts headers of a run of packets, into
+// structure-of-arrays output: per-packet statistics (PID counts, CC
+// checks, PUSI indexing) then only touch the arrays they need.
+//
+// The flags of each packet are:
+//   bit 7: transport_error_indicator
+//   bit 6: payload_unit_start_indicator
+//   bit 5: transport_priority
+//   bit 4: set if the packet does not start with a sync byte (the other
+//          fields are then meaningless, and Mpeg2TsParser::ParseHeader()
+//          would fail)
+//   bits 3-2: transport_scrambling_control
+//   bit 1: adaptation_field_exists
+//   bit 0: payload_exists
+// i.e. the high 3 bits of the second header byte, and the high 4 bits of
+// the fourth one.
+#define MPEG_TS_HEADER_FLAG_TEI 0x80
+#define MPEG_TS_HEADER_FLAG_PUSI 0x40
+#define MPEG_TS_HEADER_FLAG_PRIORITY 0x20
+#define MPEG_TS_HEADER_FLAG_NO_SYNC 0x10
+#define MPEG_TS_HEADER_FLAG_SCRAMBLING 0x0c
+#define MPEG_TS_HEADER_FLAG_ADAPTATION_FIELD 0x02
+#define MPEG_TS_HEADER_FLAG_PAYLOAD 0x01
+
+// Decodes the headers of <count> packets, <stride> bytes apart, where
+// buf points to the sync byte of the first one (i.e. after the
+// TP_extra_header of 192-byte packets). Writes the PID, continuity
+// counter and flags of packet k in pid[k], cc[k] and flags[k]. Returns
+// the number of packets that start with a sync byte. The caller must
+// ensure that the 4 header bytes of the last packet can be read.
+//
+// The implementation (AVX2 or scalar) is selected at runtime depending
+// on the CPU.
+int decode_headers(const uint8_t *buf, int count, int stride, uint16_t *pid,
+                   uint8_t *cc, uint8_t *flags);
+
+// Returns the name of the implementation used by decode_headers().
+const char *decode_headers_impl();
+
+// Per-implementation versions. The SIMD one must only be called if the
+// CPU supports it.
+int decode_headers_scalar(const uint8_t *buf, int count, int stride,
+                          uint16_t *pid, uint8_t *cc, uint8_t *flags);
+#if defined(__x86_64__) || defined(__i386__)
+int decode_headers_avx2(const uint8_t *buf, int count, int stride,
+                        uint16_t *pid, uint8_t *cc, uint8_t *flags);
+#endif
+
+#endif  // MPEG2TS_HEADERS_H_
@@ -0,0 +1,91 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_headers.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>  // for rand
+
+#include <vector>
+
+#include "mpeg2ts.pb.h"
+#include "mpeg2ts_parser.h"
+
+// exposes the header parser, which the batch decoder must match
+class HeaderParser : public Mpeg2TsParser {
+ public:
+  HeaderParser() : Mpeg2TsParser(false) {}
+  using Mpeg2TsParser::ParseHeader;
+};
+
+typedef int (*decode_headers_func)(const uint8_t *buf, int count, int stride,
+                                   uint16_t *pid, uint8_t *cc, uint8_t *flags);
+
+// decode <count> random headers with <func>, and check them against
+// Mpeg2TsParser::ParseHeader()
+static void CheckDecoder(decode_headers_func func, int count, int stride) {
+  std::vector<uint8_t> buf(count * stride);
+  for (auto &b : buf) {
+    b = rand() & 0xff;
+  }
+  int expected_synced = 0;
+  for (int k = 0; k < count; ++k) {
+    if (rand() % 8 != 0) {
+      buf[k * stride] = MPEG_TS_PACKET_SYNC;
+    }
+  }
+  std::vector<uint16_t> pid(count);
+  std::vector<uint8_t> cc(count);
+  std::vector<uint8_t> flags(count);
+  int synced = func(buf.data(), count, stride, pid.data(), cc.data(),
+                    flags.data());
+  HeaderParser parser;
+  for (int k = 0; k < count; ++k) {
+    Mpeg2TsHeader header;
+    if (parser.ParseHeader(buf.data() + k * stride, 4, &header) < 0) {
+      EXPECT_NE(0, flags[k] & MPEG_TS_HEADER_FLAG_NO_SYNC) << k;
+      continue;
+    }
+    expected_synced += 1;
+    EXPECT_EQ(0, flags[k] & MPEG_TS_HEADER_FLAG_NO_SYNC) << k;
+    EXPECT_EQ(header.pid(), pid[k]) << k;
+    EXPECT_EQ(header.continuity_counter(), cc[k]) << k;
+    EXPECT_EQ(header.transport_error_indicator(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_TEI) != 0)
+        << k;
+    EXPECT_EQ(header.payload_unit_start_indicator(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_PUSI) != 0)
+        << k;
+    EXPECT_EQ(header.transport_priority(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_PRIORITY) != 0)
+        << k;
+    EXPECT_EQ(header.transport_scrambling_control(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_SCRAMBLING) >> 2)
+        << k;
+    EXPECT_EQ(header.adaptation_field_exists(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_ADAPTATION_FIELD) != 0)
+        << k;
+    EXPECT_EQ(header.payload_exists(),
+              (flags[k] & MPEG_TS_HEADER_FLAG_PAYLOAD) != 0)
+        << k;
+  }
+  EXPECT_EQ(expected_synced, synced);
+}
+
+TEST(DecodeHeadersTest, AllImplementationsMatchParser) {
+  srand(1);
+  const int stride_arr[] = {MPEG_TS_PACKET_SIZE, M2TS_PACKET_SIZE,
+                            FEC_PACKET_SIZE};
+  for (int stride : stride_arr) {
+    // batch sizes around the SIMD width (to cover the scalar tail)
+    for (int count = 0; count < 40; ++count) {
+      CheckDecoder(decode_headers, count, stride);
+      CheckDecoder(decode_headers_scalar, count, stride);
+#if defined(__x86_64__) || defined(__i386__)
+      if (__builtin_cpu_supports("avx2")) {
+        CheckDecoder(decode_headers_avx2, count, stride);
+      }
+#endif
+    }
+  }
+  EXPECT_NE(nullptr, decode_headers_impl());
+}
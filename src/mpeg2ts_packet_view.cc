@@ -0,0 +1,300 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_packet_view.h"
+
+#include <stddef.h>  // for NULL
+
+Mpeg2TsPacketView::Mpeg2TsPacketView()
+    : buf_(NULL),
+      len_(0),
+      packet_size_(MPEG_TS_PACKET_SIZE),
+      ts_(NULL),
+      ts_len_(0),
+      extra_header_(false),
+      valid_header_(false),
+      layout_parsed_(false),
+      supported_(false) {}
+
+int Mpeg2TsPacketView::SetPacketSize(int packet_size) {
+  if (!Mpeg2TsParser::IsValidPacketSize(packet_size)) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  return 0;
+}
+
+void Mpeg2TsPacketView::Reset(const uint8_t *buf, int len) {
+  buf_ = buf;
+  len_ = len;
+  // same framing as Mpeg2TsParser::ParsePacket()
+  ts_len_ = Mpeg2TsParser::FramePacket(packet_size_, buf, len, &ts_);
+  extra_header_ = ts_ != buf;
+  valid_header_ = (ts_len_ >= 4 && ts_[0] == MPEG_TS_PACKET_SYNC);
+  layout_parsed_ = false;
+}
+
+bool Mpeg2TsPacketView::Supported() {
+  ParseLayout();
+  return supported_;
+}
+
+void Mpeg2TsPacketView::ParseLayout() {
+  if (layout_parsed_) {
+    return;
+  }
+  layout_parsed_ = true;
+  supported_ = false;
+  adaptation_field_length_ = -1;
+  pcr_offset_ = -1;
+  is_pes_ = false;
+  is_psi_ = false;
+  pts_offset_ = -1;
+  dts_offset_ = -1;
+  data_offset_ = -1;
+  if (!valid_header_) {
+    return;
+  }
+  int bi = 4;
+  if (AdaptationFieldExists()) {
+    bi = ParseAdaptationField(bi);
+    if (bi < 0) {
+      return;
+    }
+  }
+  if (PayloadUnitStartIndicator()) {
+    // the parser needs the start code to tell PES from PSI
+    if (bi + 3 > ts_len_) {
+      return;
+    }
+    if (ts_[bi] == 0 && ts_[bi + 1] == 0 && ts_[bi + 2] == 1) {
+      is_pes_ = true;
+      bi = ParsePesHeader(bi);
+      if (bi < 0) {
+        return;
+      }
+    } else {
+      // PSI sections are left to the parser
+      is_psi_ = true;
+      return;
+    }
+  }
+  data_offset_ = bi;
+  supported_ = true;
+}
+
+// Returns the offset after the adaptation field at <bi>, or -1 if the
+// parser would reject it (or it has fields the view does not support)
+int Mpeg2TsPacketView::ParseAdaptationField(int bi) {
+  if (ts_len_ - bi < 1) {
+    return -1;
+  }
+  int adaptation_field_length = ts_[bi];
+  if (ts_len_ - bi < 1 + adaptation_field_length) {
+    return -1;
+  }
+  adaptation_field_length_ = adaptation_field_length;
+  if (adaptation_field_length == 0) {
+    return bi + 1;
+  }
+  int flags = ts_[bi + 1];
+  int i = bi + 2;
+  // PCR and OPCR (with the same checks as the parser)
+  for (int mask : {0x10, 0x08}) {
+    if ((flags & mask) == 0) {
+      continue;
+    }
+    if (ts_len_ - i < 6 || ((ts_[i + 4] & 0x7e) >> 1) != 0x3f) {
+      return -1;
+    }
+    if (mask == 0x10) {
+      pcr_offset_ = i;
+    }
+    i += 6;
+  }
+  // transport private data and adaptation field extension are left to
+  // the parser
+  if ((flags & 0x03) != 0) {
+    return -1;
+  }
+  return bi + 1 + adaptation_field_length;
+}
+
+// Returns the offset of the data bytes after the PES header at <bi>,
+// or -1 if the parser would reject it (or it has fields the view does
+// not support)
+int Mpeg2TsPacketView::ParsePesHeader(int bi) {
+  if (ts_len_ - bi < 6) {
+    return -1;
+  }
+  int stream_id = ts_[bi + 3];
+  switch (stream_id) {
+    case 0xbc:  // program_stream_map
+    case 0xbe:  // padding_stream
+    case 0xbf:  // private_stream_2
+    case 0xf0:  // ECM
+    case 0xf1:  // EMM
+    case 0xf2:  // DSMCC
+    case 0xf8:  // ITU-T Rec. H.222.1 type E
+    case 0xff:  // program_stream_directory
+      // no optional PES header: left to the parser
+      return -1;
+    default:
+      break;
+  }
+  int i = bi + 6;
+  if (ts_len_ - i < 3) {
+    return -1;
+  }
+  int flags = ts_[i + 1];
+  int pes_header_data_length = ts_[i + 2];
+  i += 3;
+  int fixed_i = i;
+  if (flags & 0x80) {
+    if (!CheckPts(i)) {
+      return -1;
+    }
+    pts_offset_ = i;
+    i += 5;
+  }
+  if (flags & 0x40) {
+    if (!CheckPts(i)) {
+      return -1;
+    }
+    dts_offset_ = i;
+    i += 5;
+  }
+  // ESCR, ES rate, DSM trick mode, additional copy info, CRC, and PES
+  // extension are left to the parser
+  if ((flags & 0x3f) != 0) {
+    return -1;
+  }
+  // skip stuffing bytes
+  if (i < fixed_i + pes_header_data_length) {
+    i = fixed_i + pes_header_data_length;
+  }
+  return i;
+}
+
+bool Mpeg2TsPacketView::CheckPts(int bi) const {
+  if (ts_len_ - bi < 5) {
+    return false;
+  }
+  int guard = (ts_[bi] & 0xf0) >> 4;
+  if (guard != 1 && guard != 2 && guard != 3) {
+    return false;
+  }
+  // markers
+  return (ts_[bi] & 0x01) && (ts_[bi + 2] & 0x01) && (ts_[bi + 4] & 0x01);
+}
+
+int64_t Mpeg2TsPacketView::GetPts(int bi) const {
+  const uint8_t *buf = ts_ + bi;
+  return ((((int64_t)(buf[0]) & 0x0e) << 29) | ((int64_t)(buf[1]) << 22) |
+          (((int64_t)(buf[2]) & 0xfe) << 14) | ((int64_t)(buf[3]) << 7) |
+          (((int64_t)(buf[4]) & 0xfe) >> 1));
+}
+
+int Mpeg2TsPacketView::AdaptationFieldLength() {
+  ParseLayout();
+  return adaptation_field_length_;
+}
+
+bool Mpeg2TsPacketView::HasAdaptationFieldFlags() {
+  ParseLayout();
+  return adaptation_field_length_ > 0;
+}
+
+bool Mpeg2TsPacketView::DiscontinuityIndicator() {
+  return HasAdaptationFieldFlags() && (ts_[5] & 0x80) != 0;
+}
+
+bool Mpeg2TsPacketView::RandomAccessIndicator() {
+  return HasAdaptationFieldFlags() && (ts_[5] & 0x40) != 0;
+}
+
+bool Mpeg2TsPacketView::HasPcr() {
+  ParseLayout();
+  return pcr_offset_ >= 0;
+}
+
+int64_t Mpeg2TsPacketView::PcrBase() {
+  if (!HasPcr()) {
+    return -1;
+  }
+  const uint8_t *buf = ts_ + pcr_offset_;
+  return (((int64_t)(buf[0]) << 25) | ((int64_t)(buf[1]) << 17) |
+          ((int64_t)(buf[2]) << 9) | ((int64_t)(buf[3]) << 1) |
+          (((int64_t)(buf[4]) & 0x80) >> 7));
+}
+
+int Mpeg2TsPacketView::PcrExtension() {
+  if (!HasPcr()) {
+    return -1;
+  }
+  const uint8_t *buf = ts_ + pcr_offset_;
+  return ((buf[4] & 0x01) << 8) | buf[5];
+}
+
+bool Mpeg2TsPacketView::IsPes() {
+  ParseLayout();
+  return is_pes_;
+}
+
+int Mpeg2TsPacketView::StreamId() {
+  const uint8_t *payload;
+  return IsPes() && Payload(&payload) >= 4 ? payload[3] : -1;
+}
+
+int Mpeg2TsPacketView::PesPacketLength() {
+  const uint8_t *payload;
+  return IsPes() && Payload(&payload) >= 6 ? (payload[4] << 8) | payload[5]
+                                           : -1;
+}
+
+bool Mpeg2TsPacketView::HasPts() {
+  ParseLayout();
+  return pts_offset_ >= 0;
+}
+
+int64_t Mpeg2TsPacketView::Pts() { return HasPts() ? GetPts(pts_offset_) : -1; }
+
+bool Mpeg2TsPacketView::HasDts() {
+  ParseLayout();
+  return dts_offset_ >= 0;
+}
+
+int64_t Mpeg2TsPacketView::Dts() { return HasDts() ? GetPts(dts_offset_) : -1; }
+
+int Mpeg2TsPacketView::Payload(const uint8_t **payload) {
+  if (!valid_header_) {
+    return 0;
+  }
+  int bi = 4;
+  if (AdaptationFieldExists()) {
+    bi += (ts_len_ > bi) ? 1 + ts_[bi] : 1;
+  }
+  if (bi >= ts_len_) {
+    return 0;
+  }
+  *payload = ts_ + bi;
+  return ts_len_ - bi;
+}
+
+int Mpeg2TsPacketView::DataBytes(const uint8_t **data) {
+  ParseLayout();
+  if (!supported_ || data_offset_ >= ts_len_) {
+    return 0;
+  }
+  *data = ts_ + data_offset_;
+  return ts_len_ - data_offset_;
+}
+
+bool Mpeg2TsPacketView::IsPsi() {
+  ParseLayout();
+  return is_psi_;
+}
+
+int Mpeg2TsPacketView::PointerField() {
+  const uint8_t *payload;
+  return IsPsi() && Payload(&payload) >= 1 ? payload[0] : -1;
+}
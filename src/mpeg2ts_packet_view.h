@@ -0,0 +1,136 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef MPEG2TS_PACKET_VIEW_H_
+#define MPEG2TS_PACKET_VIEW_H_
+
+#include <stdint.h>  // for uint8_t, int64_t
+
+#include "mpeg2ts_parser.h"
+
+// A lightweight, read-only view of a binary mpeg2ts packet.
+//
+// The view does not copy the packet, and only decodes what the
+// accessors ask for: the header fields are read straight from the
+// packet bytes, and the packet layout (adaptation field, PES header,
+// data bytes) is parsed once, on the first call of an accessor that
+// needs it. All the accessors are bounds-checked.
+//
+// Supported() tells whether the view describes the packet exactly as
+// Mpeg2TsParser::ParsePacket() would: PSI sections, and the rarely-used
+// PES header and adaptation field extensions are left to the parser.
+// Callers use the view on hot paths, and only materialize the Mpeg2Ts
+// protobuf (with the parser) for the packets the view does not support.
+class Mpeg2TsPacketView {
+ public:
+  Mpeg2TsPacketView();
+
+  // Set the size of the packets passed to Reset() (-1 if invalid)
+  int SetPacketSize(int packet_size);
+
+  // Point the view at a packet (of <len> bytes). <buf> must remain
+  // valid while the view is used.
+  void Reset(const uint8_t *buf, int len);
+
+  // Returns whether the accessors below describe the packet exactly as
+  // the parser would (a valid packet, with no PSI section nor unusual
+  // header fields)
+  bool Supported();
+
+  // TP_extra_header (192-byte packets only, 0 otherwise)
+  bool HasTpExtraHeader() const { return extra_header_; }
+  int CopyPermissionIndicator() const {
+    return extra_header_ ? (buf_[0] & 0xc0) >> 6 : 0;
+  }
+  int ArrivalTimestamp() const {
+    return extra_header_ ? ((buf_[0] & 0x3f) << 24) | (buf_[1] << 16) |
+                               (buf_[2] << 8) | buf_[3]
+                         : 0;
+  }
+
+  // header (valid packets only: the fields of invalid ones are 0, and
+  // their PID -1)
+  bool ValidHeader() const { return valid_header_; }
+  bool TransportErrorIndicator() const {
+    return valid_header_ && (ts_[1] & 0x80) != 0;
+  }
+  bool PayloadUnitStartIndicator() const {
+    return valid_header_ && (ts_[1] & 0x40) != 0;
+  }
+  bool TransportPriority() const {
+    return valid_header_ && (ts_[1] & 0x20) != 0;
+  }
+  int Pid() const {
+    return valid_header_ ? ((ts_[1] & 0x1f) << 8) | ts_[2] : -1;
+  }
+  int TransportScramblingControl() const {
+    return valid_header_ ? (ts_[3] & 0xc0) >> 6 : 0;
+  }
+  bool AdaptationFieldExists() const {
+    return valid_header_ && (ts_[3] & 0x20) != 0;
+  }
+  bool PayloadExists() const { return valid_header_ && (ts_[3] & 0x10) != 0; }
+  int ContinuityCounter() const { return valid_header_ ? ts_[3] & 0x0f : 0; }
+
+  // adaptation field (supported packets only)
+  int AdaptationFieldLength();
+  // the flags are only set if the adaptation field length is not 0
+  bool HasAdaptationFieldFlags();
+  bool DiscontinuityIndicator();
+  bool RandomAccessIndicator();
+  bool HasPcr();
+  int64_t PcrBase();
+  int PcrExtension();
+
+  // PES header (supported packets only)
+  bool IsPes();
+  int StreamId();
+  int PesPacketLength();
+  bool HasPts();
+  int64_t Pts();
+  bool HasDts();
+  int64_t Dts();
+
+  // Returns the packet payload (after the header and the adaptation
+  // field), and its length (0 if there is none)
+  int Payload(const uint8_t **payload);
+
+  // Returns the data bytes (the payload after the PES header, as in the
+  // Mpeg2Ts protobuf), and their length. Supported packets only.
+  int DataBytes(const uint8_t **data);
+
+  // Returns whether the payload starts a PSI section (in which case the
+  // view is not supported), and the pointer field
+  bool IsPsi();
+  int PointerField();
+
+ private:
+  // parse the packet layout (once)
+  void ParseLayout();
+  int ParseAdaptationField(int bi);
+  int ParsePesHeader(int bi);
+  // check a PTS/DTS at <bi> (5 bytes)
+  bool CheckPts(int bi) const;
+  int64_t GetPts(int bi) const;
+
+  const uint8_t *buf_;
+  int len_;
+  int packet_size_;
+  // the mpeg2ts packet (after any TP_extra_header), and its length
+  const uint8_t *ts_;
+  int ts_len_;
+  bool extra_header_;
+  bool valid_header_;
+
+  // layout (offsets in ts_, or -1)
+  bool layout_parsed_;
+  bool supported_;
+  int adaptation_field_length_;
+  int pcr_offset_;
+  bool is_pes_;
+  bool is_psi_;
+  int pts_offset_;
+  int dts_offset_;
+  int data_offset_;
+};
+
+#endif  // MPEG2TS_PACKET_VIEW_H_
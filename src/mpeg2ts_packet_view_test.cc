@@ -0,0 +1,240 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_packet_view.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>  // for rand
+#include <string.h>  // for memcpy
+
+#include <vector>
+
+#include "mpeg2ts.pb.h"
+#include "mpeg2ts_parser.h"
+
+// write a PTS/DTS (with <guard> as the 4 first bits)
+static void WritePts(uint8_t *buf, int guard, int64_t pts) {
+  buf[0] = (guard << 4) | ((pts >> 29) & 0x0e) | 0x01;
+  buf[1] = (pts >> 22) & 0xff;
+  buf[2] = ((pts >> 14) & 0xfe) | 0x01;
+  buf[3] = (pts >> 7) & 0xff;
+  buf[4] = ((pts << 1) & 0xfe) | 0x01;
+}
+
+class Mpeg2TsPacketViewTest : public ::testing::Test {
+ protected:
+  // a PES start (PID 0x101) with an adaptation field carrying a PCR
+  void MakePesPacket(uint8_t *buf) {
+    memset(buf, 0xaa, MPEG_TS_PACKET_SIZE);
+    buf[0] = MPEG_TS_PACKET_SYNC;
+    buf[1] = 0x41;
+    buf[2] = 0x01;
+    buf[3] = 0x37;
+    // adaptation field: flags, PCR, 1 stuffing byte
+    buf[4] = 8;
+    buf[5] = 0x50;
+    int64_t pcr_base = 0x123456789;
+    buf[6] = pcr_base >> 25;
+    buf[7] = pcr_base >> 17;
+    buf[8] = pcr_base >> 9;
+    buf[9] = pcr_base >> 1;
+    buf[10] = ((pcr_base & 1) << 7) | 0x7e | 0x01;
+    buf[11] = 0x23;
+    buf[12] = 0xff;
+    // PES header with PTS and DTS
+    uint8_t pes[] = {0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0xc0, 10};
+    memcpy(buf + 13, pes, sizeof(pes));
+    WritePts(buf + 22, 3, 900000);
+    WritePts(buf + 27, 1, 897000);
+  }
+
+  // check the view against the parsed protobuf
+  void CheckView(Mpeg2TsPacketView *view, const Mpeg2Ts &mpeg2ts) {
+    ASSERT_TRUE(mpeg2ts.has_parsed());
+    const Mpeg2TsPacket &parsed = mpeg2ts.parsed();
+    const Mpeg2TsHeader &header = parsed.header();
+    EXPECT_EQ(header.transport_error_indicator(),
+              view->TransportErrorIndicator());
+    EXPECT_EQ(header.payload_unit_start_indicator(),
+              view->PayloadUnitStartIndicator());
+    EXPECT_EQ(header.transport_priority(), view->TransportPriority());
+    EXPECT_EQ(header.pid(), view->Pid());
+    EXPECT_EQ(header.transport_scrambling_control(),
+              view->TransportScramblingControl());
+    EXPECT_EQ(header.adaptation_field_exists(), view->AdaptationFieldExists());
+    EXPECT_EQ(header.payload_exists(), view->PayloadExists());
+    EXPECT_EQ(header.continuity_counter(), view->ContinuityCounter());
+    EXPECT_EQ(mpeg2ts.has_arrival_timestamp(), view->HasTpExtraHeader());
+    if (mpeg2ts.has_arrival_timestamp()) {
+      EXPECT_EQ(mpeg2ts.arrival_timestamp(), view->ArrivalTimestamp());
+      EXPECT_EQ(mpeg2ts.copy_permission_indicator(),
+                view->CopyPermissionIndicator());
+    }
+    const AdaptationField &af = parsed.adaptation_field();
+    if (parsed.has_adaptation_field()) {
+      EXPECT_EQ(af.adaptation_field_length(), view->AdaptationFieldLength());
+    }
+    EXPECT_EQ(af.has_discontinuity_indicator(),
+              view->HasAdaptationFieldFlags());
+    EXPECT_EQ(af.discontinuity_indicator(), view->DiscontinuityIndicator());
+    EXPECT_EQ(af.random_access_indicator(), view->RandomAccessIndicator());
+    EXPECT_EQ(af.has_pcr(), view->HasPcr());
+    if (af.has_pcr()) {
+      EXPECT_EQ(af.pcr().base(), view->PcrBase());
+      EXPECT_EQ(af.pcr().extension(), view->PcrExtension());
+    }
+    const PesPacket &pes = parsed.pes_packet();
+    EXPECT_EQ(parsed.has_pes_packet(), view->IsPes());
+    if (parsed.has_pes_packet()) {
+      EXPECT_EQ(pes.stream_id(), view->StreamId());
+      EXPECT_EQ(pes.pes_packet_length(), view->PesPacketLength());
+    }
+    EXPECT_EQ(pes.has_pts(), view->HasPts());
+    EXPECT_EQ(pes.has_pts() ? pes.pts() : -1, view->Pts());
+    EXPECT_EQ(pes.has_dts(), view->HasDts());
+    EXPECT_EQ(pes.has_dts() ? pes.dts() : -1, view->Dts());
+    const uint8_t *data = NULL;
+    int len = view->DataBytes(&data);
+    ASSERT_EQ(parsed.data_bytes().length(), (size_t)len);
+    EXPECT_EQ(0, memcmp(parsed.data_bytes().data(), data, len));
+  }
+
+  Mpeg2TsParser parser_{true};
+};
+
+TEST_F(Mpeg2TsPacketViewTest, PesPacket) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+  MakePesPacket(buf);
+  Mpeg2TsPacketView view;
+  view.Reset(buf, sizeof(buf));
+  ASSERT_TRUE(view.Supported());
+  EXPECT_EQ(0x101, view.Pid());
+  EXPECT_TRUE(view.HasPcr());
+  EXPECT_EQ(0x123456789, view.PcrBase());
+  EXPECT_EQ(0x123, view.PcrExtension());
+  EXPECT_TRUE(view.IsPes());
+  EXPECT_EQ(0xe0, view.StreamId());
+  EXPECT_EQ(900000, view.Pts());
+  EXPECT_EQ(897000, view.Dts());
+  const uint8_t *data;
+  EXPECT_EQ(MPEG_TS_PACKET_SIZE - 32, view.DataBytes(&data));
+  EXPECT_EQ(buf + 32, data);
+  const uint8_t *payload;
+  EXPECT_EQ(MPEG_TS_PACKET_SIZE - 13, view.Payload(&payload));
+  EXPECT_EQ(buf + 13, payload);
+
+  Mpeg2Ts mpeg2ts;
+  parser_.ParsePacket(0, 0, buf, sizeof(buf), &mpeg2ts);
+  CheckView(&view, mpeg2ts);
+
+  // invalid PTS markers: the parser returns a raw packet
+  buf[24] &= 0xfe;
+  view.Reset(buf, sizeof(buf));
+  EXPECT_FALSE(view.Supported());
+  // the header is still readable
+  EXPECT_EQ(0x101, view.Pid());
+}
+
+TEST_F(Mpeg2TsPacketViewTest, PsiPacket) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+  memset(buf, 0xff, sizeof(buf));
+  // PAT start
+  uint8_t pat[] = {0x47, 0x40, 0x00, 0x10, 0x00, 0x00, 0xb0, 0x0d};
+  memcpy(buf, pat, sizeof(pat));
+  Mpeg2TsPacketView view;
+  view.Reset(buf, sizeof(buf));
+  EXPECT_FALSE(view.Supported());
+  EXPECT_TRUE(view.IsPsi());
+  EXPECT_EQ(0, view.PointerField());
+  EXPECT_EQ(0, view.Pid());
+}
+
+TEST_F(Mpeg2TsPacketViewTest, InvalidPacket) {
+  // no sync byte
+  uint8_t buf[M2TS_PACKET_SIZE];
+  memset(buf, 0xff, sizeof(buf));
+  Mpeg2TsPacketView view;
+  view.Reset(buf, MPEG_TS_PACKET_SIZE);
+  EXPECT_FALSE(view.ValidHeader());
+  EXPECT_FALSE(view.Supported());
+  EXPECT_EQ(-1, view.Pid());
+  EXPECT_FALSE(view.PayloadUnitStartIndicator());
+  EXPECT_FALSE(view.AdaptationFieldExists());
+  EXPECT_EQ(0, view.ContinuityCounter());
+  // too short for a header
+  buf[0] = MPEG_TS_PACKET_SYNC;
+  view.Reset(buf, 3);
+  EXPECT_FALSE(view.ValidHeader());
+  EXPECT_EQ(-1, view.Pid());
+  const uint8_t *payload;
+  EXPECT_EQ(0, view.Payload(&payload));
+  // no TP_extra_header with 188-byte packets
+  EXPECT_FALSE(view.HasTpExtraHeader());
+  EXPECT_EQ(0, view.ArrivalTimestamp());
+  ASSERT_EQ(0, view.SetPacketSize(M2TS_PACKET_SIZE));
+  buf[0] = 0x00;
+  buf[M2TS_TP_EXTRA_HEADER_SIZE] = MPEG_TS_PACKET_SYNC;
+  view.Reset(buf, sizeof(buf));
+  EXPECT_TRUE(view.ValidHeader());
+  EXPECT_EQ(0x00ffffff, view.ArrivalTimestamp());
+  EXPECT_EQ(0x1fff, view.Pid());
+}
+
+TEST_F(Mpeg2TsPacketViewTest, MatchesParser) {
+  int supported = 0;
+  srand(1);
+  for (int packet_size :
+       {MPEG_TS_PACKET_SIZE, M2TS_PACKET_SIZE, FEC_PACKET_SIZE}) {
+    ASSERT_EQ(0, parser_.SetPacketSize(packet_size));
+    Mpeg2TsPacketView view;
+    ASSERT_EQ(0, view.SetPacketSize(packet_size));
+    int offset = Mpeg2TsParser::SyncOffset(packet_size);
+    std::vector<uint8_t> buf(packet_size);
+    for (int test = 0; test < 3000; ++test) {
+      // random variations of a PES packet
+      for (auto &b : buf) {
+        b = rand() & 0xff;
+      }
+      MakePesPacket(buf.data() + offset);
+      uint8_t *ts = buf.data() + offset;
+      switch (test % 6) {
+        case 0:
+          // no adaptation field
+          ts[3] &= ~0x20;
+          break;
+        case 1:
+          // random adaptation field flags and length
+          ts[4] = rand() % 190;
+          ts[5] = rand() & 0xff;
+          break;
+        case 2:
+          // random PES flags and header length
+          ts[20] = rand() & 0xff;
+          ts[21] = rand() % 20;
+          break;
+        case 3:
+          // random PTS guard
+          ts[22] = (ts[22] & 0x0f) | ((rand() & 0x0f) << 4);
+          break;
+        case 4:
+          // not a PES start
+          ts[1] &= ~0x40;
+          break;
+        default:
+          // random byte anywhere
+          buf[rand() % packet_size] = rand() & 0xff;
+          break;
+      }
+      view.Reset(buf.data(), packet_size);
+      if (!view.Supported()) {
+        continue;
+      }
+      ++supported;
+      Mpeg2Ts mpeg2ts;
+      parser_.ParsePacket(test, 0, buf.data(), packet_size, &mpeg2ts);
+      CheckView(&view, mpeg2ts);
+    }
+  }
+  // (at least) the packets with no adaptation field, and the ones that
+  // are not PES starts, are supported
+  EXPECT_LT(3000, supported);
+}
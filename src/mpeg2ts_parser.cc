@@ -7,49 +7,58 @@
 #include <algorithm>
 
 #include "mpeg2ts.pb.h"
+#include "mpeg2ts_bitfields.h"
 
 // set <len> bits at <bitindex> position in buf using the
 // <len> right-most (least-significant) bits in <val>
-static void BitSet(uint8_t *buf, int bitindex, int len, int32_t val) {
-  uint8_t mask;
-  len += bitindex;
-  // set one byte at a time
-  while (bitindex < len) {
-    // we start at bitindex % 8
-    int offset = bitindex % 8;
-    // length printed now
-    int nowlen = std::min(8 - offset, len - bitindex);
-    // get the byte to print
-    uint8_t *byte = (uint8_t *)(buf + bitindex / 8);
-    // get the mask
-    mask = 0xff >> offset;
-    if ((len - bitindex) < 8) {
-      mask &= ~(0xff >> (offset + nowlen));
-    }
-    *byte &= ~mask;
-    // put the value in the right position
-    int rshift = (len - bitindex + offset - 8);
-    uint8_t valbyte = 0;
-    if (rshift >= 0) {
-      valbyte = (val >> rshift);
-    } else {
-      valbyte = (val << -rshift);
+static inline void BitSet(uint8_t *buf, int bitindex, int len, int32_t val) {
+  // fields are at most 32 bits long, so they always fit (with their
+  // leading bit offset) in a 64-bit big-endian word
+  buf += bitindex / 8;
+  int offset = bitindex % 8;
+  int nbytes = (offset + len + 7) / 8;
+  int shift = nbytes * 8 - offset - len;
+  uint64_t mask = ((len < 64) ? ((1ULL << len) - 1) : ~0ULL) << shift;
+  uint64_t bits = ((uint64_t)(uint32_t)val << shift) & mask;
+  // fast path: whole bytes
+  if (offset == 0 && shift == 0) {
+    for (int i = nbytes - 1; i >= 0; --i) {
+      buf[i] = bits & 0xff;
+      bits >>= 8;
     }
-    // mask it
-    *byte |= valbyte & mask;
-    // next
-    bitindex += nowlen;
+    return;
+  }
+  // read-modify-write the bytes covering the field as one word
+  uint64_t word = 0;
+  for (int i = 0; i < nbytes; ++i) {
+    word = (word << 8) | buf[i];
+  }
+  word = (word & ~mask) | bits;
+  for (int i = nbytes - 1; i >= 0; --i) {
+    buf[i] = word & 0xff;
+    word >>= 8;
   }
 }
 
 // returns val[first:last] (inclusive)
-static int64_t BitGet(int64_t val, int first, int last) {
+static inline int64_t BitGet(int64_t val, int first, int last) {
   int64_t res = val >> first;
-  return res & ((1 << (last - first + 1)) - 1);
+  return res & ((1LL << (last - first + 1)) - 1);
 }
 
 Mpeg2TsParser::Mpeg2TsParser(bool return_raw_packets)
-    : return_raw_packets_(return_raw_packets) {}
+    : return_raw_packets_(return_raw_packets),
+      packet_size_(MPEG_TS_PACKET_SIZE),
+      parse_depth_(Mpeg2TsPacket::PARSE_DEPTH_FULL),
+      payload_mode_(Mpeg2TsPacket::PAYLOAD_FULL) {}
+
+int Mpeg2TsParser::SetPacketSize(int packet_size) {
+  if (!IsValidPacketSize(packet_size)) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  return 0;
+}
 
 int Mpeg2TsParser::ParsePacket(int64_t pi, int64_t bi, const uint8_t *buf,
                                int len, Mpeg2Ts *mpeg2ts) {
@@ -57,7 +66,30 @@ int Mpeg2TsParser::ParsePacket(int64_t pi, int64_t bi, const uint8_t *buf,
   mpeg2ts->Clear();
   mpeg2ts->set_packet(pi);
   mpeg2ts->set_byte(bi);
-  int res = ParseValidPacket(buf, len, mpeg2ts->mutable_parsed());
+  int res = -1;
+  if (packet_size_ == M2TS_PACKET_SIZE && len == M2TS_PACKET_SIZE) {
+    // TP_extra_header
+    res = ParseValidPacket(buf + M2TS_TP_EXTRA_HEADER_SIZE,
+                           len - M2TS_TP_EXTRA_HEADER_SIZE,
+                           mpeg2ts->mutable_parsed());
+    if (res >= 0) {
+      mpeg2ts->set_copy_permission_indicator((buf[0] & 0xc0) >> 6);
+      int arrival_timestamp = ((buf[0] & 0x3f) << 24) | (buf[1] << 16) |
+                              (buf[2] << 8) | buf[3];
+      mpeg2ts->set_arrival_timestamp(arrival_timestamp);
+      res = len;
+    }
+  } else if (packet_size_ == FEC_PACKET_SIZE && len == FEC_PACKET_SIZE) {
+    // FEC trailer
+    res = ParseValidPacket(buf, len - FEC_TRAILER_SIZE,
+                           mpeg2ts->mutable_parsed());
+    if (res >= 0) {
+      mpeg2ts->set_fec_trailer(buf + len - FEC_TRAILER_SIZE, FEC_TRAILER_SIZE);
+      res = len;
+    }
+  } else {
+    res = ParseValidPacket(buf, len, mpeg2ts->mutable_parsed());
+  }
   if (res < 0) {
     mpeg2ts->clear_parsed();
     mpeg2ts->set_raw(buf, len);
@@ -70,7 +102,29 @@ int Mpeg2TsParser::DumpPacket(const Mpeg2Ts &mpeg2ts, uint8_t *buf, int len) {
   int bi = 0;
   int res;
   if (mpeg2ts.has_parsed()) {
-    return DumpValidPacket(mpeg2ts.parsed(), buf, len);
+    if (mpeg2ts.has_arrival_timestamp()) {
+      // TP_extra_header
+      if (len < M2TS_TP_EXTRA_HEADER_SIZE) {
+        return -1;
+      }
+      BitSet(buf + bi, 0, 2, mpeg2ts.copy_permission_indicator());
+      BitSet(buf + bi, 2, 30, mpeg2ts.arrival_timestamp());
+      bi += M2TS_TP_EXTRA_HEADER_SIZE;
+    }
+    res = DumpValidPacket(mpeg2ts.parsed(), buf + bi, len - bi);
+    if (res < 0) {
+      return -1;
+    }
+    bi += res;
+    if (mpeg2ts.has_fec_trailer()) {
+      // FEC trailer
+      if (mpeg2ts.fec_trailer().length() > (unsigned int)(len - bi)) {
+        return -1;
+      }
+      res = mpeg2ts.fec_trailer().copy((char *)(buf + bi), len - bi);
+      bi += res;
+    }
+    return bi;
   } else if (mpeg2ts.has_raw()) {
     // dump raw packet
     if (mpeg2ts.raw().length() > (unsigned int)len) {
@@ -97,6 +151,9 @@ int Mpeg2TsParser::ParseValidPacket(const uint8_t *buf, int len,
     return -1;
   }
   bi += res;
+  if (parse_depth_ < Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD) {
+    return bi + ParseUnparsed(buf + bi, len - bi, mpeg2ts_packet);
+  }
 
 #if 0
   if (mpeg2ts_packet.pid() == 0x1fff) {
@@ -117,6 +174,9 @@ int Mpeg2TsParser::ParseValidPacket(const uint8_t *buf, int len,
     }
     bi += res;
   }
+  if (parse_depth_ < Mpeg2TsPacket::PARSE_DEPTH_PES) {
+    return bi + ParseUnparsed(buf + bi, len - bi, mpeg2ts_packet);
+  }
 
   if (mpeg2ts_packet->header().payload_unit_start_indicator()) {
     // check PES/PSI packet
@@ -132,6 +192,8 @@ int Mpeg2TsParser::ParseValidPacket(const uint8_t *buf, int len,
         return -1;
       }
       bi += res;
+    } else if (parse_depth_ < Mpeg2TsPacket::PARSE_DEPTH_FULL) {
+      return bi + ParseUnparsed(buf + bi, len - bi, mpeg2ts_packet);
     } else {
       res = ParsePsiPacket(buf + bi, len - bi,
                            mpeg2ts_packet->mutable_psi_packet());
@@ -143,14 +205,46 @@ int Mpeg2TsParser::ParseValidPacket(const uint8_t *buf, int len,
   }
 
   // remainder is data bytes
-  if (len - bi > 0) {
-    mpeg2ts_packet->set_data_bytes(buf + bi, len - bi);
-    bi = len;
-  }
+  bi += ParsePayload(buf + bi, len - bi, false, mpeg2ts_packet);
 
   return bi;
 }
 
+int Mpeg2TsParser::ParseUnparsed(const uint8_t *buf, int len,
+                                 Mpeg2TsPacket *mpeg2ts_packet) {
+  mpeg2ts_packet->set_parse_depth(parse_depth_);
+  return ParsePayload(buf, len, true, mpeg2ts_packet);
+}
+
+int Mpeg2TsParser::ParsePayload(const uint8_t *buf, int len, bool unparsed,
+                                Mpeg2TsPacket *mpeg2ts_packet) {
+  if (len <= 0) {
+    return 0;
+  }
+  if (payload_mode_ == Mpeg2TsPacket::PAYLOAD_FULL) {
+    if (unparsed) {
+      mpeg2ts_packet->set_unparsed(buf, len);
+    } else {
+      mpeg2ts_packet->set_data_bytes(buf, len);
+    }
+    return len;
+  }
+  // elided payload
+  mpeg2ts_packet->set_payload_mode(payload_mode_);
+  if (payload_mode_ >= Mpeg2TsPacket::PAYLOAD_LENGTH) {
+    mpeg2ts_packet->set_payload_length(len);
+  }
+  if (payload_mode_ >= Mpeg2TsPacket::PAYLOAD_HASH) {
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; ++i) {
+      hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+    }
+    mpeg2ts_packet->set_payload_hash(hash);
+  }
+  return len;
+}
+
 int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
                                    uint8_t *buf, int len) {
   int bi = 0;
@@ -161,6 +255,11 @@ int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
     return -1;
   }
 
+  // elided payloads cannot be dumped back
+  if (mpeg2ts_packet.has_payload_mode()) {
+    return -1;
+  }
+
   // dump the mpeg2-ts header
   res = DumpHeader(mpeg2ts_packet.header(), buf + bi, len - bi);
   if (res < 0) {
@@ -168,8 +267,14 @@ int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
   }
   bi += res;
 
+  // partially-parsed packets stop at their parse depth
+  int parse_depth = mpeg2ts_packet.has_parse_depth()
+                        ? mpeg2ts_packet.parse_depth()
+                        : Mpeg2TsPacket::PARSE_DEPTH_FULL;
+
   // dump the adaptation field
-  if (mpeg2ts_packet.header().adaptation_field_exists()) {
+  if (parse_depth >= Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD &&
+      mpeg2ts_packet.header().adaptation_field_exists()) {
     res = DumpAdaptationField(mpeg2ts_packet.adaptation_field(), buf + bi,
                               len - bi);
     if (res < 0) {
@@ -179,7 +284,8 @@ int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
   }
 
   // dump the payload
-  if (mpeg2ts_packet.header().payload_unit_start_indicator()) {
+  if (parse_depth >= Mpeg2TsPacket::PARSE_DEPTH_PES &&
+      mpeg2ts_packet.header().payload_unit_start_indicator()) {
     // check PES/PSI packet
     if (mpeg2ts_packet.has_pes_packet()) {
       res = DumpPesPacket(mpeg2ts_packet.pes_packet(), buf + bi, len - bi);
@@ -193,11 +299,20 @@ int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
         return -1;
       }
       bi += res;
-    } else {
+    } else if (!mpeg2ts_packet.has_parse_depth()) {
       return -1;
     }
   }
 
+  // dump the bytes after the parse depth
+  if (mpeg2ts_packet.has_unparsed()) {
+    if (mpeg2ts_packet.unparsed().length() > (unsigned int)(len - bi)) {
+      return -1;
+    }
+    res = mpeg2ts_packet.unparsed().copy((char *)(buf + bi), len - bi);
+    bi += res;
+  }
+
   if (mpeg2ts_packet.has_data_bytes()) {
     if (mpeg2ts_packet.data_bytes().length() > (unsigned int)len) {
       // not enough space for the data bytes
@@ -212,83 +327,14 @@ int Mpeg2TsParser::DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet,
 
 int Mpeg2TsParser::ParseHeader(const uint8_t *buf, int len,
                                Mpeg2TsHeader *mpeg2ts_header) {
-  // ensure ts header can be parsed
-  if (len < 4) {
-    return -1;
-  }
-  // parse ts header
-  if (buf[0] != MPEG_TS_PACKET_SYNC) {
-    return -1;
-  }
-  // flags
-  int transport_error_indicator = (buf[1] & 0x80) >> 7;
-  mpeg2ts_header->set_transport_error_indicator(transport_error_indicator);
-  int payload_unit_start_indicator = (buf[1] & 0x40) >> 6;
-  mpeg2ts_header->set_payload_unit_start_indicator(
-      payload_unit_start_indicator);
-  int transport_priority = (buf[1] & 0x20) >> 5;
-  mpeg2ts_header->set_transport_priority(transport_priority);
-  uint32_t pid = ((buf[1] & 0x1f) << 8) | buf[2];
-  mpeg2ts_header->set_pid(pid);
-  int transport_scrambling_control = (buf[3] & 0xc0) >> 6;
-  mpeg2ts_header->set_transport_scrambling_control(
-      transport_scrambling_control);
-  int adaptation_field_exists = (buf[3] & 0x20) >> 5;
-  mpeg2ts_header->set_adaptation_field_exists(adaptation_field_exists);
-  int payload_exists = (buf[3] & 0x10) >> 4;
-  mpeg2ts_header->set_payload_exists(payload_exists);
-  int continuity_counter = (buf[3] & 0x0f);
-  mpeg2ts_header->set_continuity_counter(continuity_counter);
-  return 4;
+  // sync byte and flags (see Mpeg2TsHeader in mpeg2ts.proto)
+  return ParseMpeg2TsHeaderBits(buf, len, mpeg2ts_header);
 }
 
 int Mpeg2TsParser::DumpHeader(const Mpeg2TsHeader &mpeg2ts_header, uint8_t *buf,
                               int len) {
-  int bi = 0;
-
-  // ensure ts header can be dumped
-  if (len < 4) {
-    return -1;
-  }
-  // dump ts header
-  buf[bi] = MPEG_TS_PACKET_SYNC;
-  bi += 1;
-  // flags
-  if (!mpeg2ts_header.has_transport_error_indicator()) {
-    return -1;
-  }
-  BitSet(buf + bi, 0, 1, mpeg2ts_header.transport_error_indicator());
-  if (!mpeg2ts_header.has_payload_unit_start_indicator()) {
-    return -1;
-  }
-  BitSet(buf + bi, 1, 1, mpeg2ts_header.payload_unit_start_indicator());
-  if (!mpeg2ts_header.has_transport_priority()) {
-    return -1;
-  }
-  BitSet(buf + bi, 2, 1, mpeg2ts_header.transport_priority());
-  if (!mpeg2ts_header.has_pid()) {
-    return -1;
-  }
-  BitSet(buf + bi, 3, 13, mpeg2ts_header.pid());
-  if (!mpeg2ts_header.has_transport_scrambling_control()) {
-    return -1;
-  }
-  bi += 2;
-  BitSet(buf + bi, 0, 2, mpeg2ts_header.transport_scrambling_control());
-  if (!mpeg2ts_header.has_adaptation_field_exists()) {
-    return -1;
-  }
-  BitSet(buf + bi, 2, 1, mpeg2ts_header.adaptation_field_exists());
-  if (!mpeg2ts_header.has_payload_exists()) {
-    return -1;
-  }
-  BitSet(buf + bi, 3, 1, mpeg2ts_header.payload_exists());
-  if (!mpeg2ts_header.has_continuity_counter()) {
-    return -1;
-  }
-  BitSet(buf + bi, 4, 4, mpeg2ts_header.continuity_counter());
-  bi += 1;
-  return bi;
+  // sync byte and flags (see Mpeg2TsHeader in mpeg2ts.proto)
+  return DumpMpeg2TsHeaderBits(mpeg2ts_header, buf, len);
 }
 
 int Mpeg2TsParser::ParseAdaptationField(const uint8_t *buf, int len,
@@ -567,54 +613,12 @@ int Mpeg2TsParser::ParsePCR(const uint8_t *buf, int len, PCR *pcr) {
   // |         extension[7:0]        |
   // +---+---+---+---+---+---+---+---+
 
-  // ensure PCR can be parsed
-  if (len < 6) {
-    return -1;
-  }
-
-  // check that the padding bits are 0
-  int padding = (buf[4] & 0x7e) >> 1;
-  if (padding != 0x3f) {
-    return -1;
-  }
-  // parse base/extension
-  int64_t base = (((int64_t)(buf[0]) << 25) | ((int64_t)(buf[1]) << 17) |
-                  ((int64_t)(buf[2]) << 9) | ((int64_t)(buf[3]) << 1) |
-                  (((int64_t)(buf[4]) & 0x80) >> 7));
-  int extension = ((buf[4] & 0x01) << 8) | buf[5];
-  pcr->set_base(base);
-  pcr->set_extension(extension);
-  return 6;
+  // (see PCR in mpeg2ts.proto: the reserved bits must be set)
+  return ParsePCRBits(buf, len, pcr);
 }
 
 int Mpeg2TsParser::DumpPCR(const PCR &pcr, uint8_t *buf, int len) {
-  int bi = 0;
-  int64_t base = pcr.base();
-  int extension = pcr.extension();
-
-  // base[32:25]
-  BitSet(buf + bi, 0, 8, BitGet(base, 25, 32));
-  bi += 1;
-  // base[17:24]
-  BitSet(buf + bi, 0, 8, BitGet(base, 17, 24));
-  bi += 1;
-  // base[9:16]
-  BitSet(buf + bi, 0, 8, BitGet(base, 9, 16));
-  bi += 1;
-  // base[1:8]
-  BitSet(buf + bi, 0, 8, BitGet(base, 1, 8));
-  bi += 1;
-  // base[0]
-  BitSet(buf + bi, 0, 1, BitGet(base, 0, 0));
-  // markers
-  BitSet(buf + bi, 1, 6, 0x3f);
-  // extension[8]
-  BitSet(buf + bi, 7, 1, BitGet(extension, 8, 8));
-  bi += 1;
-  // extension[0:7]
-  BitSet(buf + bi, 0, 8, BitGet(extension, 0, 7));
-  bi += 1;
-  return bi;
+  return DumpPCRBits(pcr, buf, len);
 }
 
 int Mpeg2TsParser::ParseESCR(const uint8_t *buf, int len, PCR *pcr) {
@@ -1378,21 +1382,36 @@ int Mpeg2TsParser::ParsePsiPacket(const uint8_t *buf, int len,
   psi_packet->set_pointer_field(buf + bi, pointer_field_length);
   bi += pointer_field_length;
   // parse the PSI section
-  // identify the following section
+  res = ParsePsiSection(buf + bi, len - bi, psi_packet);
+  if (res < 0) {
+    return -1;
+  }
+  return bi + res;
+}
+
+int Mpeg2TsParser::ParsePsiSection(const uint8_t *buf, int len,
+                                   PsiPacket *psi_packet) {
+  int bi = 0;
+  int res;
+  if ((len - bi) < 1) {
+    return -1;
+  }
+  // identify the following section (a failed section is removed, so
+  // the sections parsed before are kept)
   int table_id = buf[bi];
   res = -1;
   if (table_id == MPEG_TS_TABLE_ID_PROGRAM_ASSOCIATION_SECTION) {
     res = ParseProgramAssociationSection(
         buf + bi, len - bi, psi_packet->add_program_association_section());
     if (res < 0) {
-      psi_packet->clear_program_association_section();
+      psi_packet->mutable_program_association_section()->RemoveLast();
       return -1;
     }
   } else if (table_id == MPEG_TS_TABLE_ID_TS_PROGRAM_MAP_SECTION) {
     res = ParseProgramMapSection(buf + bi, len - bi,
                                  psi_packet->add_program_map_section());
     if (res < 0) {
-      psi_packet->clear_program_map_section();
+      psi_packet->mutable_program_map_section()->RemoveLast();
       return -1;
     }
   } else if ((table_id ==
@@ -1402,7 +1421,7 @@ int Mpeg2TsParser::ParsePsiPacket(const uint8_t *buf, int len,
     res = ParseServiceDescriptionSection(
         buf + bi, len - bi, psi_packet->add_service_description_section());
     if (res < 0) {
-      psi_packet->clear_service_description_section();
+      psi_packet->mutable_service_description_section()->RemoveLast();
       return -1;
     }
   } else if (table_id == MPEG_TS_TABLE_ID_FORBIDDEN) {
@@ -1413,7 +1432,7 @@ int Mpeg2TsParser::ParsePsiPacket(const uint8_t *buf, int len,
     res = ParseOtherPsiSection(buf + bi, len - bi,
                                psi_packet->add_other_psi_section());
     if (res < 0) {
-      psi_packet->clear_other_psi_section();
+      psi_packet->mutable_other_psi_section()->RemoveLast();
       return -1;
     }
   }
@@ -9,6 +9,11 @@
 
 #define MPEG_TS_PACKET_SYNC 0x47  // 'G'
 #define MPEG_TS_PACKET_SIZE 188
+#define M2TS_PACKET_SIZE 192
+#define FEC_PACKET_SIZE 204
+#define MPEG_TS_MAX_PACKET_SIZE FEC_PACKET_SIZE
+#define M2TS_TP_EXTRA_HEADER_SIZE 4
+#define FEC_TRAILER_SIZE 16
 
 #define MPEG_TS_PID_PAT 0
 
@@ -27,6 +32,61 @@ class Mpeg2TsParser {
   explicit Mpeg2TsParser(bool return_raw_packets);
   ~Mpeg2TsParser() {}
 
+  // Set the size of the packets passed to ParsePacket() (188, 192, or
+  // 204 bytes). 192-byte packets start with a 4-byte TP_extra_header,
+  // and 204-byte packets end with a 16-byte FEC trailer: both are kept
+  // in the Mpeg2Ts protobuf.
+  int SetPacketSize(int packet_size);
+
+  // Returns whether <packet_size> is one of the packet sizes above.
+  // Every class taking packet sizes validates them with it.
+  static bool IsValidPacketSize(int packet_size) {
+    return packet_size == MPEG_TS_PACKET_SIZE ||
+           packet_size == M2TS_PACKET_SIZE || packet_size == FEC_PACKET_SIZE;
+  }
+
+  // Returns the offset of the sync byte in the packets of <packet_size>
+  // bytes (after the TP_extra_header of 192-byte packets)
+  static int SyncOffset(int packet_size) {
+    return (packet_size == M2TS_PACKET_SIZE) ? M2TS_TP_EXTRA_HEADER_SIZE : 0;
+  }
+
+  // Locate the mpeg2ts packet in a <len>-byte packet read with
+  // <packet_size>-byte packets: skip the TP_extra_header, and drop the
+  // FEC trailer, of full-size packets only. Sets <ts> and returns the
+  // length of the mpeg2ts packet.
+  static int FramePacket(int packet_size, const uint8_t *buf, int len,
+                         const uint8_t **ts) {
+    *ts = buf;
+    if (len != packet_size) {
+      return len;
+    } else if (packet_size == M2TS_PACKET_SIZE) {
+      *ts = buf + M2TS_TP_EXTRA_HEADER_SIZE;
+      return len - M2TS_TP_EXTRA_HEADER_SIZE;
+    } else if (packet_size == FEC_PACKET_SIZE) {
+      return len - FEC_TRAILER_SIZE;
+    }
+    return len;
+  }
+
+  // Set how deep ParsePacket() parses the packets: the header only, up
+  // to the adaptation field, up to the PES header (PSI sections are not
+  // parsed), or everything (the default). Packets parsed partially get
+  // their parse_depth set, and keep the bytes after the last parsed
+  // layer in unparsed, so DumpPacket() still returns the original
+  // packet. Layers deeper than the parse depth are not checked either.
+  void SetParseDepth(Mpeg2TsPacket::ParseDepth parse_depth) {
+    parse_depth_ = parse_depth;
+  }
+
+  // Set what ParsePacket() keeps of the bytes it stores as-is (the data
+  // bytes, or the bytes after the parse depth): nothing, their length,
+  // their length and hash, or the bytes themselves (the default). Only
+  // the latter can be dumped back.
+  void SetPayloadMode(Mpeg2TsPacket::PayloadMode payload_mode) {
+    payload_mode_ = payload_mode;
+  }
+
   // Process a binary mpeg2ts packet into a protobuf.
   // Returns the number of packets parsed, or -1 if there was an
   // error.
@@ -36,11 +96,24 @@ class Mpeg2TsParser {
   // Process a protobuf into a binary mpeg2ts packet.
   int DumpPacket(const Mpeg2Ts &mpeg2ts, uint8_t *buf, int len);
 
+  // Parse a single PSI section (starting at its table_id) into the
+  // matching list of <psi_packet>. Returns the number of bytes parsed,
+  // or -1 if there was an error. Sections spanning several packets
+  // must be reassembled first (see PsiAssembler).
+  int ParsePsiSection(const uint8_t *buf, int len, PsiPacket *psi_packet);
+
  protected:
   int ParseValidPacket(const uint8_t *buf, int len,
                        Mpeg2TsPacket *mpeg2ts_packet);
   int DumpValidPacket(const Mpeg2TsPacket &mpeg2ts_packet, uint8_t *buf,
                       int len);
+  // keep the bytes after the parse depth
+  int ParseUnparsed(const uint8_t *buf, int len,
+                    Mpeg2TsPacket *mpeg2ts_packet);
+  // keep the bytes stored as-is (data bytes, or unparsed bytes), as the
+  // payload mode says
+  int ParsePayload(const uint8_t *buf, int len, bool unparsed,
+                   Mpeg2TsPacket *mpeg2ts_packet);
 
   int ParseHeader(const uint8_t *buf, int len, Mpeg2TsHeader *mpeg2ts_header);
   int DumpHeader(const Mpeg2TsHeader &mpeg2ts_header, uint8_t *buf, int len);
@@ -131,7 +204,10 @@ class Mpeg2TsParser {
   int DumpDescriptor(const Descriptor &descriptor, uint8_t *buf, int len);
 
  private:
-  const bool return_raw_packets_;
+  bool return_raw_packets_;
+  int packet_size_;
+  Mpeg2TsPacket::ParseDepth parse_depth_;
+  Mpeg2TsPacket::PayloadMode payload_mode_;
   Mpeg2TsPacket mpeg2ts_packet_;
 };
 
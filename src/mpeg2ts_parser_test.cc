@@ -7,7 +7,7 @@
 #include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 #include <stdio.h>   // for remove
-#include <string.h>  // for memset
+#include <string.h>  // for memset, memcpy
 #include <unistd.h>  // for usleep
 
 #include "mpeg2ts.pb.h"
@@ -324,6 +324,223 @@ TEST_F(Mpeg2TsParserTest, BinaryPackets) {
   }
 }
 
+TEST_F(Mpeg2TsParserTest, ParseDepth) {
+  const uint8_t *test_arr[] = {
+      mpts_pat_header, s1_00057d98_ts, s1_000b5060_ts,
+      s1_2080802_ts,   s1_2389999_ts,
+  };
+  const Mpeg2TsPacket::ParseDepth depth_arr[] = {
+      Mpeg2TsPacket::PARSE_DEPTH_HEADER,
+      Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD,
+      Mpeg2TsPacket::PARSE_DEPTH_PES,
+      Mpeg2TsPacket::PARSE_DEPTH_FULL,
+  };
+
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+
+  for (const auto parse_depth : depth_arr) {
+    mpeg2ts_parser_.SetParseDepth(parse_depth);
+    for (const auto test_buf : test_arr) {
+      // partial parses must still dump the original packet
+      Mpeg2Ts mpeg2ts;
+      mpeg2ts_parser_.ParsePacket(0, 0, test_buf, MPEG_TS_PACKET_SIZE,
+                                  &mpeg2ts);
+      EXPECT_EQ(MPEG_TS_PACKET_SIZE,
+                mpeg2ts_parser_.DumpPacket(mpeg2ts, buf, MPEG_TS_PACKET_SIZE))
+          << "depth " << parse_depth;
+      EXPECT_EQ(0, memcmp(buf, test_buf, MPEG_TS_PACKET_SIZE))
+          << "depth " << parse_depth;
+      if (parse_depth == Mpeg2TsPacket::PARSE_DEPTH_FULL) {
+        // some of the PSI sections are invalid (raw packets)
+        EXPECT_FALSE(mpeg2ts.parsed().has_parse_depth());
+        continue;
+      }
+      // all the packets start a PSI section, which is not parsed (nor
+      // checked)
+      EXPECT_TRUE(mpeg2ts.has_parsed()) << "depth " << parse_depth;
+      EXPECT_EQ(parse_depth, mpeg2ts.parsed().parse_depth());
+      EXPECT_FALSE(mpeg2ts.parsed().has_psi_packet())
+          << "depth " << parse_depth;
+    }
+  }
+
+  // header only: the rest of the packet is not parsed
+  Mpeg2Ts mpeg2ts;
+  mpeg2ts_parser_.SetParseDepth(Mpeg2TsPacket::PARSE_DEPTH_HEADER);
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &mpeg2ts);
+  EXPECT_EQ(0, mpeg2ts.parsed().header().pid());
+  EXPECT_EQ(Mpeg2TsPacket::PARSE_DEPTH_HEADER,
+            mpeg2ts.parsed().parse_depth());
+  EXPECT_EQ(MPEG_TS_PACKET_SIZE - 4, (int)mpeg2ts.parsed().unparsed().length());
+  EXPECT_FALSE(mpeg2ts.parsed().has_data_bytes());
+
+  // a PES packet (PID 0x100) with a PCR in its adaptation field: 4-byte
+  // header, 8-byte adaptation field, 14-byte PES header, data bytes
+  uint8_t pes_buf[MPEG_TS_PACKET_SIZE];
+  const uint8_t pes_start[] = {
+      0x47, 0x41, 0x00, 0x30, 0x07, 0x10, 0x00, 0x00, 0x12, 0x34, 0x7e,
+      0x00, 0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21,
+      0x00, 0x37, 0x77, 0x41,
+  };
+  const int pes_data_offset = sizeof(pes_start);
+  memcpy(pes_buf, pes_start, sizeof(pes_start));
+  for (int i = pes_data_offset; i < MPEG_TS_PACKET_SIZE; ++i) {
+    pes_buf[i] = i & 0xff;
+  }
+  // an adaptation field only packet (no payload), stuffed
+  uint8_t af_buf[MPEG_TS_PACKET_SIZE];
+  memset(af_buf, 0xff, sizeof(af_buf));
+  const uint8_t af_start[] = {0x47, 0x01, 0x00, 0x21, 0xb7, 0x80};
+  memcpy(af_buf, af_start, sizeof(af_start));
+
+  for (const auto parse_depth : depth_arr) {
+    mpeg2ts_parser_.SetParseDepth(parse_depth);
+    for (const uint8_t *test_buf : {pes_buf, af_buf}) {
+      Mpeg2Ts mpeg2ts;
+      mpeg2ts_parser_.ParsePacket(0, 0, test_buf, MPEG_TS_PACKET_SIZE,
+                                  &mpeg2ts);
+      ASSERT_TRUE(mpeg2ts.has_parsed()) << "depth " << parse_depth;
+      const Mpeg2TsPacket &parsed = mpeg2ts.parsed();
+      EXPECT_EQ(0x100, parsed.header().pid());
+      // the unparsed bytes dump back to the original packet
+      EXPECT_EQ(MPEG_TS_PACKET_SIZE,
+                mpeg2ts_parser_.DumpPacket(mpeg2ts, buf, MPEG_TS_PACKET_SIZE))
+          << "depth " << parse_depth;
+      EXPECT_EQ(0, memcmp(buf, test_buf, MPEG_TS_PACKET_SIZE))
+          << "depth " << parse_depth;
+      // the adaptation field is parsed from ADAPTATION_FIELD on
+      bool af_parsed =
+          parse_depth >= Mpeg2TsPacket::PARSE_DEPTH_ADAPTATION_FIELD;
+      EXPECT_EQ(af_parsed, parsed.has_adaptation_field())
+          << "depth " << parse_depth;
+      // the PES header is parsed from PES on
+      bool pes_parsed = parse_depth >= Mpeg2TsPacket::PARSE_DEPTH_PES;
+      EXPECT_EQ(pes_parsed && test_buf == pes_buf, parsed.has_pes_packet())
+          << "depth " << parse_depth;
+      // packets parsed all the way do not keep unparsed bytes
+      int unparsed_offset = 4;
+      if (af_parsed) {
+        unparsed_offset = (test_buf == pes_buf) ? 12 : MPEG_TS_PACKET_SIZE;
+      }
+      if (pes_parsed) {
+        EXPECT_FALSE(parsed.has_parse_depth()) << "depth " << parse_depth;
+        EXPECT_FALSE(parsed.has_unparsed()) << "depth " << parse_depth;
+      } else {
+        EXPECT_EQ(parse_depth, parsed.parse_depth());
+        EXPECT_EQ(MPEG_TS_PACKET_SIZE - unparsed_offset,
+                  (int)parsed.unparsed().length())
+            << "depth " << parse_depth;
+        EXPECT_EQ(0, memcmp(test_buf + unparsed_offset,
+                            parsed.unparsed().data(),
+                            parsed.unparsed().length()))
+            << "depth " << parse_depth;
+        EXPECT_FALSE(parsed.has_data_bytes()) << "depth " << parse_depth;
+      }
+      if (af_parsed && test_buf == pes_buf) {
+        EXPECT_EQ(0x2468LL, parsed.adaptation_field().pcr().base());
+        EXPECT_EQ(0, parsed.adaptation_field().pcr().extension());
+      }
+      if (pes_parsed && test_buf == pes_buf) {
+        EXPECT_EQ(0xe0, parsed.pes_packet().stream_id());
+        EXPECT_EQ(900000, parsed.pes_packet().pts());
+        ASSERT_EQ(MPEG_TS_PACKET_SIZE - pes_data_offset,
+                  (int)parsed.data_bytes().length());
+        EXPECT_EQ(0, memcmp(pes_buf + pes_data_offset,
+                            parsed.data_bytes().data(),
+                            parsed.data_bytes().length()));
+      }
+    }
+  }
+}
+
+TEST_F(Mpeg2TsParserTest, PayloadMode) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+
+  // full payload (reference)
+  Mpeg2Ts full;
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &full);
+  ASSERT_TRUE(full.parsed().has_data_bytes());
+  int data_len = full.parsed().data_bytes().length();
+
+  Mpeg2Ts mpeg2ts;
+  mpeg2ts_parser_.SetPayloadMode(Mpeg2TsPacket::PAYLOAD_NONE);
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &mpeg2ts);
+  EXPECT_EQ(Mpeg2TsPacket::PAYLOAD_NONE, mpeg2ts.parsed().payload_mode());
+  EXPECT_FALSE(mpeg2ts.parsed().has_data_bytes());
+  EXPECT_FALSE(mpeg2ts.parsed().has_payload_length());
+  EXPECT_FALSE(mpeg2ts.parsed().has_payload_hash());
+  // the PSI section is still parsed
+  EXPECT_EQ(full.parsed().psi_packet().SerializeAsString(),
+            mpeg2ts.parsed().psi_packet().SerializeAsString());
+  // elided payloads cannot be dumped
+  EXPECT_EQ(-1, mpeg2ts_parser_.DumpPacket(mpeg2ts, buf, sizeof(buf)));
+
+  mpeg2ts_parser_.SetPayloadMode(Mpeg2TsPacket::PAYLOAD_LENGTH);
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &mpeg2ts);
+  EXPECT_FALSE(mpeg2ts.parsed().has_data_bytes());
+  EXPECT_EQ(data_len, mpeg2ts.parsed().payload_length());
+  EXPECT_FALSE(mpeg2ts.parsed().has_payload_hash());
+
+  mpeg2ts_parser_.SetPayloadMode(Mpeg2TsPacket::PAYLOAD_HASH);
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &mpeg2ts);
+  EXPECT_FALSE(mpeg2ts.parsed().has_data_bytes());
+  EXPECT_EQ(data_len, mpeg2ts.parsed().payload_length());
+  uint64_t hash = mpeg2ts.parsed().payload_hash();
+  // same payload, same hash
+  memcpy(buf, mpts_pat_header, MPEG_TS_PACKET_SIZE);
+  buf[3] ^= 0x01;
+  mpeg2ts_parser_.ParsePacket(0, 0, buf, MPEG_TS_PACKET_SIZE, &mpeg2ts);
+  EXPECT_EQ(hash, mpeg2ts.parsed().payload_hash());
+  buf[MPEG_TS_PACKET_SIZE - 1] ^= 0x01;
+  mpeg2ts_parser_.ParsePacket(0, 0, buf, MPEG_TS_PACKET_SIZE, &mpeg2ts);
+  EXPECT_NE(hash, mpeg2ts.parsed().payload_hash());
+
+  // partial parses elide the unparsed bytes
+  mpeg2ts_parser_.SetParseDepth(Mpeg2TsPacket::PARSE_DEPTH_HEADER);
+  mpeg2ts_parser_.SetPayloadMode(Mpeg2TsPacket::PAYLOAD_LENGTH);
+  mpeg2ts_parser_.ParsePacket(0, 0, mpts_pat_header, MPEG_TS_PACKET_SIZE,
+                              &mpeg2ts);
+  EXPECT_FALSE(mpeg2ts.parsed().has_unparsed());
+  EXPECT_EQ(MPEG_TS_PACKET_SIZE - 4, mpeg2ts.parsed().payload_length());
+}
+
+TEST_F(Mpeg2TsParserTest, ExtendedPackets) {
+  uint8_t in[MPEG_TS_MAX_PACKET_SIZE];
+  uint8_t out[MPEG_TS_MAX_PACKET_SIZE];
+
+  // BDAV/M2TS packet: TP_extra_header + packet
+  const uint8_t tp_extra_header[] = {0x81, 0x23, 0x45, 0x67};
+  memcpy(in, tp_extra_header, sizeof(tp_extra_header));
+  memcpy(in + sizeof(tp_extra_header), mpts_pat_header, MPEG_TS_PACKET_SIZE);
+  Mpeg2Ts mpeg2ts;
+  EXPECT_EQ(0, mpeg2ts_parser_.SetPacketSize(M2TS_PACKET_SIZE));
+  mpeg2ts_parser_.ParsePacket(0, 0, in, M2TS_PACKET_SIZE, &mpeg2ts);
+  EXPECT_TRUE(mpeg2ts.has_parsed());
+  EXPECT_EQ(2, mpeg2ts.copy_permission_indicator());
+  EXPECT_EQ(0x01234567, mpeg2ts.arrival_timestamp());
+  EXPECT_EQ(M2TS_PACKET_SIZE,
+            mpeg2ts_parser_.DumpPacket(mpeg2ts, out, sizeof(out)));
+  EXPECT_EQ(0, memcmp(in, out, M2TS_PACKET_SIZE));
+
+  // DVB-ASI packet: packet + FEC trailer
+  memcpy(in, mpts_pat_header, MPEG_TS_PACKET_SIZE);
+  for (int i = 0; i < FEC_TRAILER_SIZE; ++i) {
+    in[MPEG_TS_PACKET_SIZE + i] = i;
+  }
+  EXPECT_EQ(0, mpeg2ts_parser_.SetPacketSize(FEC_PACKET_SIZE));
+  mpeg2ts_parser_.ParsePacket(0, 0, in, FEC_PACKET_SIZE, &mpeg2ts);
+  EXPECT_TRUE(mpeg2ts.has_parsed());
+  EXPECT_EQ(FEC_TRAILER_SIZE, (int)mpeg2ts.fec_trailer().length());
+  EXPECT_EQ(FEC_PACKET_SIZE,
+            mpeg2ts_parser_.DumpPacket(mpeg2ts, out, sizeof(out)));
+  EXPECT_EQ(0, memcmp(in, out, FEC_PACKET_SIZE));
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
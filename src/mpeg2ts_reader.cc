@@ -2,84 +2,898 @@
 
 #include "mpeg2ts_reader.h"
 
+#include <errno.h>
+#include <fcntl.h>     // for open, O_DIRECT, posix_fadvise
 #include <inttypes.h>  // for PRId64
-#include <string.h>    // for memmove
+#include <poll.h>
+#include <string.h>  // for memcpy
+#include <sys/inotify.h>
+#include <sys/mman.h>  // for mmap, madvise
+#include <sys/stat.h>  // for fstat
+#include <unistd.h>    // for read, lseek
 
-int Mpeg2TsReader::GetChunk(uint8_t **buf, int64_t *pi, int64_t *bi) {
-  // store current status
-  *buf = buffer_;
-  *pi = pi_;
-  *bi = bi_;
+#include <algorithm>
 
-  // try to get at least 1 block
-  if (blen_ < MPEG_TS_PACKET_SIZE) {
-    size_t inbytes =
-        fread(buffer_ + blen_, 1, MPEG_TS_PACKET_SIZE - blen_, fin_);
+#include "mpeg2ts_sync.h"
+
+Mpeg2TsReader::Mpeg2TsReader(FILE *fin, int debug, ReaderMode mode)
+    : fin_(fin),
+      debug_(debug),
+      start_offset_(-1),
+      input_bi_(0),
+      sync_gap_(DEFAULT_SYNC_GAP),
+      packet_size_(0),
+      sync_offset_(0),
+      bi_(0),
+      pi_(0),
+      pi_exact_(true),
+      input_pi_(0),
+      input_pi_exact_(true),
+      data_(NULL),
+      blen_(0),
+      eof_(false),
+      fd_(-1),
+      map_(NULL),
+      map_size_(0),
+      input_mode_(mode),
+      mode_(mode),
+      direct_started_(false),
+      direct_fd_(-1),
+      file_base_(0),
+      direct_skip_(0),
+      dropped_(0),
+      follow_(false),
+      inotify_fd_(-1),
+      probed_(false) {
+  OpenInput();
+}
+
+int Mpeg2TsReader::OpenInput() {
+  if (mode_ == READER_MODE_AUTO || mode_ == READER_MODE_MMAP) {
+    if (MapInput() < 0 && mode_ == READER_MODE_MMAP && debug_ > 0) {
+      fprintf(stderr, "warning: cannot mmap input: using stream mode\n");
+    }
+  }
+  if (map_ == NULL) {
+    return InitStream();
+  }
+  return 0;
+}
+
+void Mpeg2TsReader::CloseInput() {
+  async_.Stop();
+  prefetch_.Stop();
+  decompressor_.Stop();
+  probed_ = false;
+  if (direct_fd_ >= 0) {
+    close(direct_fd_);
+    direct_fd_ = -1;
+  }
+  direct_started_ = false;
+  direct_skip_ = 0;
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+  follow_ = false;
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+  }
+}
+
+int Mpeg2TsReader::SetInput(FILE *fin) {
+  CloseInput();
+  fin_ = fin;
+  // the byte and packet indices continue from the previous input
+  input_bi_ = bi_;
+  input_pi_ = pi_;
+  input_pi_exact_ = pi_exact_;
+  data_ = NULL;
+  blen_ = 0;
+  eof_ = false;
+  fd_ = -1;
+  start_offset_ = -1;
+  mode_ = input_mode_;
+  if (OpenInput() < 0) {
+    return -1;
+  }
+  if (debug_ > 1) {
+    printf("new input at byte %" PRId64 " (packet %" PRId64 ")\n", bi_, pi_);
+  }
+  return 0;
+}
+
+void Mpeg2TsReader::Close() { CloseInput(); }
+
+Mpeg2TsReader::~Mpeg2TsReader() { CloseInput(); }
+
+int Mpeg2TsReader::InitStream() {
+  fd_ = fileno(fin_);
+  start_offset_ = (fd_ >= 0) ? lseek(fd_, 0, SEEK_CUR) : ftello(fin_);
+  int size = std::max(DEFAULT_RING_BUFFER_SIZE,
+                      sync_gap_ + RING_BUFFER_BLOCK_SIZE);
+  if (ring_.Size() >= size) {
+    // reuse the ring of the previous input
+    ring_.Reset();
+  } else if (ring_.Init(size) < 0) {
+    // nothing can be read: the stream ends here
+    if (error_.empty()) {
+      error_ = "cannot allocate the input buffer";
+    }
+    eof_ = true;
+    return -1;
+  }
+  data_ = ring_.ReadPtr();
+  return 0;
+}
+
+int Mpeg2TsReader::SetFollow(bool follow) {
+  struct stat st;
+  int fd = fileno(fin_);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    return -1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    // pipes already block until there is more data
+    return 0;
+  }
+  follow_ = follow;
+  if (follow_ && map_ != NULL) {
+    // the mapping cannot grow with the file: switch to stream mode at
+    // the current position
+    if (bi_ != input_bi_) {
+      return -1;
+    }
+    off_t offset = start_offset_;
+    munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+      return -1;
+    }
+    return InitStream();
+  }
+  return 0;
+}
+
+void Mpeg2TsReader::WaitForInput() {
+  if (inotify_fd_ < 0) {
+    // watch the file behind the input descriptor
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%i", fileno(fin_));
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ >= 0 &&
+        inotify_add_watch(inotify_fd_, path,
+                          IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) < 0) {
+      close(inotify_fd_);
+      inotify_fd_ = -1;
+    }
+  }
+  if (debug_ > 2) {
+    printf("%" PRId64 ": waiting for more input\n", bi_ + blen_);
+  }
+  if (inotify_fd_ < 0) {
+    // no inotify: poll the file
+    usleep(FOLLOW_POLL_TIMEOUT_MS * 1000);
+    return;
+  }
+  // wait for a change (or the timeout, in case an event is missed),
+  // then drop the pending events
+  struct pollfd pfd;
+  pfd.fd = inotify_fd_;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, FOLLOW_POLL_TIMEOUT_MS) > 0) {
+    char events[4096];
+    while (read(inotify_fd_, events, sizeof(events)) > 0) {
+    }
+  }
+}
+
+int Mpeg2TsReader::MapInput() {
+  int fd = fileno(fin_);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    return -1;
+  }
+  // start at the current position of the stream
+  off_t offset = ftello(fin_);
+  if (offset < 0 || offset > st.st_size) {
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  if (Decompressor::Detect(reinterpret_cast<uint8_t *>(map) + offset,
+                           std::min((off_t)COMPRESSION_MAGIC_SIZE,
+                                    st.st_size - offset)) !=
+      COMPRESSION_NONE) {
+    // compressed input: decompress it in stream mode
+    munmap(map, st.st_size);
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  map_ = reinterpret_cast<uint8_t *>(map);
+  map_size_ = st.st_size;
+  data_ = map_ + offset;
+  start_offset_ = offset;
+  if (debug_ > 1) {
+    printf("mmap'ed %" PRId64 " bytes (starting at %" PRId64 ")\n", map_size_,
+           (int64_t)offset);
+  }
+  return 0;
+}
+
+int Mpeg2TsReader::SetSyncGap(int sync_gap) {
+  sync_gap_ = sync_gap;
+  if (map_ != NULL) {
+    // the mapping already contains the full input
+    return 0;
+  }
+  // the ring must fit the full sync gap (plus a block read)
+  if (sync_gap_ + RING_BUFFER_BLOCK_SIZE > ring_.Size()) {
+    if (async_.Running()) {
+      // restart the async reads (into the new ring) where they stopped
+      lseek(fd_, async_.Offset(), SEEK_SET);
+      async_.Stop();
+    }
+    if (prefetch_.Running()) {
+      // restart the read-ahead (into the new ring) where it stopped
+      int64_t offset = prefetch_.Offset();
+      prefetch_.Stop();
+      if (offset >= 0) {
+        lseek(fd_, offset, SEEK_SET);
+      }
+    }
+    if (direct_started_) {
+      // restart the direct reads (aligned to the new ring)
+      lseek(fd_, file_base_ + ring_.WritePos(), SEEK_SET);
+      StopDirect();
+      direct_started_ = false;
+    }
+    if (ring_.Init(sync_gap_ + RING_BUFFER_BLOCK_SIZE) < 0) {
+      return -1;
+    }
+    data_ = ring_.ReadPtr();
+    blen_ = 0;
+  }
+  return 0;
+}
+
+int Mpeg2TsReader::SetPacketSize(int packet_size) {
+  if (packet_size != 0 && packet_size != MPEG_TS_PACKET_SIZE &&
+      packet_size != M2TS_PACKET_SIZE && packet_size != FEC_PACKET_SIZE) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  sync_offset_ = (packet_size_ == M2TS_PACKET_SIZE) ? 4 : 0;
+  return 0;
+}
+
+void Mpeg2TsReader::DetectPacketSize() {
+  static const int kPacketSizes[] = {MPEG_TS_PACKET_SIZE, M2TS_PACKET_SIZE,
+                                     FEC_PACKET_SIZE};
+  // (in follow mode, only wait for the bytes needed to probe)
+  Fill(PACKET_SIZE_PROBE_COUNT * MPEG_TS_MAX_PACKET_SIZE);
+  Fill(sync_gap_, false);
+  int window = std::min(blen_, (int64_t)sync_gap_);
+  // pick the packet size whose first sync point comes earliest (ties go
+  // to the smallest size)
+  int best_size = MPEG_TS_PACKET_SIZE;
+  int best_offset = -1;
+  for (int size : kPacketSizes) {
+    int sync_offset = (size == M2TS_PACKET_SIZE) ? 4 : 0;
+    int count =
+        std::min(PACKET_SIZE_PROBE_COUNT, (window - sync_offset) / size);
+    if (count < 2) {
+      continue;
+    }
+    int num_offsets = window - sync_offset - (count - 1) * size;
+    int offset = find_sync_point(data_ + sync_offset, num_offsets, size, count);
+    if (offset >= 0 && (best_offset < 0 || offset < best_offset)) {
+      best_size = size;
+      best_offset = offset;
+    }
+  }
+  SetPacketSize(best_size);
+  if (debug_ > 0) {
+    printf("packet size: %i (sync at byte %" PRId64 ")\n", packet_size_,
+           bi_ + best_offset);
+  }
+}
+
+void Mpeg2TsReader::StartAsync() {
+  // the async reads need a file offset
+  off_t offset = (fd_ >= 0) ? lseek(fd_, 0, SEEK_CUR) : -1;
+  AsyncBackend backend = (mode_ == READER_MODE_ASYNC_THREADS)
+                             ? ASYNC_BACKEND_THREADS
+                             : ASYNC_BACKEND_AUTO;
+  if (offset < 0 || async_.Init(fd_, offset, &ring_, RING_BUFFER_BLOCK_SIZE,
+                                DEFAULT_ASYNC_QUEUE_DEPTH, backend) < 0) {
+    if (debug_ > 0) {
+      fprintf(stderr, "warning: cannot read input asynchronously: using "
+                      "stream mode\n");
+    }
+    mode_ = READER_MODE_STREAM;
+    return;
+  }
+  if (debug_ > 1) {
+    printf("async reads: %s (starting at %" PRId64 ")\n",
+           async_.BackendName(), (int64_t)offset);
+  }
+}
+
+void Mpeg2TsReader::StartPrefetch() {
+  if (prefetch_.Init(fd_, &ring_, RING_BUFFER_BLOCK_SIZE,
+                     DEFAULT_PREFETCH_DEPTH) < 0) {
+    if (debug_ > 0) {
+      fprintf(stderr, "warning: cannot read input ahead: using stream "
+                      "mode\n");
+    }
+    mode_ = READER_MODE_STREAM;
+    return;
+  }
+  if (debug_ > 1) {
+    printf("read-ahead: %i blocks of %i bytes\n", DEFAULT_PREFETCH_DEPTH,
+           RING_BUFFER_BLOCK_SIZE);
+  }
+}
+
+void Mpeg2TsReader::StartDirect() {
+  direct_started_ = true;
+  struct stat st;
+  off_t offset = (fd_ >= 0) ? lseek(fd_, 0, SEEK_CUR) : -1;
+  if (offset < 0 || fstat(fd_, &st) < 0 || !S_ISREG(st.st_mode)) {
+    if (debug_ > 0) {
+      fprintf(stderr, "warning: cannot use direct reads: using stream mode\n");
+    }
+    mode_ = READER_MODE_STREAM;
+    return;
+  }
+  file_base_ = offset - ring_.WritePos();
+  dropped_ = offset;
+  // O_DIRECT needs aligned buffers: the ring memory must not move
+  if (ring_.IsMirrored() && ring_.Used() == 0) {
+    // reopen the input (so the caller's descriptor is left as is)
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%i", fd_);
+    direct_fd_ = open(path, O_RDONLY | O_DIRECT);
+  }
+  if (direct_fd_ >= 0) {
+    // start reading at the aligned offset (and ring position) right
+    // before the current position
+    int64_t aligned = offset & ~(int64_t)(DIRECT_IO_ALIGNMENT - 1);
+    ring_.Reset();
+    file_base_ = aligned;
+    direct_skip_ = offset - aligned;
+    if (lseek(direct_fd_, aligned, SEEK_SET) < 0) {
+      StopDirect();
+    }
+  }
+  if (debug_ > 1) {
+    printf("direct reads: %s (starting at %" PRId64 ")\n",
+           (direct_fd_ >= 0) ? "O_DIRECT" : "fadvise", (int64_t)offset);
+  }
+}
+
+void Mpeg2TsReader::StopDirect() {
+  if (direct_fd_ < 0) {
+    return;
+  }
+  close(direct_fd_);
+  direct_fd_ = -1;
+  // continue with buffered reads at the ring write cursor
+  lseek(fd_, file_base_ + ring_.WritePos(), SEEK_SET);
+  if (debug_ > 1) {
+    printf("direct reads: O_DIRECT not supported: using fadvise\n");
+  }
+}
+
+void Mpeg2TsReader::DropCache() {
+  // only drop full pages behind the read cursor
+  int64_t end = (file_base_ + ring_.ReadPos()) &
+                ~(int64_t)(DIRECT_IO_ALIGNMENT - 1);
+  if (end > dropped_) {
+    posix_fadvise(fd_, dropped_, end - dropped_, POSIX_FADV_DONTNEED);
+    dropped_ = end;
+  }
+}
+
+void Mpeg2TsReader::ProbeCompression() {
+  probed_ = true;
+  if (fd_ < 0 || ring_.Used() > 0) {
+    return;
+  }
+  uint8_t magic[COMPRESSION_MAGIC_SIZE];
+  int len = 0;
+  off_t offset = lseek(fd_, 0, SEEK_CUR);
+  if (offset >= 0) {
+    len = std::max((ssize_t)0, pread(fd_, magic, sizeof(magic), offset));
+  } else {
+    // non-seekable input: the probed bytes are either kept in the ring,
+    // or passed to the decompressor
+    while (len < COMPRESSION_MAGIC_SIZE) {
+      ssize_t res = ReadInput(ring_.WritePtr() + len,
+                              COMPRESSION_MAGIC_SIZE - len);
+      if (res <= 0) {
+        break;
+      }
+      len += res;
+    }
+    memcpy(magic, ring_.WritePtr(), len);
+    ring_.Produce(len);
+  }
+  CompressionFormat format = Decompressor::Detect(magic, len);
+  if (format == COMPRESSION_NONE) {
+    return;
+  }
+  if (offset < 0) {
+    ring_.Reset();
+  } else if (format == COMPRESSION_ZSTD) {
+    decompressor_.LoadSeekTable(fd_);
+  }
+  if (!Decompressor::Supported(format) ||
+      decompressor_.Start(fd_, format, (offset < 0) ? magic : NULL,
+                          (offset < 0) ? len : 0) < 0) {
+    if (error_.empty()) {
+      const char *name = Decompressor::FormatName(format);
+      char error[128];
+      if (Decompressor::Supported(format)) {
+        snprintf(error, sizeof(error), "cannot decompress %s input", name);
+      } else {
+        snprintf(error, sizeof(error),
+                 "cannot decompress %s input (built without %s support)",
+                 name, name);
+      }
+      error_ = error;
+    }
+    eof_ = true;
+    return;
+  }
+  // the decompressor reads the input: byte indices are now offsets in
+  // the decompressed stream
+  mode_ = READER_MODE_STREAM;
+  start_offset_ = -1;
+  data_ = ring_.ReadPtr();
+  if (debug_ > 1) {
+    printf("%s input (%s)\n", Decompressor::FormatName(format),
+           decompressor_.Seekable() ? "seekable" : "not seekable");
+  }
+}
+
+ssize_t Mpeg2TsReader::ReadInput(uint8_t *buf, int len) {
+  if (decompressor_.Running()) {
+    return decompressor_.Read(buf, len);
+  }
+  if (fd_ < 0) {
+    // no file descriptor (e.g. a memory stream)
+    return fread(buf, 1, len, fin_);
+  }
+  int fd = (direct_fd_ >= 0) ? direct_fd_ : fd_;
+  ssize_t res;
+  do {
+    res = read(fd, buf, len);
+  } while (res < 0 && errno == EINTR);
+  return res;
+}
+
+int64_t Mpeg2TsReader::Fill(int64_t size, bool wait) {
+  if (map_ != NULL) {
+    // all the remaining bytes are available
+    blen_ = (map_ + map_size_) - data_;
+    eof_ = (blen_ < size);
+    return blen_;
+  }
+
+  if (!probed_ && !eof_) {
+    ProbeCompression();
+  }
+
+  if ((mode_ == READER_MODE_ASYNC || mode_ == READER_MODE_ASYNC_THREADS) &&
+      !async_.Running() && !eof_) {
+    StartAsync();
+  }
+
+  if (mode_ == READER_MODE_DIRECT && !direct_started_ && !eof_) {
+    StartDirect();
+  }
+
+  if (mode_ == READER_MODE_PREFETCH && !prefetch_.Running() && !eof_) {
+    StartPrefetch();
+  }
+
+  // read full blocks until we have enough data
+  while (ring_.Used() < size && !eof_) {
+    if (async_.Running()) {
+      ssize_t res = async_.Read();
+      if (res == 0 && follow_) {
+        if (!wait) {
+          break;
+        }
+        WaitForInput();
+      } else if (res <= 0) {
+        eof_ = true;
+      }
+      continue;
+    }
+    if (prefetch_.Running()) {
+      ssize_t res = prefetch_.Read();
+      if (res == 0 && follow_) {
+        // restart the read-ahead once the file grows
+        prefetch_.Stop();
+        if (!wait) {
+          break;
+        }
+        WaitForInput();
+        StartPrefetch();
+      } else if (res <= 0) {
+        eof_ = true;
+      }
+      continue;
+    }
+    int len = std::min(ring_.Free(),
+                       RING_BUFFER_BLOCK_SIZE -
+                           (int)(ring_.WritePos() % RING_BUFFER_BLOCK_SIZE));
+    if (direct_fd_ >= 0) {
+      // O_DIRECT lengths must be aligned too
+      len &= ~(DIRECT_IO_ALIGNMENT - 1);
+      if (len == 0) {
+        break;
+      }
+    }
+    ssize_t inbytes = ReadInput(ring_.WritePtr(), len);
+    if (inbytes < 0 && errno == EINVAL && direct_fd_ >= 0) {
+      // the filesystem does not support O_DIRECT reads
+      StopDirect();
+      continue;
+    }
     if (debug_ > 3) {
-      printf("%" PRId64 "-%" PRId64 ": reading %i\n", bi_, bi_ + inbytes,
-             MPEG_TS_PACKET_SIZE - blen_);
+      printf("%" PRId64 "-%" PRId64 ": reading %i\n", ring_.WritePos(),
+             ring_.WritePos() + (inbytes > 0 ? inbytes : 0), len);
+    }
+    if (inbytes == 0 && follow_ && !decompressor_.Running()) {
+      // the file may grow: wait for more data
+      if (!wait) {
+        break;
+      }
+      WaitForInput();
+      continue;
+    }
+    if (inbytes < 0 && decompressor_.Running() && error_.empty()) {
+      // (the bytes decoded before the error were already returned)
+      char error[128];
+      snprintf(error, sizeof(error), "%s %s input at byte %" PRId64,
+               Decompressor::ErrorName(decompressor_.Error()),
+               Decompressor::FormatName(decompressor_.Format()),
+               input_bi_ + decompressor_.ErrorOffset());
+      error_ = error;
     }
-    blen_ += inbytes;
+    if (inbytes <= 0) {
+      eof_ = true;
+      break;
+    }
+    ring_.Produce(inbytes);
+    if (direct_skip_ > 0) {
+      // drop the bytes before the start position
+      int skip = std::min(direct_skip_, ring_.Used());
+      ring_.Consume(skip);
+      direct_skip_ -= skip;
+    }
+    if (mode_ == READER_MODE_DIRECT && direct_fd_ < 0) {
+      DropCache();
+    }
+  }
+  data_ = ring_.ReadPtr();
+  blen_ = ring_.Used();
+  return blen_;
+}
+
+int64_t Mpeg2TsReader::InputSize() {
+  if (map_ != NULL) {
+    return input_bi_ + map_size_ - start_offset_;
+  }
+  if (!probed_) {
+    ProbeCompression();
   }
+  if (decompressor_.Running()) {
+    // the decompressed size is only known for seekable zstd inputs
+    return decompressor_.Seekable()
+               ? input_bi_ + decompressor_.DecompressedSize()
+               : -1;
+  }
+  struct stat st;
+  if (start_offset_ < 0 || fd_ < 0 || fstat(fd_, &st) < 0 ||
+      !S_ISREG(st.st_mode)) {
+    return -1;
+  }
+  return input_bi_ + st.st_size - start_offset_;
+}
+
+int64_t Mpeg2TsReader::InputOffset(int64_t bi) const {
+  if (start_offset_ < 0 || decompressor_.Running()) {
+    return -1;
+  }
+  return start_offset_ + (bi - input_bi_);
+}
+
+int Mpeg2TsReader::Seek(int64_t bi) {
+  if (map_ != NULL) {
+    data_ = map_ + std::min(start_offset_ + (bi - input_bi_), map_size_);
+    blen_ = 0;
+  } else if (decompressor_.Seekable() && decompressor_.Running()) {
+    // restart the decompression at the frame containing <bi>, and
+    // read forward from there
+    int64_t frame = decompressor_.SeekFrame(bi - input_bi_);
+    if (frame < 0) {
+      return -1;
+    }
+    ring_.Reset();
+    data_ = ring_.ReadPtr();
+    blen_ = 0;
+    bi_ = input_bi_ + frame;
+    eof_ = false;
+    while (bi_ < bi) {
+      if (Fill(std::min(bi - bi_, (int64_t)(ring_.Size() / 2))) <= 0) {
+        break;
+      }
+      Advance(std::min(blen_, bi - bi_), 0);
+    }
+  } else if (start_offset_ >= 0) {
+    // stop the pending reads, and restart them at the new position
+    async_.Stop();
+    prefetch_.Stop();
+    if (direct_started_) {
+      StopDirect();
+      direct_started_ = false;
+    }
+    int64_t offset = start_offset_ + (bi - input_bi_);
+    int res = (fd_ >= 0) ? (int)(lseek(fd_, offset, SEEK_SET) < 0)
+                         : fseeko(fin_, offset, SEEK_SET);
+    if (res != 0) {
+      return -1;
+    }
+    ring_.Reset();
+    data_ = ring_.ReadPtr();
+    blen_ = 0;
+  } else {
+    // non-seekable input: read forward
+    if (bi < bi_) {
+      return -1;
+    }
+    while (bi_ < bi) {
+      if (Fill(std::min(bi - bi_, (int64_t)(ring_.Size() / 2))) <= 0) {
+        break;
+      }
+      Advance(std::min(blen_, bi - bi_), 0);
+    }
+  }
+  bi_ = bi;
+  eof_ = false;
+  return 0;
+}
+
+int Mpeg2TsReader::SkipToSync() {
+  Mpeg2TsChunk chunk;
+  int len = GetChunk(&chunk);
+  if (len > 0 && !chunk.synced) {
+    Advance(len, 0);
+  }
+  return (len < 0) ? -1 : 0;
+}
+
+int Mpeg2TsReader::SeekTo(int64_t bi, int64_t pi) {
+  if (packet_size_ == 0) {
+    DetectPacketSize();
+  }
+  // the cursor is the target if it reaches both bounds, and it is the
+  // first chunk that does (the previous one missed one of them)
+  bool reached = (bi < 0 || bi_ >= bi) && (pi < 0 || pi_ >= pi);
+  bool first = (bi >= 0 && bi_ == bi) || (pi >= 0 && pi_ == pi) ||
+               (bi_ == input_bi_);
+  if (!pi_exact_ || (reached && !first)) {
+    // count again from the start of the input
+    if (!input_pi_exact_ || Seek(input_bi_) < 0) {
+      return -1;
+    }
+    pi_ = input_pi_;
+    pi_exact_ = true;
+  }
+  // scan the chunks (as a full read would return them) up to the
+  // target
+  Mpeg2TsChunk chunk;
+  while ((bi >= 0 && bi_ < bi) || (pi >= 0 && pi_ < pi)) {
+    int len = GetPackets(SEEK_SCAN_PACKETS, &chunk);
+    if (len <= 0) {
+      // lost sync, or the end of the stream
+      return len;
+    }
+    if (chunk.synced) {
+      // stop in the run at the first packet reaching both bounds
+      int64_t count = 0;
+      if (bi >= 0 && bi > chunk.bi) {
+        count = (bi - chunk.bi + packet_size_ - 1) / packet_size_;
+      }
+      if (pi >= 0) {
+        count = std::max(count, pi - chunk.pi);
+      }
+      if (count < chunk.count) {
+        Advance(count * packet_size_, count);
+        break;
+      }
+    }
+    Next(chunk);
+  }
+  if (debug_ > 1) {
+    printf("seek to byte %" PRId64 ", packet %" PRId64 ": packet %" PRId64
+           " at byte %" PRId64 "\n",
+           bi, pi, pi_, bi_);
+  }
+  return 0;
+}
+
+int Mpeg2TsReader::SeekByte(int64_t bi, bool exact) {
+  if (exact) {
+    return SeekTo(bi, -1);
+  }
+  if (packet_size_ == 0) {
+    DetectPacketSize();
+  }
+  if (Seek(bi) < 0 || SkipToSync() < 0) {
+    return -1;
+  }
+  pi_ = bi_ / packet_size_;
+  pi_exact_ = false;
+  if (debug_ > 1) {
+    printf("seek to byte %" PRId64 ": packet %" PRId64 " (estimated) at byte "
+           "%" PRId64 "\n",
+           bi, pi_, bi_);
+  }
+  return 0;
+}
+
+int Mpeg2TsReader::SeekPacket(int64_t pi) { return SeekTo(-1, pi); }
+
+int Mpeg2TsReader::SeekChunk(int64_t bi, int64_t pi) {
+  if (packet_size_ == 0) {
+    DetectPacketSize();
+  }
+  if (Seek(bi) < 0) {
+    return -1;
+  }
+  pi_ = pi;
+  pi_exact_ = true;
+  return 0;
+}
+
+int Mpeg2TsReader::GetChunk(const uint8_t **buf, int64_t *pi, int64_t *bi) {
+  Mpeg2TsChunk chunk;
+  int len = GetChunk(&chunk);
+  *buf = chunk.buf;
+  *pi = chunk.pi;
+  *bi = chunk.bi;
+  return len;
+}
+
+int Mpeg2TsReader::GetChunk(Mpeg2TsChunk *chunk) {
+  if (packet_size_ == 0) {
+    DetectPacketSize();
+  }
+
+  // try to get at least 1 block
+  Fill(packet_size_);
+
+  // store current status
+  chunk->buf = data_;
+  chunk->pi = pi_;
+  chunk->bi = bi_;
+  chunk->len = 0;
+  chunk->count = 1;
+  chunk->synced = false;
+
   // ensure we have 1 block available
-  if (blen_ < MPEG_TS_PACKET_SIZE && feof(fin_)) {
+  if (blen_ < packet_size_ && eof_) {
     // treat this as a full chunk
-    return blen_;
+    chunk->len = blen_;
+    return chunk->len;
   }
 
   // check whether this is a valid packet
-  if (blen_ >= MPEG_TS_PACKET_SIZE && buffer_[0] == MPEG_TS_PACKET_SYNC) {
+  if (blen_ >= packet_size_ && data_[sync_offset_] == MPEG_TS_PACKET_SYNC) {
     if (debug_ > 2) {
-      printf("%" PRId64 ": found 0x47\n", bi_);
+      printf("%" PRId64 ": found 0x47\n", bi_ + sync_offset_);
     }
-    return MPEG_TS_PACKET_SIZE;
+    chunk->len = packet_size_;
+    chunk->synced = true;
+    return chunk->len;
   }
 
   // need to sync the stream
 
   // read (up to) sync_gap bytes
-  if (blen_ < sync_gap_) {
-    size_t inbytes = fread(buffer_ + blen_, 1, sync_gap_ - blen_, fin_);
-    if (debug_ > 1) {
-      printf("%" PRId64 "-%" PRId64 ": reading %i\n", bi_, bi_ + inbytes,
-             sync_gap_ - blen_);
-    }
-    blen_ += inbytes;
-  }
+  Fill(sync_gap_);
+  // (Fill() may have moved the buffered bytes)
+  chunk->buf = data_;
+  chunk->pi = pi_;
+  chunk->bi = bi_;
+  int window = std::min(blen_, (int64_t)sync_gap_);
 
   // ensure we have enough bytes to sync up
-  if (blen_ < (3 * MPEG_TS_PACKET_SIZE) && feof(fin_)) {
-    return blen_;
+  if (window < (3 * packet_size_) && eof_) {
+    chunk->len = window;
+    return chunk->len;
   }
 
-  // look for 3 'G's in a row, up to MPEG_TS_PACKET_SIZE bytes from the
-  // beginning
-  int i = 0;
-  while ((2 * i + MPEG_TS_PACKET_SIZE) < blen_) {
-    if (buffer_[i] == MPEG_TS_PACKET_SYNC &&
-        buffer_[i + MPEG_TS_PACKET_SIZE] == MPEG_TS_PACKET_SYNC &&
-        buffer_[i + (2 * MPEG_TS_PACKET_SIZE)] == MPEG_TS_PACKET_SYNC) {
-      // found sync point
-      if (debug_ > 2) {
-        printf("%" PRId64 "-%" PRId64 "-%" PRId64 ": found 3x 0x47...\n",
-               bi_ + i, bi_ + i + MPEG_TS_PACKET_SIZE,
-               bi_ + i + (2 * MPEG_TS_PACKET_SIZE));
-      }
-      // return the unsync'ed bytes
-      return i;
+  // look for 3 'G's in a row, up to (sync_gap - packet_size) / 2 bytes
+  // from the beginning
+  int num_offsets = std::min((window - packet_size_ + 1) / 2,
+                             window - sync_offset_ - (2 * packet_size_));
+  int i = find_sync_point(data_ + sync_offset_, std::max(num_offsets, 0),
+                          packet_size_, 3);
+  if (i >= 0) {
+    // found sync point
+    if (debug_ > 2) {
+      int64_t sync_bi = bi_ + i + sync_offset_;
+      printf("%" PRId64 "-%" PRId64 "-%" PRId64 ": found 3x 0x47...\n",
+             sync_bi, sync_bi + packet_size_, sync_bi + (2 * packet_size_));
     }
-    ++i;
+    // return the unsync'ed bytes
+    chunk->len = i;
+    return chunk->len;
   }
 
   // no sync found: punt
+  chunk->len = -1;
   return -1;
 }
 
-void Mpeg2TsReader::Next(int used_size) {
-  if (blen_ > used_size) {
-    memmove(buffer_, buffer_ + used_size, blen_ - used_size);
+int Mpeg2TsReader::GetPackets(int max_packets, Mpeg2TsChunk *chunk) {
+  int len = GetChunk(chunk);
+  if (len <= 0 || !chunk->synced) {
+    return len;
+  }
+
+  // extend the run while the next packet would also be a valid one
+  int64_t size = (int64_t)max_packets * packet_size_;
+  if (map_ == NULL) {
+    // do not ask for more than the ring can hold
+    size = std::min(size, (int64_t)(ring_.Size() / 2));
+  }
+  // (do not wait for more data in follow mode)
+  Fill(size, false);
+  const uint8_t *buf = data_;
+  int max_count = std::min((int64_t)max_packets, blen_ / packet_size_);
+  int count = 1;
+  while (count < max_count &&
+         buf[count * packet_size_ + sync_offset_] == MPEG_TS_PACKET_SYNC) {
+    ++count;
+  }
+  if (debug_ > 2) {
+    printf("%" PRId64 ": found %i packets\n", bi_, count);
+  }
+  chunk->buf = buf;
+  chunk->count = count;
+  chunk->len = count * packet_size_;
+  return chunk->len;
+}
+
+void Mpeg2TsReader::Advance(int size, int count) {
+  // just move the cursor (over the mapping or the ring)
+  if (map_ == NULL) {
+    ring_.Consume(size);
   }
-  blen_ -= used_size;
-  bi_ += used_size;
-  pi_ += 1;
+  data_ += size;
+  blen_ -= size;
+  bi_ += size;
+  pi_ += count;
+}
+
+void Mpeg2TsReader::Next(int used_size) { Advance(used_size, 1); }
+
+void Mpeg2TsReader::Next(const Mpeg2TsChunk &chunk) {
+  Advance(chunk.len, chunk.count);
 }
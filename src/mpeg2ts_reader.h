@@ -3,57 +3,316 @@
 #ifndef MPEG2TS_READER_H_
 #define MPEG2TS_READER_H_
 
-#include <stdint.h>  // for uint8_t, int64_t
-#include <stdio.h>   // for FILE
+#include <stdint.h>     // for uint8_t, int64_t
+#include <stdio.h>      // for FILE
+#include <sys/types.h>  // for ssize_t
+
+#include <string>
+
+#include "async_reader.h"
+#include "decompressor.h"
+#include "prefetch_reader.h"
+#include "ring_buffer.h"
 
 #define MPEG_TS_PACKET_SYNC 0x47  // 'G'
 #define MPEG_TS_PACKET_SIZE 188
+// BDAV/M2TS packets: 4-byte TP_extra_header + mpeg-ts packet
+#define M2TS_PACKET_SIZE 192
+// DVB-ASI packets: mpeg-ts packet + 16-byte Reed-Solomon trailer
+#define FEC_PACKET_SIZE 204
+#define MPEG_TS_MAX_PACKET_SIZE FEC_PACKET_SIZE
+
+// number of sync bytes in a row needed to detect the packet size
+#define PACKET_SIZE_PROBE_COUNT 5
+
+// O_DIRECT buffer address, file offset, and length alignment
+#define DIRECT_IO_ALIGNMENT 4096
+
+// follow mode: maximum time waiting for a file change before retrying
+#define FOLLOW_POLL_TIMEOUT_MS 1000
 
 #define DEFAULT_SYNC_GAP (10 * MPEG_TS_PACKET_SIZE)
 
+// packets per run when scanning for an exact seek (see SeekTo())
+#define SEEK_SCAN_PACKETS 1024
+
+// reader input modes
+typedef enum {
+  READER_MODE_INVALID = -1,
+  // mmap regular files, stream anything else
+  READER_MODE_AUTO = 0,
+  // read-based input (through a ring buffer)
+  READER_MODE_STREAM = 1,
+  // memory-mapped input (regular files only)
+  READER_MODE_MMAP = 2,
+  // asynchronous reads, several blocks ahead (regular files only):
+  // io_uring, or a thread pool if io_uring is not available
+  READER_MODE_ASYNC = 3,
+  // asynchronous reads using the thread pool
+  READER_MODE_ASYNC_THREADS = 4,
+  // O_DIRECT reads, bypassing the page cache (regular files only). If
+  // O_DIRECT is not supported, it uses buffered reads, and drops the
+  // pages behind the cursor from the page cache.
+  READER_MODE_DIRECT = 5,
+  // read-ahead: a background thread reads the next blocks into the
+  // ring while the current ones are parsed (any input)
+  READER_MODE_PREFETCH = 6,
+} ReaderMode;
+
+// a chunk of the input stream (a packet, or a non-parseable chunk)
+//
+// GetPackets() also returns runs of contiguous sync'ed packets as a
+// single chunk: packet k in the run starts at buf + k * packet_size,
+// and has packet index pi + k and byte index bi + k * packet_size
+// (see Mpeg2TsReader::PacketSize()).
+struct Mpeg2TsChunk {
+  const uint8_t *buf;
+  int len;
+  // packet/byte index of the first byte in the chunk
+  int64_t pi;
+  int64_t bi;
+  // number of packets in the chunk (a non-parseable chunk counts as 1)
+  int count;
+  // whether the chunk contains sync'ed packets
+  bool synced;
+};
+
 // an mpeg-ts stream sync'er
 //
 // Algorithm:
 //   - Find 'G', look 188 bytes down, expect another 'G'.
 //   - If we find 3 'G's in a row, we found a sync point.
 //     - If we do not find them in sync_gap_, punt.
+//
+// The packet size (188, 192 or 204 bytes) is detected on the first
+// chunk by looking for PACKET_SIZE_PROBE_COUNT sync bytes in a row at
+// each of the strides, unless it is set with SetPacketSize(). With
+// 192-byte packets, the sync byte follows the 4-byte TP_extra_header,
+// and chunks start at the header.
+//
+// Regular files are memory-mapped (unless mode is READER_MODE_STREAM),
+// so chunks point straight into the mapping. Anything else (pipes,
+// stdin) is read in large blocks into a ring buffer, and chunks point
+// into the ring. In the async modes, regular files are read into the
+// ring by an AsyncReader, which keeps several block reads in flight.
+// In the direct mode, regular files are read into the ring with
+// O_DIRECT, in aligned blocks. In the prefetch mode, any input is read
+// into the ring by a PrefetchReader thread, ahead of the parser.
+//
+// gzip and zstd inputs are detected by their magic numbers, and
+// decompressed (on a separate thread) into the ring. Byte indices are
+// then offsets in the decompressed stream. Seekable zstd inputs can
+// seek to any frame: other compressed inputs can only move forward.
 
 class Mpeg2TsReader {
  public:
-  explicit Mpeg2TsReader(FILE *fin, int debug)
-      : fin_(fin), debug_(debug), sync_gap_(DEFAULT_SYNC_GAP) {
-    buffer_ = new uint8_t[sync_gap_];
-    blen_ = 0;
-    pi_ = 0;
-    bi_ = 0;
-  }
-  ~Mpeg2TsReader() { delete[] buffer_; }
-
-  int SetSyncGap(int sync_gap) {
-    delete[] buffer_;
-    sync_gap_ = sync_gap;
-    buffer_ = new uint8_t[sync_gap_];
-    blen_ = 0;
-    if (!buffer_) {
-      return -1;
-    }
-    return 0;
+  explicit Mpeg2TsReader(FILE *fin, int debug,
+                         ReaderMode mode = READER_MODE_AUTO);
+  ~Mpeg2TsReader();
+
+  int SetSyncGap(int sync_gap);
+
+  // Set the packet size (0 to auto-detect it). Returns -1 if the size
+  // is not supported.
+  int SetPacketSize(int packet_size);
+
+  // Continue reading from a new input (e.g. the next file of a split
+  // recording). The byte and packet indices continue from the current
+  // input, and the packet size is kept. Chunks from the previous input
+  // must not be used after this. Returns 0 if successful, -1 otherwise.
+  int SetInput(FILE *fin);
+
+  // Stop reading from the current input (joining the read-ahead and
+  // decompression threads), so it can be closed. Chunks must not be
+  // used after this, and the reader can only continue with SetInput().
+  void Close();
+
+  // Follow a growing file (tail -f): at the end of the file, wait
+  // (using inotify) for more data instead of returning. A short final
+  // packet is then incomplete, not a non-parseable chunk. Memory-mapped
+  // inputs switch to stream mode (before the first read only). Returns
+  // -1 if the input cannot be followed.
+  int SetFollow(bool follow);
+
+  // Returns the packet size (only valid after the first GetChunk())
+  int PacketSize() const { return packet_size_; }
+
+  // Returns whether the input is memory-mapped
+  bool IsMapped() const { return map_ != NULL; }
+
+  // Returns the name of the async read backend ("none" if not in use)
+  const char *AsyncBackendName() const { return async_.BackendName(); }
+
+  // Returns why the input could not be read completely (e.g. a corrupt
+  // or truncated compressed input, or an unsupported compression
+  // format), or NULL if there was no error. The error is sticky: the
+  // stream ends (as if the input ended) after the last good bytes.
+  const char *Error() const {
+    return error_.empty() ? NULL : error_.c_str();
   }
 
+  // Returns the input size (in bytes, from the initial position, plus
+  // the previous inputs), or -1 if the input is not seekable
+  int64_t InputSize();
+
+  // Returns the file offset of byte <bi> of the current input, or -1
+  // if the input bytes have no file offset (non-seekable or compressed
+  // inputs)
+  int64_t InputOffset(int64_t bi) const;
+
+  // Move the cursor to the first chunk at (or after) byte <bi> and
+  // packet <pi> (-1 for no bound), with the chunks and packet indices
+  // of a full read: the chunks are scanned (sync only, from the start
+  // of the current input if the cursor is past the target, or its
+  // packet index is estimated). Non-seekable inputs can only move
+  // forward. Returns 0 if successful (at the end of the stream if the
+  // target is past it), -1 otherwise.
+  int SeekTo(int64_t bi, int64_t pi);
+
+  // Move the cursor to byte <bi> (from the initial position), which
+  // must be in the current input (see SetInput()). If <exact>, same as
+  // SeekTo(bi, -1). Otherwise, the input is repositioned without
+  // scanning, the cursor skips to the next sync point, and the packet
+  // index is estimated as bi / PacketSize() (see PacketIndexExact()).
+  int SeekByte(int64_t bi, bool exact = true);
+
+  // Move the cursor to packet <pi> (same as SeekTo(-1, pi)).
+  int SeekPacket(int64_t pi);
+
+  // Move the cursor to byte <bi>, which must be a chunk boundary of a
+  // full read with packet index <pi> (e.g. a chunk returned by another
+  // reader of the same input), without scanning. Returns 0 if
+  // successful, -1 otherwise.
+  int SeekChunk(int64_t bi, int64_t pi);
+
+  // Returns whether the packet indices are those of a full read (i.e.
+  // there was no estimated seek since the start of the input)
+  bool PacketIndexExact() const { return pi_exact_; }
+
   // Get a chunk (a packet, or a non-parseable chunk)
-  int GetChunk(uint8_t **buf, int64_t *pi, int64_t *bi);
+  int GetChunk(const uint8_t **buf, int64_t *pi, int64_t *bi);
+
+  // Get a chunk (a packet, or a non-parseable chunk). Returns the
+  // chunk length (0 at the end of the stream, -1 if sync was lost).
+  int GetChunk(Mpeg2TsChunk *chunk);
+
+  // Get a run of up to <max_packets> contiguous sync'ed packets. If
+  // the stream is not sync'ed at the current position, it returns the
+  // non-parseable chunk instead. Returns the chunk length (0 at the end
+  // of the stream, -1 if sync was lost).
+  int GetPackets(int max_packets, Mpeg2TsChunk *chunk);
 
   // Get next packet
   void Next(int used_size);
 
+  // Skip a full chunk (as returned by GetChunk() or GetPackets())
+  void Next(const Mpeg2TsChunk &chunk);
+
  private:
+  // Ensure (up to) <size> bytes are available at data_. Returns the
+  // number of available bytes, and sets eof_ if the input cannot
+  // provide <size> bytes. In follow mode, it waits for the file to grow
+  // instead (unless <wait> is false).
+  int64_t Fill(int64_t size, bool wait = true);
+
+  // set up the current input (mmap or stream mode). Returns -1 (and
+  // sets the input error) if the input cannot be read.
+  int OpenInput();
+  // release the current input state
+  void CloseInput();
+
+  // set up the ring buffer (stream mode). Returns -1 if it cannot be
+  // allocated.
+  int InitStream();
+
+  // follow mode: wait until the input file changes
+  void WaitForInput();
+
+  int MapInput();
+
+  // start the async reads (at the current input position)
+  void StartAsync();
+
+  // start the read-ahead thread (at the current input position)
+  void StartPrefetch();
+
+  // start the direct reads (at the current input position)
+  void StartDirect();
+  // switch the direct reads back to buffered reads
+  void StopDirect();
+  // drop the input pages behind the cursor from the page cache
+  void DropCache();
+
+  // probe the packet size at the current position
+  void DetectPacketSize();
+
+  // reposition the input at byte <bi>, dropping any buffered data
+  int Seek(int64_t bi);
+
+  // skip the non-parseable bytes at the cursor, if any
+  int SkipToSync();
+
+  // move the cursor <size> bytes (<count> packets) forward
+  void Advance(int size, int count);
+
+  // detect a compressed input (before the first read), and start
+  // decompressing it
+  void ProbeCompression();
+
+  // read (up to) <len> bytes from the input
+  ssize_t ReadInput(uint8_t *buf, int len);
+
   FILE *fin_;
   int debug_;
+  // file offset of the first byte of the input (-1 if the input is not
+  // seekable), and its byte index
+  int64_t start_offset_;
+  int64_t input_bi_;
   int sync_gap_;
+  // packet size (0 until detected), and offset of the sync byte in it
+  int packet_size_;
+  int sync_offset_;
   int64_t bi_;
   int64_t pi_;
-  uint8_t *buffer_;
-  int blen_;
+  // whether pi_ is exact (see PacketIndexExact()), and packet index
+  // (and exactness) at the start of the current input
+  bool pi_exact_;
+  int64_t input_pi_;
+  bool input_pi_exact_;
+  // current window (blen_ bytes starting at data_)
+  const uint8_t *data_;
+  int64_t blen_;
+  bool eof_;
+  // stream mode
+  int fd_;
+  RingBuffer ring_;
+  // mmap mode
+  uint8_t *map_;
+  int64_t map_size_;
+  // requested and current (after fallbacks) input mode
+  ReaderMode input_mode_;
+  ReaderMode mode_;
+  // async modes (must be destroyed before the ring)
+  AsyncReader async_;
+  // prefetch mode (must be destroyed before the ring)
+  PrefetchReader prefetch_;
+  // direct mode
+  bool direct_started_;
+  int direct_fd_;
+  // file offset of ring position 0
+  int64_t file_base_;
+  // bytes to skip at the start of the first (aligned) read
+  int direct_skip_;
+  // end of the range already dropped from the page cache
+  int64_t dropped_;
+  // follow mode
+  bool follow_;
+  int inotify_fd_;
+  // compressed inputs
+  Decompressor decompressor_;
+  bool probed_;
+  // first input error (see Error())
+  std::string error_;
 };
 
 #endif  // MPEG2TS_READER_H_
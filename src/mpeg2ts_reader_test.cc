@@ -0,0 +1,619 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_reader.h"
+
+#include <gtest/gtest.h>
+#include <inttypes.h>  // for PRId64
+#include <stdio.h>   // for tmpfile, fmemopen
+#include <stdlib.h>  // for rand
+#include <string.h>  // for memset
+#include <unistd.h>  // for pipe
+#include <zlib.h>    // for deflate
+
+#include <fcntl.h>  // for open
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "mpeg2ts_sync.h"
+
+struct ChunkInfo {
+  int len;
+  int64_t pi;
+  int64_t bi;
+  bool operator==(const ChunkInfo &other) const {
+    return len == other.len && pi == other.pi && bi == other.bi;
+  }
+};
+
+class Mpeg2TsReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // 10 packets, then 50 bytes of garbage, then 10 packets, then a
+    // short trailer
+    AddPackets(10);
+    for (int i = 0; i < 50; ++i) {
+      stream_.push_back(0x11);
+    }
+    AddPackets(10);
+    for (int i = 0; i < 7; ++i) {
+      stream_.push_back(0x22);
+    }
+  }
+
+  void AddPackets(int num) {
+    for (int i = 0; i < num; ++i) {
+      stream_.push_back(MPEG_TS_PACKET_SYNC);
+      for (int j = 1; j < MPEG_TS_PACKET_SIZE; ++j) {
+        stream_.push_back(j & 0x3f);
+      }
+    }
+  }
+
+  // read the full stream, and check the chunks point to the right data
+  std::vector<ChunkInfo> ReadAll(FILE *fin, ReaderMode mode,
+                                 bool expect_mapped) {
+    std::vector<ChunkInfo> chunks;
+    Mpeg2TsReader reader(fin, 0, mode);
+    EXPECT_EQ(expect_mapped, reader.IsMapped());
+    Mpeg2TsChunk chunk;
+    while (reader.GetChunk(&chunk) > 0) {
+      EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+      chunks.push_back({chunk.len, chunk.pi, chunk.bi});
+      reader.Next(chunk.len);
+    }
+    return chunks;
+  }
+
+  FILE *OpenFile() {
+    FILE *fin = tmpfile();
+    fwrite(stream_.data(), 1, stream_.size(), fin);
+    rewind(fin);
+    return fin;
+  }
+
+  // gzip-compress the stream
+  std::vector<uint8_t> GzipStream() {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 + 16: gzip header
+    EXPECT_EQ(Z_OK, deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                 15 + 16, 8, Z_DEFAULT_STRATEGY));
+    std::vector<uint8_t> out(deflateBound(&zs, stream_.size()));
+    zs.next_in = stream_.data();
+    zs.avail_in = stream_.size();
+    zs.next_out = out.data();
+    zs.avail_out = out.size();
+    EXPECT_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+    deflateEnd(&zs);
+    out.resize(zs.total_out);
+    return out;
+  }
+
+  FILE *OpenFile(const std::vector<uint8_t> &data) {
+    FILE *fin = tmpfile();
+    fwrite(data.data(), 1, data.size(), fin);
+    rewind(fin);
+    return fin;
+  }
+
+  // gzip-compress the stream into a temporary file
+  FILE *OpenGzipFile() { return OpenFile(GzipStream()); }
+
+  std::vector<uint8_t> stream_;
+};
+
+TEST_F(Mpeg2TsReaderTest, StreamResync) {
+  FILE *fin = fmemopen(stream_.data(), stream_.size(), "r");
+  std::vector<ChunkInfo> chunks = ReadAll(fin, READER_MODE_AUTO, false);
+  fclose(fin);
+
+  std::vector<ChunkInfo> expected;
+  for (int i = 0; i < 10; ++i) {
+    expected.push_back({MPEG_TS_PACKET_SIZE, i, i * MPEG_TS_PACKET_SIZE});
+  }
+  expected.push_back({50, 10, 10 * MPEG_TS_PACKET_SIZE});
+  for (int i = 0; i < 10; ++i) {
+    expected.push_back(
+        {MPEG_TS_PACKET_SIZE, 11 + i, 50 + (10 + i) * MPEG_TS_PACKET_SIZE});
+  }
+  expected.push_back({7, 21, 50 + 20 * MPEG_TS_PACKET_SIZE});
+  EXPECT_EQ(expected, chunks);
+}
+
+TEST_F(Mpeg2TsReaderTest, MmapMatchesStream) {
+  FILE *fin = OpenFile();
+  std::vector<ChunkInfo> stream_chunks =
+      ReadAll(fin, READER_MODE_STREAM, false);
+  rewind(fin);
+  std::vector<ChunkInfo> mmap_chunks = ReadAll(fin, READER_MODE_AUTO, true);
+  fclose(fin);
+  EXPECT_EQ(stream_chunks, mmap_chunks);
+  EXPECT_EQ(22u, mmap_chunks.size());
+}
+
+TEST_F(Mpeg2TsReaderTest, PipeMatchesStream) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ((ssize_t)stream_.size(),
+            write(fds[1], stream_.data(), stream_.size()));
+  close(fds[1]);
+  FILE *fin = fdopen(fds[0], "r");
+  std::vector<ChunkInfo> pipe_chunks = ReadAll(fin, READER_MODE_AUTO, false);
+  fclose(fin);
+
+  fin = OpenFile();
+  std::vector<ChunkInfo> mmap_chunks = ReadAll(fin, READER_MODE_AUTO, true);
+  fclose(fin);
+  EXPECT_EQ(mmap_chunks, pipe_chunks);
+}
+
+TEST_F(Mpeg2TsReaderTest, AsyncMatchesStream) {
+  // make the stream larger than the ring, so blocks get recycled
+  AddPackets(30000);
+  for (ReaderMode mode : {READER_MODE_ASYNC, READER_MODE_ASYNC_THREADS}) {
+    FILE *fin = OpenFile();
+    std::vector<ChunkInfo> stream_chunks =
+        ReadAll(fin, READER_MODE_STREAM, false);
+    rewind(fin);
+    std::vector<ChunkInfo> async_chunks = ReadAll(fin, mode, false);
+    fclose(fin);
+    EXPECT_EQ(stream_chunks, async_chunks) << "mode " << mode;
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, PrefetchMatchesStream) {
+  // make the stream larger than the ring, so blocks get recycled
+  AddPackets(30000);
+  FILE *fin = OpenFile();
+  std::vector<ChunkInfo> stream_chunks =
+      ReadAll(fin, READER_MODE_STREAM, false);
+  rewind(fin);
+  std::vector<ChunkInfo> prefetch_chunks =
+      ReadAll(fin, READER_MODE_PREFETCH, false);
+  fclose(fin);
+  EXPECT_EQ(stream_chunks, prefetch_chunks);
+
+  // pipes are read ahead too (in short reads)
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  std::thread writer([&]() {
+    for (size_t i = 0; i < stream_.size(); i += 1000) {
+      size_t len = std::min((size_t)1000, stream_.size() - i);
+      ASSERT_EQ((ssize_t)len, write(fds[1], stream_.data() + i, len));
+    }
+    close(fds[1]);
+  });
+  fin = fdopen(fds[0], "r");
+  std::vector<ChunkInfo> pipe_chunks =
+      ReadAll(fin, READER_MODE_PREFETCH, false);
+  writer.join();
+  fclose(fin);
+  EXPECT_EQ(stream_chunks, pipe_chunks);
+}
+
+TEST_F(Mpeg2TsReaderTest, DirectMatchesStream) {
+  AddPackets(30000);
+  FILE *fin = OpenFile();
+  std::vector<ChunkInfo> stream_chunks =
+      ReadAll(fin, READER_MODE_STREAM, false);
+  rewind(fin);
+  std::vector<ChunkInfo> direct_chunks =
+      ReadAll(fin, READER_MODE_DIRECT, false);
+  EXPECT_EQ(stream_chunks, direct_chunks);
+
+  // start at an unaligned offset
+  ASSERT_EQ(0, fseek(fin, 1000, SEEK_SET));
+  Mpeg2TsReader reader(fin, 0, READER_MODE_DIRECT);
+  Mpeg2TsChunk chunk;
+  ASSERT_LT(0, reader.GetChunk(&chunk));
+  EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + 1000, chunk.len));
+  fclose(fin);
+}
+
+TEST_F(Mpeg2TsReaderTest, GetPacketsMatchesGetChunk) {
+  for (ReaderMode mode : {READER_MODE_STREAM, READER_MODE_MMAP}) {
+    FILE *fin = OpenFile();
+    std::vector<ChunkInfo> chunks = ReadAll(fin, READER_MODE_STREAM, false);
+    rewind(fin);
+
+    // expand the runs into per-packet chunks
+    std::vector<ChunkInfo> batch_chunks;
+    std::vector<int> counts;
+    Mpeg2TsReader reader(fin, 0, mode);
+    Mpeg2TsChunk chunk;
+    while (reader.GetPackets(4, &chunk) > 0) {
+      counts.push_back(chunk.count);
+      if (!chunk.synced) {
+        EXPECT_EQ(1, chunk.count);
+        batch_chunks.push_back({chunk.len, chunk.pi, chunk.bi});
+      }
+      for (int i = 0; chunk.synced && i < chunk.count; ++i) {
+        const uint8_t *buf = chunk.buf + i * MPEG_TS_PACKET_SIZE;
+        EXPECT_EQ(MPEG_TS_PACKET_SYNC, buf[0]);
+        batch_chunks.push_back({MPEG_TS_PACKET_SIZE, chunk.pi + i,
+                                chunk.bi + i * MPEG_TS_PACKET_SIZE});
+      }
+      reader.Next(chunk);
+    }
+    fclose(fin);
+    EXPECT_EQ(chunks, batch_chunks) << "mode " << mode;
+    // 10 packets, garbage, 10 packets, trailer
+    std::vector<int> expected_counts = {4, 4, 2, 1, 4, 4, 2, 1};
+    EXPECT_EQ(expected_counts, counts) << "mode " << mode;
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, Seek) {
+  for (ReaderMode mode : {READER_MODE_STREAM, READER_MODE_MMAP}) {
+    FILE *fin = OpenFile();
+    Mpeg2TsReader reader(fin, 0, mode);
+    EXPECT_EQ((int64_t)stream_.size(), reader.InputSize());
+    Mpeg2TsChunk chunk;
+    // land in the middle of packet 4: resync at packet 5
+    ASSERT_EQ(0, reader.SeekByte(4 * MPEG_TS_PACKET_SIZE + 10));
+    ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+    EXPECT_EQ(5, chunk.pi);
+    EXPECT_EQ(5 * MPEG_TS_PACKET_SIZE, chunk.bi);
+    // seek backwards, to the garbage (a chunk of its own)
+    ASSERT_EQ(0, reader.SeekByte(10 * MPEG_TS_PACKET_SIZE));
+    ASSERT_EQ(50, reader.GetChunk(&chunk));
+    EXPECT_FALSE(chunk.synced);
+    EXPECT_EQ(10, chunk.pi);
+    reader.Next(chunk);
+    ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+    EXPECT_EQ(11, chunk.pi);
+    EXPECT_EQ(10 * MPEG_TS_PACKET_SIZE + 50, chunk.bi);
+    EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+    ASSERT_EQ(0, reader.SeekPacket(2));
+    ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+    EXPECT_EQ(2, chunk.pi);
+    EXPECT_EQ(2 * MPEG_TS_PACKET_SIZE, chunk.bi);
+    fclose(fin);
+  }
+
+  // non-seekable input: forward only
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ((ssize_t)stream_.size(),
+            write(fds[1], stream_.data(), stream_.size()));
+  close(fds[1]);
+  FILE *fin = fdopen(fds[0], "r");
+  Mpeg2TsReader reader(fin, 0);
+  EXPECT_EQ(-1, reader.InputSize());
+  Mpeg2TsChunk chunk;
+  ASSERT_EQ(0, reader.SeekPacket(3));
+  ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+  EXPECT_EQ(3, chunk.pi);
+  EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+  EXPECT_EQ(-1, reader.SeekPacket(1));
+  fclose(fin);
+}
+
+TEST_F(Mpeg2TsReaderTest, SeekMatchesFullRead) {
+  // a damaged prefix: garbage before the first packet, and a sync gap
+  // (a truncated packet) in the middle
+  std::vector<uint8_t> stream(333, 0x33);
+  stream.insert(stream.end(), stream_.begin(), stream_.end());
+  stream.insert(stream.end(), stream_.begin(), stream_.begin() + 100);
+  AddPackets(50);
+  stream.insert(stream.end(), stream_.begin(), stream_.end());
+  stream_ = stream;
+  FILE *fin = OpenFile();
+  std::vector<ChunkInfo> chunks = ReadAll(fin, READER_MODE_STREAM, false);
+  fclose(fin);
+  for (ReaderMode mode : {READER_MODE_STREAM, READER_MODE_MMAP}) {
+    fin = OpenFile();
+    Mpeg2TsReader reader(fin, 0, mode);
+    Mpeg2TsChunk chunk;
+    // every packet index lands on the chunk of the full read (in any
+    // order: backward seeks count again from the start)
+    for (int64_t pi : {50, 3, 0, 71, 12, 99, 20}) {
+      if (pi >= (int64_t)chunks.size()) {
+        continue;
+      }
+      ASSERT_EQ(0, reader.SeekPacket(pi));
+      ASSERT_LT(0, reader.GetChunk(&chunk));
+      EXPECT_EQ(chunks[pi], ChunkInfo({chunk.len, chunk.pi, chunk.bi}))
+          << "packet " << pi << " mode " << mode;
+    }
+    // every byte lands on the first chunk at (or after) it
+    for (int64_t bi = 0; bi < (int64_t)stream_.size(); bi += 97) {
+      auto iter = std::find_if(
+          chunks.begin(), chunks.end(),
+          [bi](const ChunkInfo &info) { return info.bi >= bi; });
+      ASSERT_EQ(0, reader.SeekByte(bi));
+      if (iter == chunks.end()) {
+        EXPECT_EQ(0, reader.GetChunk(&chunk));
+        continue;
+      }
+      ASSERT_LT(0, reader.GetChunk(&chunk));
+      EXPECT_EQ(*iter, ChunkInfo({chunk.len, chunk.pi, chunk.bi}))
+          << "byte " << bi << " mode " << mode;
+      EXPECT_TRUE(reader.PacketIndexExact());
+    }
+    // estimated seeks are flagged, and exact ones count again
+    ASSERT_EQ(0, reader.SeekByte(40 * MPEG_TS_PACKET_SIZE, false));
+    EXPECT_FALSE(reader.PacketIndexExact());
+    ASSERT_EQ(0, reader.SeekPacket(40));
+    EXPECT_TRUE(reader.PacketIndexExact());
+    ASSERT_LT(0, reader.GetChunk(&chunk));
+    EXPECT_EQ(chunks[40], ChunkInfo({chunk.len, chunk.pi, chunk.bi}));
+    fclose(fin);
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, Gzip) {
+  // make the stream larger than a decompressed block
+  AddPackets(10000);
+  FILE *fin = OpenFile();
+  std::vector<ChunkInfo> stream_chunks =
+      ReadAll(fin, READER_MODE_STREAM, false);
+  fclose(fin);
+  // byte indices are offsets in the decompressed stream
+  for (ReaderMode mode : {READER_MODE_AUTO, READER_MODE_ASYNC}) {
+    fin = OpenGzipFile();
+    std::vector<ChunkInfo> gzip_chunks = ReadAll(fin, mode, false);
+    fclose(fin);
+    EXPECT_EQ(stream_chunks, gzip_chunks) << "mode " << mode;
+  }
+
+  // gzip inputs are not seekable: forward only
+  fin = OpenGzipFile();
+  Mpeg2TsReader reader(fin, 0);
+  EXPECT_EQ(-1, reader.InputSize());
+  Mpeg2TsChunk chunk;
+  ASSERT_EQ(0, reader.SeekPacket(5000));
+  ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+  // (after the garbage and the trailer chunks)
+  EXPECT_EQ(5000, chunk.pi);
+  EXPECT_EQ(stream_chunks[5000].bi, chunk.bi);
+  EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+  EXPECT_EQ(-1, reader.SeekPacket(1));
+  fclose(fin);
+}
+
+TEST_F(Mpeg2TsReaderTest, GzipErrors) {
+  AddPackets(10000);
+  std::vector<uint8_t> gzip = GzipStream();
+  // a complete input has no error
+  FILE *fin = OpenFile(gzip);
+  {
+    Mpeg2TsReader reader(fin, 0);
+    Mpeg2TsChunk chunk;
+    while (reader.GetChunk(&chunk) > 0) {
+      reader.Next(chunk.len);
+    }
+    EXPECT_TRUE(reader.Error() == NULL);
+  }
+  fclose(fin);
+
+  // a truncated input returns the bytes decoded before the end, then
+  // reports where it was cut
+  std::vector<uint8_t> truncated(gzip.begin(), gzip.begin() + gzip.size() / 2);
+  // a corrupted gzip trailer (CRC-32): all the bytes are decoded, but
+  // the member does not check
+  std::vector<uint8_t> corrupted = gzip;
+  corrupted[corrupted.size() - 8] ^= 0xff;
+  for (bool truncate : {true, false}) {
+    fin = OpenFile(truncate ? truncated : corrupted);
+    Mpeg2TsReader reader(fin, 0);
+    Mpeg2TsChunk chunk;
+    int64_t end = 0;
+    while (reader.GetChunk(&chunk) > 0) {
+      EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+      end = chunk.bi + chunk.len;
+      reader.Next(chunk.len);
+    }
+    ASSERT_TRUE(reader.Error() != NULL);
+    char expected[128];
+    if (truncate) {
+      EXPECT_LT(0, end);
+      EXPECT_GT((int64_t)stream_.size(), end);
+      snprintf(expected, sizeof(expected),
+               "truncated gzip input at byte %" PRId64, end);
+    } else {
+      EXPECT_EQ((int64_t)stream_.size(), end);
+      snprintf(expected, sizeof(expected),
+               "corrupt gzip input at byte %zu", stream_.size());
+    }
+    EXPECT_STREQ(expected, reader.Error());
+    fclose(fin);
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, SetInput) {
+  std::vector<ChunkInfo> expected;
+  {
+    FILE *fin = OpenFile();
+    expected = ReadAll(fin, READER_MODE_STREAM, false);
+    fclose(fin);
+  }
+  // split the stream in the middle of the garbage
+  int split = 10 * MPEG_TS_PACKET_SIZE + 20;
+  for (ReaderMode mode : {READER_MODE_AUTO, READER_MODE_STREAM}) {
+    FILE *fin1 = tmpfile();
+    fwrite(stream_.data(), 1, split, fin1);
+    rewind(fin1);
+    FILE *fin2 = tmpfile();
+    fwrite(stream_.data() + split, 1, stream_.size() - split, fin2);
+    rewind(fin2);
+
+    std::vector<ChunkInfo> chunks;
+    Mpeg2TsReader reader(fin1, 0, mode);
+    Mpeg2TsChunk chunk;
+    for (FILE *fin : {fin1, fin2}) {
+      if (fin == fin2) {
+        ASSERT_EQ(0, reader.SetInput(fin2));
+      }
+      while (reader.GetChunk(&chunk) > 0) {
+        EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+        chunks.push_back({chunk.len, chunk.pi, chunk.bi});
+        reader.Next(chunk);
+      }
+    }
+    fclose(fin1);
+    fclose(fin2);
+    // the garbage is returned in 2 chunks (one per input)
+    ASSERT_EQ(expected.size() + 1, chunks.size()) << "mode " << mode;
+    EXPECT_EQ((ChunkInfo{20, 10, 10 * MPEG_TS_PACKET_SIZE}), chunks[10]);
+    EXPECT_EQ((ChunkInfo{30, 11, split}), chunks[11]);
+    EXPECT_EQ(expected.back().bi, chunks.back().bi);
+    EXPECT_EQ(expected.back().pi + 1, chunks.back().pi);
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, Follow) {
+  for (ReaderMode mode :
+       {READER_MODE_AUTO, READER_MODE_ASYNC, READER_MODE_PREFETCH}) {
+    FILE *fin = tmpfile();
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%i", fileno(fin));
+    int fd = open(path, O_WRONLY | O_APPEND);
+    ASSERT_LE(0, fd);
+    // 5 packets, and half of the 6th one
+    int len = 5 * MPEG_TS_PACKET_SIZE + 100;
+    ASSERT_EQ(len, write(fd, stream_.data(), len));
+
+    Mpeg2TsReader reader(fin, 0, mode);
+    ASSERT_EQ(0, reader.SetFollow(true));
+    EXPECT_FALSE(reader.IsMapped());
+    Mpeg2TsChunk chunk;
+    ASSERT_EQ(5 * MPEG_TS_PACKET_SIZE, reader.GetPackets(10, &chunk));
+    reader.Next(chunk);
+    // the file grows while the reader waits for the 6th packet
+    std::thread writer([&]() {
+      usleep(100000);
+      int rest = 10 * MPEG_TS_PACKET_SIZE - len;
+      ASSERT_EQ(rest, write(fd, stream_.data() + len, rest));
+    });
+    ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk)) << "mode " << mode;
+    EXPECT_TRUE(chunk.synced);
+    EXPECT_EQ(5, chunk.pi);
+    EXPECT_EQ(0, memcmp(chunk.buf, stream_.data() + chunk.bi, chunk.len));
+    writer.join();
+    reader.Next(chunk);
+    ASSERT_EQ(4 * MPEG_TS_PACKET_SIZE, reader.GetPackets(10, &chunk));
+    EXPECT_EQ(6, chunk.pi);
+    close(fd);
+    fclose(fin);
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, LargeSyncGap) {
+  // a long run of garbage needs a larger sync gap
+  std::vector<uint8_t> garbage(5000, 0x33);
+  stream_.insert(stream_.begin() + 3 * MPEG_TS_PACKET_SIZE, garbage.begin(),
+                 garbage.end());
+  AddPackets(40);
+  for (ReaderMode mode : {READER_MODE_STREAM, READER_MODE_MMAP}) {
+    FILE *fin = OpenFile();
+    Mpeg2TsReader reader(fin, 0, mode);
+    Mpeg2TsChunk chunk;
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_EQ(MPEG_TS_PACKET_SIZE, reader.GetChunk(&chunk));
+      reader.Next(chunk);
+    }
+    // default sync gap: punt
+    EXPECT_EQ(-1, reader.GetChunk(&chunk)) << "mode " << mode;
+    // larger sync gap: resync after the garbage
+    ASSERT_EQ(0, reader.SetSyncGap(60 * MPEG_TS_PACKET_SIZE));
+    EXPECT_EQ(5000, reader.GetChunk(&chunk)) << "mode " << mode;
+    EXPECT_EQ(3 * MPEG_TS_PACKET_SIZE, chunk.bi);
+    fclose(fin);
+  }
+}
+
+TEST_F(Mpeg2TsReaderTest, DetectPacketSize) {
+  for (int packet_size : {M2TS_PACKET_SIZE, FEC_PACKET_SIZE}) {
+    // 5 bytes of garbage, then 10 packets of <packet_size> bytes
+    std::vector<uint8_t> stream(5, 0x11);
+    int sync_offset = (packet_size == M2TS_PACKET_SIZE) ? 4 : 0;
+    for (int i = 0; i < 10; ++i) {
+      for (int j = 0; j < packet_size; ++j) {
+        stream.push_back((j == sync_offset) ? MPEG_TS_PACKET_SYNC : (j & 0x3f));
+      }
+    }
+    FILE *fin = fmemopen(stream.data(), stream.size(), "r");
+    Mpeg2TsReader reader(fin, 0);
+    Mpeg2TsChunk chunk;
+    EXPECT_EQ(5, reader.GetPackets(100, &chunk));
+    EXPECT_EQ(packet_size, reader.PacketSize());
+    reader.Next(chunk);
+    EXPECT_EQ(10 * packet_size, reader.GetPackets(100, &chunk));
+    EXPECT_EQ(10, chunk.count);
+    EXPECT_EQ(0, memcmp(chunk.buf, stream.data() + 5, chunk.len));
+    reader.Next(chunk);
+    EXPECT_EQ(0, reader.GetChunk(&chunk));
+    fclose(fin);
+  }
+}
+
+TEST(FindSyncPointTest, AllImplementationsMatch) {
+  // noisy buffer with a few 'G's, plus a real sync point
+  std::vector<uint8_t> buf(8 * MPEG_TS_PACKET_SIZE);
+  srand(1);
+  for (int test = 0; test < 200; ++test) {
+    for (auto &b : buf) {
+      b = (rand() % 8 == 0) ? MPEG_TS_PACKET_SYNC : (rand() & 0x3f);
+    }
+    int sync = rand() % (4 * MPEG_TS_PACKET_SIZE);
+    if (test % 10 != 0) {
+      for (int j = 0; j < 3; ++j) {
+        buf[sync + j * MPEG_TS_PACKET_SIZE] = MPEG_TS_PACKET_SYNC;
+      }
+    }
+    int num_offsets = buf.size() - 2 * MPEG_TS_PACKET_SIZE;
+    int expected = find_sync_point_scalar(buf.data(), num_offsets,
+                                          MPEG_TS_PACKET_SIZE, 3);
+    if (test % 10 != 0) {
+      EXPECT_LE(expected, sync);
+      EXPECT_GE(expected, 0);
+    }
+    EXPECT_EQ(expected, find_sync_point(buf.data(), num_offsets,
+                                        MPEG_TS_PACKET_SIZE, 3))
+        << find_sync_point_impl();
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2")) {
+      EXPECT_EQ(expected, find_sync_point_sse2(buf.data(), num_offsets,
+                                               MPEG_TS_PACKET_SIZE, 3));
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      EXPECT_EQ(expected, find_sync_point_avx2(buf.data(), num_offsets,
+                                               MPEG_TS_PACKET_SIZE, 3));
+    }
+#endif
+  }
+}
+
+TEST(RingBufferTest, WrapAround) {
+  RingBuffer ring;
+  ASSERT_EQ(0, ring.Init(4096));
+  int size = ring.Size();
+  // fill the ring, then consume most of it
+  memset(ring.WritePtr(), 'a', ring.Free());
+  ring.Produce(size);
+  EXPECT_EQ(0, ring.Free());
+  ring.Consume(size - 10);
+  // write across the end of the ring
+  ASSERT_EQ(size - 10, ring.Free());
+  memset(ring.WritePtr(), 'b', 100);
+  ring.Produce(100);
+  // buffered data is contiguous
+  ASSERT_EQ(110, ring.Used());
+  const uint8_t *data = ring.ReadPtr();
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ('a', data[i]) << "offset " << i;
+  }
+  for (int i = 10; i < 110; ++i) {
+    EXPECT_EQ('b', data[i]) << "offset " << i;
+  }
+  EXPECT_EQ(size - 10, ring.ReadPos());
+  EXPECT_EQ(size + 100, ring.WritePos());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "mpeg2ts_sync.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define MPEG_TS_PACKET_SYNC 0x47  // 'G'
+
+int find_sync_point_scalar(const uint8_t *buf, int num_offsets, int stride,
+                           int count) {
+  for (int i = 0; i < num_offsets; ++i) {
+    int j = 0;
+    while (j < count && buf[i + j * stride] == MPEG_TS_PACKET_SYNC) {
+      ++j;
+    }
+    if (j == count) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Compare 16 (SSE2) or 32 (AVX2) consecutive offsets at once: AND the
+// per-byte comparisons of the <count> strided windows, and look for
+// the first offset where all of them matched.
+
+__attribute__((target("sse2"))) int find_sync_point_sse2(const uint8_t *buf,
+                                                         int num_offsets,
+                                                         int stride,
+                                                         int count) {
+  const __m128i sync = _mm_set1_epi8(MPEG_TS_PACKET_SYNC);
+  int i = 0;
+  for (; i + 16 <= num_offsets; i += 16) {
+    __m128i match = _mm_set1_epi8((char)0xff);
+    for (int j = 0; j < count; ++j) {
+      __m128i window = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(buf + i + j * stride));
+      match = _mm_and_si128(match, _mm_cmpeq_epi8(window, sync));
+    }
+    int mask = _mm_movemask_epi8(match);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  // tail
+  int res = find_sync_point_scalar(buf + i, num_offsets - i, stride, count);
+  return (res < 0) ? -1 : i + res;
+}
+
+__attribute__((target("avx2"))) int find_sync_point_avx2(const uint8_t *buf,
+                                                         int num_offsets,
+                                                         int stride,
+                                                         int count) {
+  const __m256i sync = _mm256_set1_epi8(MPEG_TS_PACKET_SYNC);
+  int i = 0;
+  for (; i + 32 <= num_offsets; i += 32) {
+    __m256i match = _mm256_set1_epi8((char)0xff);
+    for (int j = 0; j < count; ++j) {
+      __m256i window = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(buf + i + j * stride));
+      match = _mm256_and_si256(match, _mm256_cmpeq_epi8(window, sync));
+    }
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(match);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  // tail
+  int res = find_sync_point_sse2(buf + i, num_offsets - i, stride, count);
+  return (res < 0) ? -1 : i + res;
+}
+
+#endif
+
+typedef int (*find_sync_point_func)(const uint8_t *buf, int num_offsets,
+                                    int stride, int count);
+
+// the implementation used by find_sync_point(), and its name
+typedef struct find_sync_point_best_t {
+  find_sync_point_func func;
+  const char *name;
+} find_sync_point_best_t;
+
+static find_sync_point_best_t select_find_sync_point() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {find_sync_point_avx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {find_sync_point_sse2, "sse2"};
+  }
+#endif
+  return {find_sync_point_scalar, "scalar"};
+}
+
+// Selected on first use (a function-local static), so callers from
+// other translation units' static initializers do not see it unset.
+static const find_sync_point_best_t &find_sync_point_best() {
+  static const find_sync_point_best_t best = select_find_sync_point();
+  return best;
+}
+
+int find_sync_point(const uint8_t *buf, int num_offsets, int stride,
+                    int count) {
+  return find_sync_point_best().func(buf, num_offsets, stride, count);
+}
+
+const char *find_sync_point_impl() { return find_sync_point_best().name; }
@@ -0,0 +1,32 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef MPEG2TS_SYNC_H_
+#define MPEG2TS_SYNC_H_
+
+#include <stdint.h>  // for uint8_t
+
+// Returns the first offset i (0 <= i < num_offsets) such that buf[i],
+// buf[i + stride], ..., buf[i + (count - 1) * stride] are all mpeg-ts
+// sync bytes (0x47), or -1 if there is none. The caller must ensure
+// that buf[num_offsets - 1 + (count - 1) * stride] can be read.
+//
+// The implementation (AVX2, SSE2, or scalar) is selected at runtime
+// depending on the CPU.
+int find_sync_point(const uint8_t *buf, int num_offsets, int stride,
+                    int count);
+
+// Returns the name of the implementation used by find_sync_point().
+const char *find_sync_point_impl();
+
+// Per-implementation versions. The SIMD ones must only be called if
+// the CPU supports them.
+int find_sync_point_scalar(const uint8_t *buf, int num_offsets, int stride,
+                           int count);
+#if defined(__x86_64__) || defined(__i386__)
+int find_sync_point_sse2(const uint8_t *buf, int num_offsets, int stride,
+                         int count);
+int find_sync_point_avx2(const uint8_t *buf, int num_offsets, int stride,
+                         int count);
+#endif
+
+#endif  // MPEG2TS_SYNC_H_
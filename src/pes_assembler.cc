@@ -0,0 +1,192 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "pes_assembler.h"
+
+#include "mpeg2ts_parser.h"
+#include "ts_payload.h"
+
+// PES packets without the optional PES header (ISO/IEC 13818-1,
+// Table 2-21)
+static bool pes_has_header(int stream_id) {
+  return stream_id != 0xbc &&  // program_stream_map
+         stream_id != 0xbe &&  // padding_stream
+         stream_id != 0xbf &&  // private_stream_2
+         stream_id != 0xf0 &&  // ECM_stream
+         stream_id != 0xf1 &&  // EMM_stream
+         stream_id != 0xf2 &&  // DSMCC_stream
+         stream_id != 0xf8 &&  // ITU-T Rec. H.222.1 type E
+         stream_id != 0xff;    // program_stream_directory
+}
+
+// Returns a PTS/DTS (5 bytes)
+static int64_t pes_timestamp(const uint8_t *buf) {
+  return ((int64_t)((buf[0] >> 1) & 0x07) << 30) | (buf[1] << 22) |
+         ((buf[2] >> 1) << 15) | (buf[3] << 7) | (buf[4] >> 1);
+}
+
+PesAssembler::PesAssembler()
+    : packet_size_(MPEG_TS_PACKET_SIZE), returned_(-1) {}
+
+int PesAssembler::SetPacketSize(int packet_size) {
+  if (!Mpeg2TsParser::IsValidPacketSize(packet_size)) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  return 0;
+}
+
+void PesAssembler::Reset() {
+  pids_.clear();
+  free_.clear();
+  for (int i = 0; i < (int)buffers_.size(); ++i) {
+    free_.push_back(i);
+  }
+  returned_ = -1;
+}
+
+int PesAssembler::GetBuffer() {
+  if (free_.empty()) {
+    buffers_.emplace_back();
+    return buffers_.size() - 1;
+  }
+  int buffer = free_.back();
+  free_.pop_back();
+  // keep the capacity
+  buffers_[buffer].clear();
+  return buffer;
+}
+
+void PesAssembler::ReleaseBuffer(int buffer) { free_.push_back(buffer); }
+
+bool PesAssembler::Full(int buffer) const {
+  const std::vector<uint8_t> &pes = buffers_[buffer];
+  if (pes.size() < 6) {
+    return false;
+  }
+  int pes_packet_length = (pes[4] << 8) | pes[5];
+  // 0 means unbounded (video only)
+  return pes_packet_length != 0 && (int)pes.size() >= 6 + pes_packet_length;
+}
+
+int PesAssembler::Push(int64_t pi, int64_t bi, const uint8_t *buf, int len,
+                       PesUnit *unit) {
+  TsPayload ts;
+  int res = ts.Parse(packet_size_, buf, len);
+  if (res <= 0) {
+    return res;
+  }
+  int pid = ts.Pid();
+  auto iter = pids_.find(pid);
+  if (iter == pids_.end()) {
+    pid_state_t state = {-1, 0, 0, -1};
+    iter = pids_.emplace(pid, state).first;
+  }
+  pid_state_t *state = &iter->second;
+  TsPayload::Continuity continuity =
+      ts.CheckContinuity(&state->continuity_counter);
+  if (continuity == TsPayload::CONTINUITY_DUPLICATE) {
+    return 0;
+  }
+  if ((continuity == TsPayload::CONTINUITY_GAP || ts.Len() < 0) &&
+      state->buffer >= 0) {
+    ReleaseBuffer(state->buffer);
+    state->buffer = -1;
+  }
+  if (ts.Len() < 0) {
+    return 0;
+  }
+  res = 0;
+  if (state->buffer >= 0 &&
+      (ts.PayloadUnitStartIndicator() || Full(state->buffer))) {
+    // a new PES packet starts, or the rest of the packet is stuffing
+    res = Complete(pid, state, unit);
+  }
+  if (ts.PayloadUnitStartIndicator()) {
+    state->buffer = GetBuffer();
+    state->pi = pi;
+    state->bi = bi;
+  }
+  if (state->buffer < 0) {
+    // not in a PES packet
+    return res;
+  }
+  std::vector<uint8_t> &pes = buffers_[state->buffer];
+  pes.insert(pes.end(), ts.Data(), ts.Data() + ts.Len());
+  if (res == 0 && Full(state->buffer)) {
+    // (otherwise, it is returned with the next packet of its PID)
+    res = Complete(pid, state, unit);
+  }
+  return res;
+}
+
+int PesAssembler::Flush(PesUnit *unit) {
+  for (auto &iter : pids_) {
+    if (iter.second.buffer >= 0 && Complete(iter.first, &iter.second, unit)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int PesAssembler::Complete(int pid, pid_state_t *state, PesUnit *unit) {
+  int buffer = state->buffer;
+  state->buffer = -1;
+  // the previous unit is not used anymore
+  if (returned_ >= 0) {
+    ReleaseBuffer(returned_);
+    returned_ = -1;
+  }
+  const std::vector<uint8_t> &pes = buffers_[buffer];
+  int len = pes.size();
+  // packet_start_code_prefix, stream_id, and PES_packet_length
+  if (len < 6 || pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01) {
+    ReleaseBuffer(buffer);
+    return 0;
+  }
+  int stream_id = pes[3];
+  int pes_packet_length = (pes[4] << 8) | pes[5];
+  if (pes_packet_length != 0) {
+    if (len < 6 + pes_packet_length) {
+      // cut short
+      ReleaseBuffer(buffer);
+      return 0;
+    }
+    // drop the stuffing after it
+    len = 6 + pes_packet_length;
+  }
+  int64_t pts = -1;
+  int64_t dts = -1;
+  int data_offset = 6;
+  if (pes_has_header(stream_id)) {
+    if (len < 9) {
+      ReleaseBuffer(buffer);
+      return 0;
+    }
+    int pts_dts_flags = (pes[7] & 0xc0) >> 6;
+    data_offset = 9 + pes[8];
+    if (data_offset > len ||
+        (pts_dts_flags >= 2 && data_offset < 14) ||
+        (pts_dts_flags == 3 && data_offset < 19)) {
+      ReleaseBuffer(buffer);
+      return 0;
+    }
+    if (pts_dts_flags >= 2) {
+      pts = pes_timestamp(pes.data() + 9);
+    }
+    if (pts_dts_flags == 3) {
+      dts = pes_timestamp(pes.data() + 14);
+    }
+  }
+  unit->pid = pid;
+  unit->pi = state->pi;
+  unit->bi = state->bi;
+  unit->stream_id = stream_id;
+  unit->pts = pts;
+  unit->dts = dts;
+  unit->buf = pes.data();
+  unit->len = len;
+  unit->data = pes.data() + data_offset;
+  unit->data_len = len - data_offset;
+  returned_ = buffer;
+  return 1;
+}
@@ -0,0 +1,95 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef PES_ASSEMBLER_H_
+#define PES_ASSEMBLER_H_
+
+#include <stdint.h>  // for uint8_t, int64_t
+
+#include <map>
+#include <vector>
+
+// a complete PES packet (see PesAssembler)
+struct PesUnit {
+  int pid;
+  // packet/byte index of the packet where it starts
+  int64_t pi;
+  int64_t bi;
+  int stream_id;
+  // PTS and DTS (-1 if none)
+  int64_t pts;
+  int64_t dts;
+  // the PES packet (header and data bytes), and its data bytes
+  const uint8_t *buf;
+  int len;
+  const uint8_t *data;
+  int data_len;
+};
+
+// A per-PID PES packet assembler.
+//
+// The parser (and the view) describe one mpeg-ts packet at a time, so a
+// codec analyzer looking at the data bytes of a packet misses anything
+// that straddles packets (e.g. split start codes), and analyzing every
+// packet of a PES packet scans it piecewise. The assembler accumulates
+// the payload of each PID, from one payload_unit_start_indicator to the
+// next (or up to the PES_packet_length, if set), and returns each PES
+// packet once it is complete, so it can be analyzed once, as a whole.
+//
+// A PES packet in progress is dropped on a continuity counter gap, and
+// when it ends short of its PES_packet_length. The PES packets are
+// accumulated in buffers taken from a pool, and returned to it once the
+// unit has been used, so the steady state does not allocate.
+class PesAssembler {
+ public:
+  PesAssembler();
+
+  // Set the size of the packets passed to Push() (188, 192, or 204)
+  int SetPacketSize(int packet_size);
+
+  // Feed a (synced) packet of <len> bytes, with packet/byte index
+  // <pi>/<bi>. Returns 1 if the packet completes a PES packet (of its
+  // PID), which is then described in <unit> (valid until the next call),
+  // 0 otherwise, and -1 if the packet is not a valid mpeg-ts packet.
+  int Push(int64_t pi, int64_t bi, const uint8_t *buf, int len,
+           PesUnit *unit);
+
+  // Returns the PES packets still in progress at the end of the stream,
+  // one per call (see Push()): 1 if <unit> was set, 0 if there are no
+  // more.
+  int Flush(PesUnit *unit);
+
+  // Forget the PES packets in progress (e.g. after a seek)
+  void Reset();
+
+ private:
+  // the PES packet in progress of a PID
+  typedef struct pid_state_t {
+    // buffer index (-1 if none)
+    int buffer;
+    int64_t pi;
+    int64_t bi;
+    // last continuity counter (-1 if none)
+    int continuity_counter;
+  } pid_state_t;
+
+  // Returns the index of an empty buffer from the pool
+  int GetBuffer();
+  void ReleaseBuffer(int buffer);
+
+  // Returns whether the buffer holds its whole PES_packet_length
+  bool Full(int buffer) const;
+
+  // End the PES packet in progress of <pid>. Returns 1 if it is a valid
+  // PES packet (described in <unit>), 0 otherwise.
+  int Complete(int pid, pid_state_t *state, PesUnit *unit);
+
+  int packet_size_;
+  std::map<int, pid_state_t> pids_;
+  // buffer pool (indices, so the assembler can be copied), free
+  // buffers, and buffer of the last unit returned (-1 if none)
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::vector<int> free_;
+  int returned_;
+};
+
+#endif  // PES_ASSEMBLER_H_
@@ -0,0 +1,155 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "pes_assembler.h"
+
+#include <gtest/gtest.h>
+#include <string.h>  // for memcmp
+
+#include <set>
+#include <vector>
+
+#include "mpeg2ts_parser.h"
+#include "ts_test_utils.h"
+
+class PesAssemblerTest : public ::testing::Test {
+ protected:
+  // a PES packet (stream_id 0xe0) with a PTS, and <data_len> data bytes
+  // (0, 1, 2, ...). A bounded one has its PES_packet_length set.
+  std::vector<uint8_t> MakePes(int64_t pts, int data_len, bool bounded) {
+    int pes_packet_length = bounded ? (3 + 5 + data_len) : 0;
+    std::vector<uint8_t> pes = {
+        0x00, 0x00, 0x01, 0xe0, (uint8_t)(pes_packet_length >> 8),
+        (uint8_t)(pes_packet_length & 0xff), 0x80, 0x80, 0x05,
+        (uint8_t)(0x21 | ((pts >> 29) & 0x0e)), (uint8_t)(pts >> 22),
+        (uint8_t)(((pts >> 14) & 0xfe) | 0x01), (uint8_t)(pts >> 7),
+        (uint8_t)(((pts << 1) & 0xfe) | 0x01),
+    };
+    for (int i = 0; i < data_len; ++i) {
+      pes.push_back(i & 0xff);
+    }
+    return pes;
+  }
+
+  PesAssembler pes_assembler_;
+};
+
+TEST_F(PesAssemblerTest, UnboundedPes) {
+  // video PES packets end at the next payload_unit_start_indicator
+  std::vector<uint8_t> pes = MakePes(900000, 1000, false);
+  auto packets = Packetize(PACKETIZE_PES, 0x101, pes, 0);
+  ASSERT_EQ(6, packets.size());
+  PesUnit unit;
+  for (int i = 0; i < (int)packets.size(); ++i) {
+    EXPECT_EQ(0, pes_assembler_.Push(i, i * MPEG_TS_PACKET_SIZE,
+                                     packets[i].data(), packets[i].size(),
+                                     &unit));
+  }
+  auto next = Packetize(PACKETIZE_PES, 0x101, MakePes(903003, 10, false), 6);
+  EXPECT_EQ(1, pes_assembler_.Push(6, 6 * MPEG_TS_PACKET_SIZE,
+                                   next[0].data(), next[0].size(), &unit));
+  EXPECT_EQ(0x101, unit.pid);
+  EXPECT_EQ(0, unit.pi);
+  EXPECT_EQ(0, unit.bi);
+  EXPECT_EQ(0xe0, unit.stream_id);
+  EXPECT_EQ(900000, unit.pts);
+  EXPECT_EQ(-1, unit.dts);
+  ASSERT_EQ((int)pes.size(), unit.len);
+  EXPECT_EQ(0, memcmp(pes.data(), unit.buf, unit.len));
+  ASSERT_EQ(1000, unit.data_len);
+  EXPECT_EQ(999 & 0xff, unit.data[999]);
+
+  // the last one is returned at the end of the stream
+  EXPECT_EQ(1, pes_assembler_.Flush(&unit));
+  EXPECT_EQ(6, unit.pi);
+  EXPECT_EQ(903003, unit.pts);
+  EXPECT_EQ(10, unit.data_len);
+  EXPECT_EQ(0, pes_assembler_.Flush(&unit));
+}
+
+TEST_F(PesAssemblerTest, BoundedPes) {
+  // audio PES packets end at their PES_packet_length
+  std::vector<uint8_t> pes = MakePes(1234, 400, true);
+  auto packets = Packetize(PACKETIZE_PES, 0x102, pes, 3);
+  ASSERT_EQ(3, packets.size());
+  PesUnit unit;
+  EXPECT_EQ(0, pes_assembler_.Push(0, 0, packets[0].data(),
+                                   packets[0].size(), &unit));
+  EXPECT_EQ(0, pes_assembler_.Push(1, 188, packets[1].data(),
+                                   packets[1].size(), &unit));
+  EXPECT_EQ(1, pes_assembler_.Push(2, 376, packets[2].data(),
+                                   packets[2].size(), &unit));
+  EXPECT_EQ(1234, unit.pts);
+  EXPECT_EQ(400, unit.data_len);
+  EXPECT_EQ(0, pes_assembler_.Flush(&unit));
+
+  // a PES packet cut short is dropped
+  packets = Packetize(PACKETIZE_PES, 0x102, pes, 6);
+  EXPECT_EQ(0, pes_assembler_.Push(3, 0, packets[0].data(),
+                                   packets[0].size(), &unit));
+  EXPECT_EQ(0, pes_assembler_.Push(4, 0, packets[1].data(),
+                                   packets[1].size(), &unit));
+  EXPECT_EQ(0, pes_assembler_.Flush(&unit));
+}
+
+TEST_F(PesAssemblerTest, ContinuityGap) {
+  auto packets = Packetize(PACKETIZE_PES, 0x101, MakePes(0, 500, false), 0);
+  auto next =
+      Packetize(PACKETIZE_PES, 0x101, MakePes(0, 10, false), packets.size());
+  PesUnit unit;
+  for (int i = 0; i < (int)packets.size(); ++i) {
+    if (i == 1) {
+      // lost packet
+      continue;
+    }
+    EXPECT_EQ(0, pes_assembler_.Push(i, 0, packets[i].data(),
+                                     packets[i].size(), &unit));
+  }
+  EXPECT_EQ(0, pes_assembler_.Push(9, 0, next[0].data(), next[0].size(),
+                                   &unit));
+  EXPECT_EQ(1, pes_assembler_.Flush(&unit));
+  EXPECT_EQ(9, unit.pi);
+}
+
+TEST_F(PesAssemblerTest, PooledBuffers) {
+  // two interleaved PIDs: once warm, the same few buffers are reused
+  PesUnit unit;
+  int cc = 0;
+  int units = 0;
+  std::set<const uint8_t *> bufs;
+  for (int i = 0; i < 20; ++i) {
+    for (int pid = 0x101; pid <= 0x102; ++pid) {
+      auto packets = Packetize(PACKETIZE_PES, pid, MakePes(i, 300, false), cc);
+      for (auto &packet : packets) {
+        if (pes_assembler_.Push(i, 0, packet.data(), packet.size(), &unit)) {
+          units += 1;
+          EXPECT_EQ(i - 1, unit.pts);
+          EXPECT_EQ(pid, unit.pid);
+          if (i >= 2) {
+            bufs.insert(unit.buf);
+          }
+        }
+      }
+    }
+    cc += 2;
+  }
+  EXPECT_EQ(2 * 19, units);
+  // one in progress per PID, plus the one returned
+  EXPECT_GE(3, bufs.size());
+  EXPECT_EQ(1, pes_assembler_.Flush(&unit));
+  EXPECT_EQ(1, pes_assembler_.Flush(&unit));
+  EXPECT_EQ(0, pes_assembler_.Flush(&unit));
+}
+
+TEST_F(PesAssemblerTest, TruncatedPacket) {
+  auto packets = Packetize(PACKETIZE_PES, 0x101, MakePes(0, 500, false), 0);
+  PesUnit unit;
+  EXPECT_EQ(0, pes_assembler_.Push(0, 0, packets[0].data(), packets[0].size(),
+                                   &unit));
+  // a header with an adaptation field, and no room for its length: the
+  // PES packet in progress is lost
+  const uint8_t truncated[] = {MPEG_TS_PACKET_SYNC, 0x01, 0x01, 0x31};
+  EXPECT_EQ(0, pes_assembler_.Push(1, 0, truncated, sizeof(truncated), &unit));
+  EXPECT_EQ(0, pes_assembler_.Flush(&unit));
+  // too short for a header
+  EXPECT_EQ(-1, pes_assembler_.Push(2, 0, truncated, 3, &unit));
+}
@@ -0,0 +1,187 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "pid_filter.h"
+
+#include <stdlib.h>  // for strtol
+#include <string.h>  // for strncmp
+
+#include "mpeg2ts_parser.h"
+
+#define PROGRAM_PREFIX "program:"
+#define PROGRAM_NUMBER_MAX 0xffff
+// PCR_PID value of programs with no PCR
+#define PID_NULL 0x1fff
+
+PidFilter::PidFilter()
+    : packet_size_(MPEG_TS_PACKET_SIZE) {
+  pass_.set();
+}
+
+int PidFilter::SetPacketSize(int packet_size) {
+  if (!Mpeg2TsParser::IsValidPacketSize(packet_size)) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  return psi_assembler_.SetPacketSize(packet_size);
+}
+
+int PidFilter::AddSpec(const char *spec) {
+  const char *item = spec;
+  while (true) {
+    bool exclude = (*item == '-');
+    if (exclude) {
+      item += 1;
+    }
+    bool program = (strncmp(item, PROGRAM_PREFIX, strlen(PROGRAM_PREFIX)) == 0);
+    if (program) {
+      item += strlen(PROGRAM_PREFIX);
+    }
+    char *endptr;
+    long value = strtol(item, &endptr, 0);
+    if (endptr == item || value < 0 ||
+        value > (program ? PROGRAM_NUMBER_MAX : PID_FILTER_NUM_PIDS - 1) ||
+        (*endptr != ',' && *endptr != '\0')) {
+      return -1;
+    }
+    if (program && exclude) {
+      ExcludeProgram(value);
+    } else if (program) {
+      IncludeProgram(value);
+    } else if (exclude) {
+      ExcludePid(value);
+    } else {
+      IncludePid(value);
+    }
+    if (*endptr == '\0') {
+      return 0;
+    }
+    item = endptr + 1;
+  }
+}
+
+void PidFilter::IncludePid(int pid) {
+  include_pids_.insert(pid);
+  Rebuild();
+}
+
+void PidFilter::ExcludePid(int pid) {
+  exclude_pids_.insert(pid);
+  Rebuild();
+}
+
+void PidFilter::IncludeProgram(int program_number) {
+  include_programs_.insert(program_number);
+  Rebuild();
+}
+
+void PidFilter::ExcludeProgram(int program_number) {
+  exclude_programs_.insert(program_number);
+  Rebuild();
+}
+
+bool PidFilter::Empty() const {
+  return include_pids_.empty() && exclude_pids_.empty() && !HasPrograms();
+}
+
+bool PidFilter::HasPrograms() const {
+  return !include_programs_.empty() || !exclude_programs_.empty();
+}
+
+int PidFilter::PacketPid(const uint8_t *buf, int len) const {
+  int sync_offset = Mpeg2TsParser::SyncOffset(packet_size_);
+  if (len < sync_offset + 4 || buf[sync_offset] != MPEG_TS_PACKET_SYNC) {
+    return -1;
+  }
+  return ((buf[sync_offset + 1] & 0x1f) << 8) | buf[sync_offset + 2];
+}
+
+bool PidFilter::Select(const uint8_t *buf, int len) {
+  int pid = PacketPid(buf, len);
+  if (pid < 0) {
+    // no PID (e.g. garbage between packets)
+    return Empty();
+  }
+  if (track_[pid]) {
+    PsiPacket psi_packet;
+    if (psi_assembler_.Push(buf, len, &psi_packet) > 0) {
+      Update(psi_packet);
+    }
+  }
+  return pass_[pid];
+}
+
+void PidFilter::Update(const PsiPacket &psi_packet) {
+  bool changed = false;
+  for (auto &pas : psi_packet.program_association_section()) {
+    for (auto &program_information : pas.program_information()) {
+      int program_number = program_information.program_number();
+      if (program_number == 0) {
+        // network PID
+        continue;
+      }
+      int pmt_pid = program_information.program_map_pid();
+      auto iter = pmt_pids_.find(program_number);
+      if (iter == pmt_pids_.end() || iter->second != pmt_pid) {
+        pmt_pids_[program_number] = pmt_pid;
+        changed = true;
+      }
+    }
+  }
+  for (auto &pms : psi_packet.program_map_section()) {
+    std::set<int> pids;
+    if (pms.pcr_pid() != PID_NULL) {
+      pids.insert(pms.pcr_pid());
+    }
+    for (auto &stream_description : pms.stream_description()) {
+      pids.insert(stream_description.elementary_pid());
+    }
+    std::set<int> &program_pids = program_pids_[pms.program_number()];
+    if (program_pids != pids) {
+      program_pids = pids;
+      changed = true;
+    }
+  }
+  if (changed) {
+    Rebuild();
+  }
+}
+
+void PidFilter::Rebuild() {
+  std::set<int> included = include_pids_;
+  std::set<int> excluded = exclude_pids_;
+  track_.reset();
+  if (HasPrograms()) {
+    track_[MPEG_TS_PID_PAT] = true;
+  }
+  // expand the programs into their PIDs
+  for (int list = 0; list < 2; ++list) {
+    const std::set<int> &programs =
+        (list == 0) ? include_programs_ : exclude_programs_;
+    std::set<int> &pids = (list == 0) ? included : excluded;
+    for (int program_number : programs) {
+      auto pmt_iter = pmt_pids_.find(program_number);
+      if (pmt_iter == pmt_pids_.end()) {
+        continue;
+      }
+      pids.insert(pmt_iter->second);
+      track_[pmt_iter->second] = true;
+      auto pids_iter = program_pids_.find(program_number);
+      if (pids_iter != program_pids_.end()) {
+        pids.insert(pids_iter->second.begin(), pids_iter->second.end());
+      }
+    }
+  }
+  // with no includes, everything passes
+  bool include_all = include_pids_.empty() && include_programs_.empty();
+  if (include_all) {
+    pass_.set();
+  } else {
+    pass_.reset();
+  }
+  for (int pid : included) {
+    pass_[pid] = true;
+  }
+  for (int pid : excluded) {
+    pass_[pid] = false;
+  }
+}
@@ -0,0 +1,90 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef PID_FILTER_H_
+#define PID_FILTER_H_
+
+#include <stdint.h>  // for uint8_t
+
+#include <bitset>
+#include <map>
+#include <set>
+
+#include "mpeg2ts.pb.h"
+#include "psi_assembler.h"
+
+#define PID_FILTER_NUM_PIDS (1 << 13)
+
+// A PID filter, checked on the raw packet bytes (before parsing).
+//
+// The filter has lists of included and excluded PIDs and programs. A
+// packet passes if its PID is included (or nothing is included), and
+// is not excluded. Programs (by program number) stand for their PMT
+// PID (from the PAT), and the PCR and elementary PIDs in their PMT:
+// Select() follows the PAT and the PMTs of the programs in the lists
+// (reassembling the sections that span several packets), so the
+// program PIDs are only known once their tables have been seen.
+//
+// The filter decision is a table lookup, rebuilt only when the lists or
+// the program tables change.
+class PidFilter {
+ public:
+  PidFilter();
+
+  // Set the size of the packets passed to Select(), and to the PSI
+  // assembler behind the program lists
+  int SetPacketSize(int packet_size);
+
+  // Add a filter spec: a comma-separated list of PIDs (e.g. "0x100"),
+  // and programs ("program:<program_number>"). Items starting with '-'
+  // are excluded. Returns 0 if successful, -1 otherwise.
+  int AddSpec(const char *spec);
+
+  void IncludePid(int pid);
+  void ExcludePid(int pid);
+  void IncludeProgram(int program_number);
+  void ExcludeProgram(int program_number);
+
+  // Returns whether the filter lets every packet pass
+  bool Empty() const;
+
+  // Returns whether the filter follows the PAT and PMTs (i.e. it uses
+  // programs), and therefore depends on the packets seen before
+  bool HasPrograms() const;
+
+  // Returns whether a (synced) packet of <len> bytes passes the filter.
+  // PAT and PMT packets of the programs in the lists are parsed to
+  // update the program PIDs, whether they pass or not.
+  bool Select(const uint8_t *buf, int len);
+
+  // Returns whether packets of PID <pid> pass the filter (with the
+  // program PIDs known so far)
+  bool Matches(int pid) const { return pass_[pid]; }
+
+  // Returns the PID of a (synced) packet of <len> bytes, read straight
+  // from the header bytes, or -1
+  int PacketPid(const uint8_t *buf, int len) const;
+
+  // Update the program PIDs from parsed PAT or PMT sections
+  void Update(const PsiPacket &psi_packet);
+
+ private:
+  // rebuild the pass_ and track_ tables
+  void Rebuild();
+
+  int packet_size_;
+  std::set<int> include_pids_;
+  std::set<int> exclude_pids_;
+  std::set<int> include_programs_;
+  std::set<int> exclude_programs_;
+  // PMT PID of each program (from the PAT), and PCR and elementary PIDs
+  // of each program (from its PMT)
+  std::map<int, int> pmt_pids_;
+  std::map<int, std::set<int>> program_pids_;
+  // per-PID decision, and PIDs parsed to follow the programs (fixed
+  // size, so status_t copies do not allocate them)
+  std::bitset<PID_FILTER_NUM_PIDS> pass_;
+  std::bitset<PID_FILTER_NUM_PIDS> track_;
+  PsiAssembler psi_assembler_;
+};
+
+#endif  // PID_FILTER_H_
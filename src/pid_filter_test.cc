@@ -0,0 +1,140 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "pid_filter.h"
+
+#include <gtest/gtest.h>
+#include <string.h>  // for memset, memcpy
+
+#include "mpeg2ts_parser.h"
+
+class PidFilterTest : public ::testing::Test {
+ protected:
+  // a packet of PID <pid> with a PSI section
+  void MakePsiPacket(int pid, const uint8_t *section, int len, uint8_t *buf) {
+    memset(buf, 0xff, MPEG_TS_PACKET_SIZE);
+    buf[0] = MPEG_TS_PACKET_SYNC;
+    buf[1] = 0x40 | (pid >> 8);
+    buf[2] = pid & 0xff;
+    buf[3] = 0x10;
+    // pointer_field
+    buf[4] = 0x00;
+    memcpy(buf + 5, section, len);
+  }
+
+  // a PAT with programs 1 (PMT in PID 0x100) and 2 (PMT in PID 0x200)
+  void MakePat(uint8_t *buf) {
+    const uint8_t section[] = {
+        0x00, 0xb0, 0x11, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01,
+        0xe1, 0x00, 0x00, 0x02, 0xe2, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    MakePsiPacket(MPEG_TS_PID_PAT, section, sizeof(section), buf);
+  }
+
+  // the PMT of program 1: PCR in 0x101, streams in 0x101 and 0x102
+  void MakePmt(uint8_t *buf) {
+    const uint8_t section[] = {
+        0x02, 0xb0, 0x17, 0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1,
+        0x01, 0xf0, 0x00, 0x1b, 0xe1, 0x01, 0xf0, 0x00, 0x81,
+        0xe1, 0x02, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    MakePsiPacket(0x100, section, sizeof(section), buf);
+  }
+
+  // a packet of PID <pid> with no PSI section
+  void MakePacket(int pid, uint8_t *buf) {
+    memset(buf, 0xaa, MPEG_TS_PACKET_SIZE);
+    buf[0] = MPEG_TS_PACKET_SYNC;
+    buf[1] = pid >> 8;
+    buf[2] = pid & 0xff;
+    buf[3] = 0x10;
+  }
+
+  PidFilter pid_filter_;
+};
+
+TEST_F(PidFilterTest, Empty) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+  EXPECT_TRUE(pid_filter_.Empty());
+  EXPECT_FALSE(pid_filter_.HasPrograms());
+  MakePacket(0x123, buf);
+  EXPECT_TRUE(pid_filter_.Select(buf, sizeof(buf)));
+}
+
+TEST_F(PidFilterTest, Pids) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+  EXPECT_EQ(0, pid_filter_.AddSpec("0x100,257"));
+  EXPECT_FALSE(pid_filter_.Empty());
+  EXPECT_FALSE(pid_filter_.HasPrograms());
+  MakePacket(0x100, buf);
+  EXPECT_EQ(0x100, pid_filter_.PacketPid(buf, sizeof(buf)));
+  EXPECT_TRUE(pid_filter_.Select(buf, sizeof(buf)));
+  MakePacket(0x101, buf);
+  EXPECT_TRUE(pid_filter_.Select(buf, sizeof(buf)));
+  MakePacket(0x102, buf);
+  EXPECT_FALSE(pid_filter_.Select(buf, sizeof(buf)));
+
+  // exclusions win
+  EXPECT_EQ(0, pid_filter_.AddSpec("-0x101"));
+  EXPECT_FALSE(pid_filter_.Matches(0x101));
+  EXPECT_TRUE(pid_filter_.Matches(0x100));
+
+  // exclusions only
+  PidFilter exclude_filter;
+  EXPECT_EQ(0, exclude_filter.AddSpec("-0x1fff"));
+  EXPECT_FALSE(exclude_filter.Matches(0x1fff));
+  EXPECT_TRUE(exclude_filter.Matches(0x100));
+}
+
+TEST_F(PidFilterTest, InvalidSpecs) {
+  const char *spec_arr[] = {
+      "", "0x2000", "--1", "0x100,", "abc", "program:", "program:0x10000",
+  };
+  for (const auto spec : spec_arr) {
+    EXPECT_EQ(-1, pid_filter_.AddSpec(spec)) << spec;
+  }
+}
+
+TEST_F(PidFilterTest, Programs) {
+  uint8_t buf[MPEG_TS_PACKET_SIZE];
+  EXPECT_EQ(0, pid_filter_.AddSpec("program:1,0x300"));
+  EXPECT_TRUE(pid_filter_.HasPrograms());
+  // before the PAT, only the PIDs pass
+  MakePacket(0x101, buf);
+  EXPECT_FALSE(pid_filter_.Select(buf, sizeof(buf)));
+  EXPECT_TRUE(pid_filter_.Matches(0x300));
+  // the PAT gives the PMT PID
+  MakePat(buf);
+  EXPECT_FALSE(pid_filter_.Select(buf, sizeof(buf)));
+  EXPECT_TRUE(pid_filter_.Matches(0x100));
+  EXPECT_FALSE(pid_filter_.Matches(0x200));
+  EXPECT_FALSE(pid_filter_.Matches(0x101));
+  // the PMT gives the PCR and elementary PIDs
+  MakePmt(buf);
+  EXPECT_TRUE(pid_filter_.Select(buf, sizeof(buf)));
+  EXPECT_TRUE(pid_filter_.Matches(0x101));
+  EXPECT_TRUE(pid_filter_.Matches(0x102));
+  EXPECT_TRUE(pid_filter_.Matches(0x300));
+  EXPECT_FALSE(pid_filter_.Matches(0x103));
+
+  // excluded programs
+  PidFilter exclude_filter;
+  EXPECT_EQ(0, exclude_filter.AddSpec("-program:1"));
+  MakePat(buf);
+  EXPECT_TRUE(exclude_filter.Select(buf, sizeof(buf)));
+  MakePmt(buf);
+  EXPECT_FALSE(exclude_filter.Select(buf, sizeof(buf)));
+  EXPECT_FALSE(exclude_filter.Matches(0x102));
+  EXPECT_TRUE(exclude_filter.Matches(0x200));
+}
+
+TEST_F(PidFilterTest, M2tsPackets) {
+  uint8_t buf[M2TS_PACKET_SIZE];
+  EXPECT_EQ(0, pid_filter_.SetPacketSize(M2TS_PACKET_SIZE));
+  EXPECT_EQ(0, pid_filter_.AddSpec("0x102"));
+  memset(buf, 0x00, M2TS_TP_EXTRA_HEADER_SIZE);
+  MakePacket(0x102, buf + M2TS_TP_EXTRA_HEADER_SIZE);
+  EXPECT_EQ(0x102, pid_filter_.PacketPid(buf, sizeof(buf)));
+  EXPECT_TRUE(pid_filter_.Select(buf, sizeof(buf)));
+  // not synced
+  EXPECT_EQ(-1, pid_filter_.PacketPid(buf + 1, sizeof(buf) - 1));
+}
@@ -0,0 +1,146 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "prefetch_reader.h"
+
+#include <errno.h>
+#include <unistd.h>  // for read, lseek
+
+#include <algorithm>
+
+PrefetchReader::PrefetchReader()
+    : ring_(NULL),
+      fd_(-1),
+      block_size_(0),
+      depth_(0),
+      base_offset_(-1),
+      slots_(NULL),
+      head_(0),
+      tail_(0),
+      consumed_(0),
+      quit_(false),
+      ended_(false),
+      end_res_(0),
+      consumer_waiting_(false),
+      producer_waiting_(false) {}
+
+PrefetchReader::~PrefetchReader() { Stop(); }
+
+int PrefetchReader::Init(int fd, RingBuffer *ring, int block_size,
+                         int depth) {
+  Stop();
+  if (fd < 0 || !ring->IsMirrored() || depth <= 0) {
+    return -1;
+  }
+  fd_ = fd;
+  block_size_ = block_size;
+  depth_ = depth;
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  base_offset_ = (offset < 0) ? -1 : offset - ring->WritePos();
+  slots_ = new ssize_t[depth_];
+  head_ = 0;
+  tail_ = 0;
+  consumed_ = ring->ReadPos();
+  quit_ = false;
+  ended_ = false;
+  end_res_ = 0;
+  consumer_waiting_ = false;
+  producer_waiting_ = false;
+  ring_ = ring;
+  thread_ = std::thread(&PrefetchReader::Run, this, ring->WritePos());
+  return 0;
+}
+
+void PrefetchReader::Stop() {
+  if (ring_ == NULL) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  delete[] slots_;
+  slots_ = NULL;
+  ring_ = NULL;
+}
+
+int64_t PrefetchReader::Offset() const {
+  if (base_offset_ < 0 || ring_ == NULL) {
+    return -1;
+  }
+  return base_offset_ + ring_->WritePos();
+}
+
+void PrefetchReader::Run(int64_t pos) {
+  int64_t size = ring_->Size();
+  while (!quit_) {
+    // read up to the next block boundary, without overwriting the data
+    // that has not been consumed yet
+    int64_t tail = tail_.load(std::memory_order_relaxed);
+    int len = (int)std::min(block_size_ - (pos % block_size_),
+                            consumed_ + size - pos);
+    if (tail - head_ >= depth_ || len <= 0) {
+      // queue (or ring) full: wait for the consumer
+      std::unique_lock<std::mutex> lock(mutex_);
+      producer_waiting_ = true;
+      cv_.wait(lock, [this, tail, pos, size] {
+        return quit_ || (tail - head_ < depth_ && consumed_ + size > pos);
+      });
+      producer_waiting_ = false;
+      continue;
+    }
+    ssize_t res;
+    do {
+      res = read(fd_, ring_->PosPtr(pos), len);
+    } while (res < 0 && errno == EINTR);
+    slots_[tail % depth_] = res;
+    tail_ = tail + 1;
+    if (consumer_waiting_) {
+      // (taking the lock ensures the consumer is already waiting)
+      std::lock_guard<std::mutex> lock(mutex_);
+    }
+    cv_.notify_all();
+    if (res <= 0) {
+      // end of the input (or error)
+      return;
+    }
+    pos += res;
+  }
+}
+
+ssize_t PrefetchReader::Read() {
+  if (ring_ == NULL) {
+    return -1;
+  }
+  if (ended_) {
+    return end_res_;
+  }
+  // publish the read cursor: the space before it can be reused
+  consumed_ = ring_->ReadPos();
+  if (producer_waiting_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  cv_.notify_all();
+  int64_t head = head_.load(std::memory_order_relaxed);
+  if (tail_ == head) {
+    // queue empty: wait for the thread
+    std::unique_lock<std::mutex> lock(mutex_);
+    consumer_waiting_ = true;
+    cv_.wait(lock, [this, head] { return tail_ != head; });
+    consumer_waiting_ = false;
+  }
+  ssize_t res = slots_[head % depth_];
+  head_ = head + 1;
+  if (producer_waiting_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  cv_.notify_all();
+  if (res > 0) {
+    ring_->Produce(res);
+  } else {
+    ended_ = true;
+    end_res_ = (res < 0) ? -1 : 0;
+  }
+  return (res < 0) ? -1 : res;
+}
@@ -0,0 +1,86 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef PREFETCH_READER_H_
+#define PREFETCH_READER_H_
+
+#include <stdint.h>     // for int64_t
+#include <sys/types.h>  // for ssize_t
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "ring_buffer.h"
+
+// number of blocks read ahead of the consumer (2: double buffering)
+#define DEFAULT_PREFETCH_DEPTH 2
+
+// A read-ahead reader: a background thread reads the next blocks of the
+// input into the free space of a (mirrored) RingBuffer while the
+// consumer parses the current ones.
+//
+// Filled blocks are handed over to the consumer through a lock-free
+// single-producer single-consumer queue of <depth> slots: the consumer
+// appends them to the ring (in order) in Read(). The consumer read
+// cursor is published back to the thread, so it never overwrites data
+// that has not been consumed. Threads only sleep (on a condition
+// variable) when the queue is empty (consumer) or full (thread).
+//
+// Any input descriptor (files, pipes) is supported: the thread reads
+// sequentially from its current position.
+class PrefetchReader {
+ public:
+  PrefetchReader();
+  ~PrefetchReader();
+
+  // Start reading <fd> into <ring>, which must be mirrored. Returns 0
+  // if successful, -1 otherwise.
+  int Init(int fd, RingBuffer *ring, int block_size, int depth);
+
+  // Stop the thread (dropping the blocks read ahead)
+  void Stop();
+
+  bool Running() const { return ring_ != NULL; }
+
+  // Wait for the next block, and append it to the ring. Returns the
+  // number of bytes appended, 0 at the end of the input, -1 on error.
+  ssize_t Read();
+
+  // file offset of the ring write cursor (-1 if the input is not
+  // seekable)
+  int64_t Offset() const;
+
+ private:
+  // thread: read into the ring, starting at ring position <pos>
+  void Run(int64_t pos);
+
+  RingBuffer *ring_;
+  int fd_;
+  int block_size_;
+  int depth_;
+  // file offset of ring position 0 (-1 if not seekable)
+  int64_t base_offset_;
+  std::thread thread_;
+
+  // SPSC queue: slots [head_, tail_) are the read() results of the
+  // filled blocks (head_ is only written by the consumer, tail_ by the
+  // thread)
+  ssize_t *slots_;
+  std::atomic<int64_t> head_;
+  std::atomic<int64_t> tail_;
+  // consumer read cursor, as seen by the thread
+  std::atomic<int64_t> consumed_;
+  std::atomic<bool> quit_;
+  // (consumer) result of the last block, once the input has ended
+  bool ended_;
+  ssize_t end_res_;
+
+  // slow path: sleeping while the queue is empty or full
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> consumer_waiting_;
+  std::atomic<bool> producer_waiting_;
+};
+
+#endif  // PREFETCH_READER_H_
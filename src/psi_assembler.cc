@@ -0,0 +1,153 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "psi_assembler.h"
+
+#include <algorithm>
+
+#include "mpeg2ts_parser.h"
+#include "ts_payload.h"
+
+PsiAssembler::PsiAssembler()
+    : packet_size_(MPEG_TS_PACKET_SIZE),
+      skip_unchanged_(true),
+      mpeg2ts_parser_(false) {}
+
+int PsiAssembler::SetPacketSize(int packet_size) {
+  if (!Mpeg2TsParser::IsValidPacketSize(packet_size)) {
+    return -1;
+  }
+  packet_size_ = packet_size;
+  return 0;
+}
+
+void PsiAssembler::Reset() { pids_.clear(); }
+
+int PsiAssembler::Push(const uint8_t *buf, int len, PsiPacket *psi_packet) {
+  TsPayload ts;
+  int res = ts.Parse(packet_size_, buf, len);
+  if (res <= 0) {
+    return res;
+  }
+  auto iter = pids_.find(ts.Pid());
+  if (iter == pids_.end()) {
+    pid_state_t state;
+    state.continuity_counter = -1;
+    iter = pids_.emplace(ts.Pid(), state).first;
+  }
+  pid_state_t *state = &iter->second;
+  TsPayload::Continuity continuity =
+      ts.CheckContinuity(&state->continuity_counter);
+  if (continuity == TsPayload::CONTINUITY_DUPLICATE) {
+    return 0;
+  }
+  if (continuity == TsPayload::CONTINUITY_GAP) {
+    state->section.clear();
+  }
+  if (ts.Len() <= 0) {
+    state->section.clear();
+    return 0;
+  }
+  const uint8_t *payload = ts.Data();
+  int payload_len = ts.Len();
+  int completed = 0;
+  bool done = false;
+  if (!ts.PayloadUnitStartIndicator()) {
+    // continuation of the section in progress (if any). The rest of the
+    // packet (after its end) is stuffing.
+    if (!state->section.empty()) {
+      AppendSection(payload, payload_len, state, &done);
+      if (done) {
+        completed += FlushSection(state, psi_packet);
+      }
+    }
+    return completed;
+  }
+  // the pointer_field tells where the first new section starts: the
+  // bytes before it end the section in progress
+  int pointer_field = payload[0];
+  if (1 + pointer_field > payload_len) {
+    state->section.clear();
+    return completed;
+  }
+  if (!state->section.empty()) {
+    AppendSection(payload + 1, pointer_field, state, &done);
+    if (done) {
+      completed += FlushSection(state, psi_packet);
+    }
+    // drop an incomplete section
+    state->section.clear();
+  }
+  completed += StartSections(payload + 1 + pointer_field,
+                             payload_len - 1 - pointer_field, state,
+                             psi_packet);
+  return completed;
+}
+
+int PsiAssembler::StartSections(const uint8_t *buf, int len,
+                                pid_state_t *state, PsiPacket *psi_packet) {
+  int completed = 0;
+  int bi = 0;
+  // stuffing (0xff) follows the last section
+  while (bi < len && buf[bi] != MPEG_TS_TABLE_ID_FORBIDDEN) {
+    bool done = false;
+    bi += AppendSection(buf + bi, len - bi, state, &done);
+    if (!done) {
+      // continues in the next packet
+      break;
+    }
+    completed += FlushSection(state, psi_packet);
+  }
+  return completed;
+}
+
+int PsiAssembler::AppendSection(const uint8_t *buf, int len,
+                                pid_state_t *state, bool *done) {
+  std::vector<uint8_t> &section = state->section;
+  int used = 0;
+  *done = false;
+  while (true) {
+    // table_id and section_length first, then the rest of the section
+    int size = section.size();
+    int need = 3;
+    if (size >= 3) {
+      need += ((section[1] & 0x0f) << 8) | section[2];
+      if (need > PSI_MAX_SECTION_SIZE) {
+        section.clear();
+        return len;
+      }
+      if (size == need) {
+        *done = true;
+        return used;
+      }
+    }
+    if (used == len) {
+      return used;
+    }
+    int n = std::min(need - size, len - used);
+    section.insert(section.end(), buf + used, buf + used + n);
+    used += n;
+  }
+}
+
+uint32_t PsiAssembler::SectionKey(const std::vector<uint8_t> &section) {
+  uint32_t key = (uint32_t)section[0] << 24;
+  // long sections (section_syntax_indicator) have a table_id_extension
+  // and a section_number
+  if ((section[1] & 0x80) != 0 && section.size() >= 8) {
+    key |= (section[3] << 16) | (section[4] << 8) | section[6];
+  }
+  return key;
+}
+
+int PsiAssembler::FlushSection(pid_state_t *state, PsiPacket *psi_packet) {
+  std::vector<uint8_t> &table = state->tables[SectionKey(state->section)];
+  if (skip_unchanged_ && table == state->section) {
+    state->section.clear();
+    return 0;
+  }
+  table = state->section;
+  int res = mpeg2ts_parser_.ParsePsiSection(state->section.data(),
+                                            state->section.size(), psi_packet);
+  state->section.clear();
+  return (res < 0) ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef PSI_ASSEMBLER_H_
+#define PSI_ASSEMBLER_H_
+
+#include <stdint.h>  // for uint8_t
+
+#include <map>
+#include <vector>
+
+#include "mpeg2ts.pb.h"
+#include "mpeg2ts_parser.h"
+
+// maximum size of a PSI section (private sections, including the 3-byte
+// section header)
+#define PSI_MAX_SECTION_SIZE (3 + 4093)
+
+// A per-PID PSI section assembler.
+//
+// Mpeg2TsParser::ParsePacket() parses each packet on its own, so it only
+// parses the sections that start and end in the same packet (a longer
+// PAT, PMT, or SDT is kept as raw bytes, which keeps the packet-level
+// output lossless). The assembler follows the pointer_field and the
+// continuation packets of each PID it is fed, and parses every section
+// once it is whole, whether it fits in one packet or spans many.
+//
+// A section in progress is dropped on a continuity counter gap, and
+// when a new section starts before it is complete.
+//
+// Tables repeat all the time (e.g. the PAT and PMTs every 100 ms), so the
+// assembler keeps the last section of each table (per PID, table_id,
+// table_id_extension, and section_number): a section with the same
+// bytes (hence the same version_number and CRC_32) is not parsed nor
+// returned again, unless SetSkipUnchanged(false) is used.
+class PsiAssembler {
+ public:
+  PsiAssembler();
+
+  // Set the size of the packets passed to Push()
+  int SetPacketSize(int packet_size);
+
+  // Set whether unchanged sections are skipped (the default)
+  void SetSkipUnchanged(bool skip_unchanged) {
+    skip_unchanged_ = skip_unchanged;
+  }
+
+  // Feed a (synced) packet of <len> bytes. Each section completed by the
+  // packet is parsed and appended to the matching list of <psi_packet>
+  // (pointer_field is not set). Returns the number of sections
+  // completed (and new or changed), or -1 if the packet is not a valid
+  // mpeg-ts packet.
+  int Push(const uint8_t *buf, int len, PsiPacket *psi_packet);
+
+  // Forget the sections in progress, and the known tables (e.g. after a
+  // seek)
+  void Reset();
+
+ private:
+  // the section in progress of a PID
+  typedef struct pid_state_t {
+    std::vector<uint8_t> section;
+    // last continuity counter (-1 if none)
+    int continuity_counter;
+    // last section of each table (see SectionKey())
+    std::map<uint32_t, std::vector<uint8_t>> tables;
+  } pid_state_t;
+
+  // Returns the table key of a complete section
+  static uint32_t SectionKey(const std::vector<uint8_t> &section);
+
+  // Append the bytes that start sections in <buf> (i.e. after the
+  // pointer_field of a packet with payload_unit_start_indicator).
+  // Returns the number of sections completed.
+  int StartSections(const uint8_t *buf, int len, pid_state_t *state,
+                    PsiPacket *psi_packet);
+
+  // Append <len> bytes to the section in progress. Returns the number of
+  // bytes used (up to the end of the section), and sets <*done> if the
+  // section is now complete.
+  int AppendSection(const uint8_t *buf, int len, pid_state_t *state,
+                    bool *done);
+
+  // Parse the complete section in progress, and clear it. Returns 1 if
+  // it was parsed, 0 otherwise (including unchanged sections).
+  int FlushSection(pid_state_t *state, PsiPacket *psi_packet);
+
+  int packet_size_;
+  bool skip_unchanged_;
+  std::map<int, pid_state_t> pids_;
+  // section parser (reused for all the sections)
+  Mpeg2TsParser mpeg2ts_parser_;
+};
+
+#endif  // PSI_ASSEMBLER_H_
@@ -0,0 +1,220 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "psi_assembler.h"
+
+#include <gtest/gtest.h>
+#include <string.h>  // for memcpy
+
+#include <algorithm>
+#include <vector>
+
+#include "mpeg2ts_parser.h"
+#include "ts_test_utils.h"
+
+class PsiAssemblerTest : public ::testing::Test {
+ protected:
+  // a PMT section (program 1, PCR in 0x101) with <num_streams> streams
+  // (0x101, 0x102, ...)
+  std::vector<uint8_t> MakePmtSection(int num_streams) {
+    int section_length = 9 + num_streams * 5 + 4;
+    std::vector<uint8_t> section = {
+        0x02,
+        (uint8_t)(0xb0 | (section_length >> 8)),
+        (uint8_t)(section_length & 0xff),
+        0x00,
+        0x01,
+        0xc1,
+        0x00,
+        0x00,
+        0xe1,
+        0x01,
+        0xf0,
+        0x00,
+    };
+    for (int i = 0; i < num_streams; ++i) {
+      int pid = 0x101 + i;
+      const uint8_t stream[] = {0x1b, (uint8_t)(0xe0 | (pid >> 8)),
+                                (uint8_t)(pid & 0xff), 0xf0, 0x00};
+      section.insert(section.end(), stream, stream + sizeof(stream));
+    }
+    // CRC_32 (not checked)
+    section.insert(section.end(), 4, 0x00);
+    return section;
+  }
+
+  // a PAT section with programs 1 (PMT in PID 0x100) and 2 (PMT in PID
+  // 0x200)
+  std::vector<uint8_t> MakePatSection() {
+    return {
+        0x00, 0xb0, 0x11, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01,
+        0xe1, 0x00, 0x00, 0x02, 0xe2, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+  }
+
+  // a packet of PID <pid> with <payload> (stuffed)
+  std::vector<uint8_t> MakePacket(int pid, bool start, int cc,
+                                  const std::vector<uint8_t> &payload) {
+    std::vector<uint8_t> buf(MPEG_TS_PACKET_SIZE, 0xff);
+    buf[0] = MPEG_TS_PACKET_SYNC;
+    buf[1] = (start ? 0x40 : 0x00) | (pid >> 8);
+    buf[2] = pid & 0xff;
+    buf[3] = 0x10 | (cc & 0x0f);
+    memcpy(buf.data() + 4, payload.data(),
+           std::min(payload.size(), buf.size() - 4));
+    return buf;
+  }
+
+  PsiAssembler psi_assembler_;
+};
+
+TEST_F(PsiAssemblerTest, SinglePacketSections) {
+  // a PAT and a short PMT in the same packet
+  std::vector<uint8_t> sections = MakePatSection();
+  std::vector<uint8_t> pmt = MakePmtSection(2);
+  sections.insert(sections.end(), pmt.begin(), pmt.end());
+  auto packets = Packetize(PACKETIZE_PSI, 0x100, sections, 0);
+  ASSERT_EQ(1, packets.size());
+  PsiPacket psi_packet;
+  EXPECT_EQ(2, psi_assembler_.Push(packets[0].data(), packets[0].size(),
+                                   &psi_packet));
+  ASSERT_EQ(1, psi_packet.program_association_section_size());
+  auto &pas = psi_packet.program_association_section(0);
+  EXPECT_EQ(2, pas.program_information_size());
+  ASSERT_EQ(1, psi_packet.program_map_section_size());
+  EXPECT_EQ(2, psi_packet.program_map_section(0).stream_description_size());
+  EXPECT_FALSE(psi_packet.has_pointer_field());
+}
+
+TEST_F(PsiAssemblerTest, MultiPacketSection) {
+  // a PMT that the packet parser cannot parse on its own
+  std::vector<uint8_t> pmt = MakePmtSection(80);
+  auto packets = Packetize(PACKETIZE_PSI, 0x100, pmt, 14);
+  ASSERT_EQ(3, packets.size());
+  Mpeg2TsParser mpeg2ts_parser(true);
+  Mpeg2Ts mpeg2ts;
+  mpeg2ts_parser.ParsePacket(0, 0, packets[0].data(), packets[0].size(),
+                             &mpeg2ts);
+  EXPECT_EQ(0, mpeg2ts.parsed().psi_packet().program_map_section_size());
+
+  PsiPacket psi_packet;
+  EXPECT_EQ(0, psi_assembler_.Push(packets[0].data(), packets[0].size(),
+                                   &psi_packet));
+  // duplicate packets are ignored
+  EXPECT_EQ(0, psi_assembler_.Push(packets[0].data(), packets[0].size(),
+                                   &psi_packet));
+  EXPECT_EQ(0, psi_assembler_.Push(packets[1].data(), packets[1].size(),
+                                   &psi_packet));
+  EXPECT_EQ(1, psi_assembler_.Push(packets[2].data(), packets[2].size(),
+                                   &psi_packet));
+  ASSERT_EQ(1, psi_packet.program_map_section_size());
+  auto &pms = psi_packet.program_map_section(0);
+  EXPECT_EQ(1, pms.program_number());
+  ASSERT_EQ(80, pms.stream_description_size());
+  EXPECT_EQ(0x101 + 79, pms.stream_description(79).elementary_pid());
+}
+
+TEST_F(PsiAssemblerTest, PointerField) {
+  std::vector<uint8_t> pat = MakePatSection();
+  std::vector<uint8_t> short_pmt = MakePmtSection(2);
+  std::vector<uint8_t> long_pmt = MakePmtSection(36);
+  ASSERT_LT(183, long_pmt.size());
+  PsiPacket psi_packet;
+
+  // a section header split across packets: the pointer_field skips the
+  // end of a section that was never started
+  std::vector<uint8_t> payload(183 - 2, 0x00);
+  payload.insert(payload.begin(), 183 - 2);
+  payload.insert(payload.end(), short_pmt.begin(), short_pmt.begin() + 2);
+  auto buf = MakePacket(0x100, true, 0, payload);
+  EXPECT_EQ(0, psi_assembler_.Push(buf.data(), buf.size(), &psi_packet));
+  payload.assign(short_pmt.begin() + 2, short_pmt.end());
+  buf = MakePacket(0x100, false, 1, payload);
+  EXPECT_EQ(1, psi_assembler_.Push(buf.data(), buf.size(), &psi_packet));
+  EXPECT_EQ(1, psi_packet.program_map_section_size());
+
+  // the pointer_field ends the section in progress, and a new one starts
+  // after it
+  payload.assign(1, 0x00);
+  payload.insert(payload.end(), long_pmt.begin(), long_pmt.begin() + 183);
+  buf = MakePacket(0x100, true, 2, payload);
+  EXPECT_EQ(0, psi_assembler_.Push(buf.data(), buf.size(), &psi_packet));
+  int rest = long_pmt.size() - 183;
+  payload.assign(1, rest);
+  payload.insert(payload.end(), long_pmt.begin() + 183, long_pmt.end());
+  payload.insert(payload.end(), pat.begin(), pat.end());
+  buf = MakePacket(0x100, true, 3, payload);
+  EXPECT_EQ(2, psi_assembler_.Push(buf.data(), buf.size(), &psi_packet));
+  ASSERT_EQ(2, psi_packet.program_map_section_size());
+  EXPECT_EQ(36, psi_packet.program_map_section(1).stream_description_size());
+  EXPECT_EQ(1, psi_packet.program_association_section_size());
+}
+
+TEST_F(PsiAssemblerTest, ContinuityGap) {
+  std::vector<uint8_t> long_pmt = MakePmtSection(36);
+  auto packets = Packetize(PACKETIZE_PSI, 0x100, long_pmt, 5);
+  ASSERT_EQ(2, packets.size());
+  PsiPacket psi_packet;
+  EXPECT_EQ(0, psi_assembler_.Push(packets[0].data(), packets[0].size(),
+                                   &psi_packet));
+  // lose a packet
+  packets[1][3] = 0x17;
+  EXPECT_EQ(0, psi_assembler_.Push(packets[1].data(), packets[1].size(),
+                                   &psi_packet));
+  EXPECT_EQ(0, psi_packet.program_map_section_size());
+  // not a packet
+  packets[1][0] = 0x00;
+  EXPECT_EQ(-1, psi_assembler_.Push(packets[1].data(), packets[1].size(),
+                                    &psi_packet));
+}
+
+TEST_F(PsiAssemblerTest, M2tsPackets) {
+  EXPECT_EQ(0, psi_assembler_.SetPacketSize(M2TS_PACKET_SIZE));
+  auto packets = Packetize(PACKETIZE_PSI, 0x100, MakePmtSection(50), 0);
+  PsiPacket psi_packet;
+  int completed = 0;
+  for (auto &packet : packets) {
+    std::vector<uint8_t> buf(M2TS_TP_EXTRA_HEADER_SIZE, 0x00);
+    buf.insert(buf.end(), packet.begin(), packet.end());
+    completed += psi_assembler_.Push(buf.data(), buf.size(), &psi_packet);
+  }
+  EXPECT_EQ(1, completed);
+  ASSERT_EQ(1, psi_packet.program_map_section_size());
+  EXPECT_EQ(50, psi_packet.program_map_section(0).stream_description_size());
+}
+
+TEST_F(PsiAssemblerTest, UnchangedSections) {
+  std::vector<uint8_t> pmt = MakePmtSection(40);
+  PsiPacket psi_packet;
+  int cc = 0;
+  // repetitions of a table are only returned once
+  for (int i = 0; i < 3; ++i) {
+    int completed = 0;
+    for (auto &packet : Packetize(PACKETIZE_PSI, 0x100, pmt, cc)) {
+      completed += psi_assembler_.Push(packet.data(), packet.size(),
+                                       &psi_packet);
+      cc += 1;
+    }
+    EXPECT_EQ((i == 0) ? 1 : 0, completed) << i;
+  }
+  EXPECT_EQ(1, psi_packet.program_map_section_size());
+  // a new version is
+  pmt[5] = 0xc3;
+  int completed = 0;
+  for (auto &packet : Packetize(PACKETIZE_PSI, 0x100, pmt, cc)) {
+    completed += psi_assembler_.Push(packet.data(), packet.size(), &psi_packet);
+    cc += 1;
+  }
+  EXPECT_EQ(1, completed);
+  ASSERT_EQ(2, psi_packet.program_map_section_size());
+  EXPECT_EQ(1, psi_packet.program_map_section(1).version_number());
+
+  // unless asked otherwise
+  PsiAssembler all_sections;
+  all_sections.SetSkipUnchanged(false);
+  auto packets = Packetize(PACKETIZE_PSI, 0x100, MakePmtSection(2), 0);
+  EXPECT_EQ(1, all_sections.Push(packets[0].data(), packets[0].size(),
+                                 &psi_packet));
+  packets[0][3] += 1;
+  EXPECT_EQ(1, all_sections.Push(packets[0].data(), packets[0].size(),
+                                 &psi_packet));
+}
@@ -0,0 +1,104 @@
+// Copyright Google Inc. Apache 2.0.
+
+#include "ring_buffer.h"
+
+#include <string.h>    // for memmove
+#include <sys/mman.h>  // for mmap, memfd_create
+#include <unistd.h>    // for sysconf, ftruncate
+
+#include <new>  // for std::nothrow
+
+RingBuffer::RingBuffer()
+    : base_(NULL), size_(0), mirrored_(false), rpos_(0), wpos_(0), origin_(0) {}
+
+RingBuffer::~RingBuffer() { Release(); }
+
+void RingBuffer::Release() {
+  if (base_ == NULL) {
+    return;
+  }
+  if (mirrored_) {
+    munmap(base_, 2 * (size_t)size_);
+  } else {
+    delete[] base_;
+  }
+  base_ = NULL;
+}
+
+int RingBuffer::Init(int size) {
+  Release();
+  Reset();
+  // round up to the page size
+  int page_size = sysconf(_SC_PAGESIZE);
+  size_ = ((size + page_size - 1) / page_size) * page_size;
+
+  // try to map the same memory twice in a row
+  mirrored_ = false;
+  int fd = memfd_create("m2pb-ring", 0);
+  if (fd >= 0) {
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, size_) == 0) {
+      base = mmap(NULL, 2 * (size_t)size_, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (base != MAP_FAILED) {
+      uint8_t *first = reinterpret_cast<uint8_t *>(base);
+      if (mmap(first, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+               fd, 0) != MAP_FAILED &&
+          mmap(first + size_, size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+        base_ = first;
+        mirrored_ = true;
+      } else {
+        munmap(base, 2 * (size_t)size_);
+      }
+    }
+    close(fd);
+  }
+  if (base_ == NULL) {
+    // linear fallback
+    base_ = new (std::nothrow) uint8_t[size_];
+  }
+  if (base_ == NULL) {
+    size_ = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void RingBuffer::Reset() {
+  rpos_ = 0;
+  wpos_ = 0;
+  origin_ = 0;
+}
+
+const uint8_t *RingBuffer::ReadPtr() const {
+  if (mirrored_) {
+    return base_ + (rpos_ % size_);
+  }
+  return base_ + (rpos_ - origin_);
+}
+
+void RingBuffer::Consume(int len) { rpos_ += len; }
+
+uint8_t *RingBuffer::WritePtr() {
+  if (mirrored_) {
+    return base_ + (wpos_ % size_);
+  }
+  return base_ + (wpos_ - origin_);
+}
+
+int RingBuffer::Free() {
+  if (mirrored_) {
+    return size_ - Used();
+  }
+  // linear fallback: move the buffered data to the front once we run
+  // out of space at the end
+  if ((size_ - (wpos_ - origin_)) < (size_ / 2) && rpos_ > origin_) {
+    memmove(base_, base_ + (rpos_ - origin_), Used());
+    origin_ = rpos_;
+  }
+  return size_ - (int)(wpos_ - origin_);
+}
+
+void RingBuffer::Produce(int len) { wpos_ += len; }
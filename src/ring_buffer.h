@@ -0,0 +1,74 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stdint.h>  // for uint8_t, int64_t
+
+#define RING_BUFFER_BLOCK_SIZE (1 << 20)
+#define DEFAULT_RING_BUFFER_SIZE (4 * RING_BUFFER_BLOCK_SIZE)
+
+// A circular byte buffer.
+//
+// The buffer memory is mapped twice, back to back, so that both the
+// buffered data (starting at ReadPtr()) and the free space (starting
+// at WritePtr()) are always contiguous, even when they wrap around the
+// end of the ring. Data is never moved: the producer appends at the
+// write cursor and the consumer moves the read cursor forward.
+//
+// If the double mapping is not available, the ring falls back to a
+// linear buffer that moves the (unconsumed) data to the front once
+// the write cursor reaches the end of the buffer.
+class RingBuffer {
+ public:
+  RingBuffer();
+  ~RingBuffer();
+
+  // Allocate the buffer. <size> is rounded up to the page size.
+  // Returns 0 if successful, -1 otherwise.
+  int Init(int size);
+
+  // Returns the buffer size
+  int Size() const { return size_; }
+  // Returns whether the buffer memory is double-mapped
+  bool IsMirrored() const { return mirrored_; }
+
+  // buffered (produced but not consumed) data
+  const uint8_t *ReadPtr() const;
+  int Used() const { return (int)(wpos_ - rpos_); }
+  void Consume(int len);
+
+  // contiguous free space
+  uint8_t *WritePtr();
+  int Free();
+  void Produce(int len);
+
+  // absolute (since Init/Reset) read/write positions
+  int64_t ReadPos() const { return rpos_; }
+  int64_t WritePos() const { return wpos_; }
+
+  // (mirrored ring only) pointer to absolute position <pos>, which
+  // must be in [ReadPos(), ReadPos() + Size()]. Used to write ahead of
+  // the write cursor.
+  uint8_t *PosPtr(int64_t pos) { return base_ + (pos % size_); }
+
+  // memory backing the ring (both mappings if mirrored)
+  uint8_t *Base() { return base_; }
+  int64_t MappedSize() const { return (mirrored_ ? 2 : 1) * (int64_t)size_; }
+
+  // drop all the buffered data
+  void Reset();
+
+ private:
+  void Release();
+
+  uint8_t *base_;
+  int size_;
+  bool mirrored_;
+  int64_t rpos_;
+  int64_t wpos_;
+  // linear fallback: offset of rpos_ in base_
+  int64_t origin_;
+};
+
+#endif  // RING_BUFFER_H_
@@ -0,0 +1,84 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef TS_PAYLOAD_H_
+#define TS_PAYLOAD_H_
+
+#include <stdint.h>  // for uint8_t
+
+#include "mpeg2ts_parser.h"
+
+// The payload of a binary mpeg2ts packet, and the header fields needed
+// to reassemble it with the payloads of the other packets of its PID
+// (see PsiAssembler and PesAssembler).
+class TsPayload {
+ public:
+  // how a packet follows the previous packet of its PID
+  enum Continuity { CONTINUITY_OK, CONTINUITY_DUPLICATE, CONTINUITY_GAP };
+
+  // Locate the payload of a <len>-byte packet, read with <packet_size>
+  // byte packets. Returns -1 if it is not a valid mpeg2ts packet, 0 if
+  // it carries nothing to reassemble (transport_error_indicator set, or
+  // no payload), or 1.
+  int Parse(int packet_size, const uint8_t *buf, int len) {
+    const uint8_t *ts;
+    int ts_len = Mpeg2TsParser::FramePacket(packet_size, buf, len, &ts);
+    if (ts_len < 4 || ts[0] != MPEG_TS_PACKET_SYNC) {
+      return -1;
+    }
+    if ((ts[1] & 0x80) != 0) {
+      // transport_error_indicator: do not trust the packet
+      return 0;
+    }
+    pid_ = ((ts[1] & 0x1f) << 8) | ts[2];
+    payload_unit_start_indicator_ = (ts[1] & 0x40) != 0;
+    continuity_counter_ = ts[3] & 0x0f;
+    if ((ts[3] & 0x10) == 0) {
+      // the continuity counter only increments with a payload
+      return 0;
+    }
+    int bi = 4;
+    if ((ts[3] & 0x20) != 0) {
+      // adaptation_field_length (if the packet has room for it)
+      bi += 1 + ((ts_len > 4) ? ts[4] : 0);
+    }
+    data_ = ts + bi;
+    len_ = (bi <= ts_len) ? (ts_len - bi) : -1;
+    return 1;
+  }
+
+  // Check the continuity counter of the packet against <*last>, the one
+  // of the previous packet of its PID (-1 if none), and update <*last>
+  // (duplicate packets are to be dropped, and gaps lose the data in
+  // progress)
+  Continuity CheckContinuity(int *last) const {
+    Continuity continuity = CONTINUITY_OK;
+    if (*last >= 0) {
+      if (continuity_counter_ == *last) {
+        return CONTINUITY_DUPLICATE;
+      }
+      if (continuity_counter_ != ((*last + 1) & 0x0f)) {
+        continuity = CONTINUITY_GAP;
+      }
+    }
+    *last = continuity_counter_;
+    return continuity;
+  }
+
+  int Pid() const { return pid_; }
+  bool PayloadUnitStartIndicator() const {
+    return payload_unit_start_indicator_;
+  }
+  // the payload (after the adaptation field), and its length: -1 if the
+  // adaptation field overflows the packet
+  const uint8_t *Data() const { return data_; }
+  int Len() const { return len_; }
+
+ private:
+  int pid_;
+  bool payload_unit_start_indicator_;
+  int continuity_counter_;
+  const uint8_t *data_;
+  int len_;
+};
+
+#endif  // TS_PAYLOAD_H_
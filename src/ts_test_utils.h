@@ -0,0 +1,61 @@
+// Copyright Google Inc. Apache 2.0.
+
+#ifndef TS_TEST_UTILS_H_
+#define TS_TEST_UTILS_H_
+
+#include <stdint.h>  // for uint8_t
+#include <string.h>  // for memcpy
+
+#include <algorithm>
+#include <vector>
+
+#include "mpeg2ts_parser.h"
+
+// what the packets of Packetize() carry
+enum PacketizedPayload {
+  // PSI sections: the first packet starts with a pointer_field, and the
+  // last one is stuffed with 0xff bytes
+  PACKETIZE_PSI,
+  // a PES packet: the last packet is padded with an adaptation field
+  PACKETIZE_PES,
+};
+
+// Split <payload> in mpeg2ts packets of PID <pid>, starting with
+// continuity counter <cc>.
+static inline std::vector<std::vector<uint8_t>> Packetize(
+    PacketizedPayload type, int pid, const std::vector<uint8_t> &payload,
+    int cc) {
+  std::vector<std::vector<uint8_t>> packets;
+  size_t offset = 0;
+  while (offset < payload.size()) {
+    std::vector<uint8_t> buf(MPEG_TS_PACKET_SIZE, 0xff);
+    bool start = (offset == 0);
+    buf[0] = MPEG_TS_PACKET_SYNC;
+    buf[1] = (start ? 0x40 : 0x00) | (pid >> 8);
+    buf[2] = pid & 0xff;
+    buf[3] = 0x10 | (cc & 0x0f);
+    int bi = 4;
+    if (type == PACKETIZE_PSI && start) {
+      // pointer_field
+      buf[bi++] = 0x00;
+    }
+    int n = std::min(payload.size() - offset, (size_t)(buf.size() - bi));
+    if (type == PACKETIZE_PES && n < (int)buf.size() - bi) {
+      // adaptation field stuffing
+      buf[3] |= 0x20;
+      int af_len = buf.size() - bi - n - 1;
+      buf[bi] = af_len;
+      if (af_len > 0) {
+        buf[bi + 1] = 0x00;
+      }
+      bi += 1 + af_len;
+    }
+    memcpy(buf.data() + bi, payload.data() + offset, n);
+    offset += n;
+    cc += 1;
+    packets.push_back(buf);
+  }
+  return packets;
+}
+
+#endif  // TS_TEST_UTILS_H_
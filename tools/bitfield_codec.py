@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+
+"""Generates bit-field Parse/Dump routines from an annotated .proto file.
+
+Messages whose fields all carry the (bit_offset) and (bit_width) field
+options (see mpeg2ts.proto) get a pair of C++ routines that load the
+bytes covering the message as a single big-endian word, and extract
+(or insert) every field with a constant shift and mask:
+
+  int Parse<Message>Bits(const uint8_t *buf, int len, <Message> *msg);
+  int Dump<Message>Bits(const <Message> &msg, uint8_t *buf, int len);
+
+Both return the number of bytes covered by the message, or -1 if the
+buffer is too short, a marker (see the (bit_marker) message option)
+does not match when parsing, or a field is missing when dumping. Bits
+that are neither fields nor markers are not touched when dumping.
+
+The input is the descriptor set of the .proto file, as written by
+"protoc --descriptor_set_out" (read without the protobuf runtime).
+
+Usage: bitfield_codec.py <input.desc> <output.h>
+"""
+
+import os
+import re
+import sys
+
+
+# descriptor.proto field numbers
+FILE_DESCRIPTOR_SET_FILE = 1
+FILE_NAME = 1
+FILE_MESSAGE_TYPE = 4
+FILE_EXTENSION = 7
+MESSAGE_NAME = 1
+MESSAGE_FIELD = 2
+MESSAGE_NESTED_TYPE = 3
+MESSAGE_OPTIONS = 7
+FIELD_NAME = 1
+FIELD_EXTENDEE = 2
+FIELD_NUMBER = 3
+FIELD_LABEL = 4
+FIELD_TYPE = 5
+FIELD_OPTIONS = 8
+LABEL_REPEATED = 3
+# field types that can hold a bit field (and their maximum width)
+FIELD_TYPES = {
+    3: ('int64', 64),
+    4: ('uint64', 64),
+    5: ('int32', 32),
+    8: ('bool', 1),
+    13: ('uint32', 32),
+}
+# BitMarker field numbers
+MARKER_OFFSET = 1
+MARKER_WIDTH = 2
+MARKER_VALUE = 3
+
+MAX_WORD_BYTES = 8
+
+
+def read_varint(buf, pos):
+  """Returns the varint at buf[pos:], and the position after it."""
+  value = 0
+  shift = 0
+  while True:
+    b = buf[pos]
+    pos += 1
+    value |= (b & 0x7f) << shift
+    shift += 7
+    if not b & 0x80:
+      return value, pos
+
+
+def decode(buf):
+  """Returns the (field number, value) list of the serialized message."""
+  fields = []
+  pos = 0
+  while pos < len(buf):
+    key, pos = read_varint(buf, pos)
+    number, wire_type = key >> 3, key & 0x7
+    if wire_type == 0:
+      value, pos = read_varint(buf, pos)
+    elif wire_type == 1:
+      value, pos = buf[pos:pos + 8], pos + 8
+    elif wire_type == 2:
+      length, pos = read_varint(buf, pos)
+      value, pos = buf[pos:pos + length], pos + length
+    elif wire_type == 5:
+      value, pos = buf[pos:pos + 4], pos + 4
+    else:
+      raise ValueError('unsupported wire type %d' % wire_type)
+    fields.append((number, value))
+  return fields
+
+
+def get(fields, number, default=None):
+  """Returns the last value of field <number> in <fields>."""
+  values = get_all(fields, number)
+  return values[-1] if values else default
+
+
+def get_all(fields, number):
+  """Returns the values of field <number> in <fields>."""
+  return [value for n, value in fields if n == number]
+
+
+def signed(value, bits=64):
+  """Returns the varint <value> as a signed integer."""
+  value &= (1 << bits) - 1
+  return value - (1 << bits) if value >> (bits - 1) else value
+
+
+class BitField(object):
+  """A field of a message, and its bit layout."""
+
+  def __init__(self, name, field_type, offset, width):
+    self.name = name
+    self.field_type = field_type
+    self.offset = offset
+    self.width = width
+
+
+class BitMarker(object):
+  """Fixed bits of a message."""
+
+  def __init__(self, offset, width, value):
+    self.offset = offset
+    self.width = width
+    self.value = value
+
+
+class BitMessage(object):
+  """A message whose fields are all bit fields."""
+
+  def __init__(self, name, fields, markers):
+    self.name = name
+    self.fields = fields
+    self.markers = markers
+    self.size = (max(f.offset + f.width for f in fields + markers) + 7) // 8
+    self.word_bits = 32 if self.size <= 4 else 64
+
+  def shift(self, field):
+    """Returns the shift of <field> (or marker) in the message word."""
+    return self.size * 8 - field.offset - field.width
+
+
+class Options(object):
+  """The field numbers of the bit layout options."""
+
+  def __init__(self, extensions):
+    self.bit_offset = extensions.get('.google.protobuf.FieldOptions',
+                                     {}).get('bit_offset')
+    self.bit_width = extensions.get('.google.protobuf.FieldOptions',
+                                    {}).get('bit_width')
+    self.bit_marker = extensions.get('.google.protobuf.MessageOptions',
+                                     {}).get('bit_marker')
+
+
+def parse_descriptor_set(buf):
+  """Returns the proto file name and the list of BitMessage in <buf>."""
+  files = get_all(decode(buf), FILE_DESCRIPTOR_SET_FILE)
+  if not files:
+    raise ValueError('empty descriptor set')
+  # the last file is the one given to protoc (the imports come first)
+  proto = decode(files[-1])
+  # the option extensions (by extendee and name)
+  extensions = {}
+  for extension in get_all(proto, FILE_EXTENSION):
+    extension = decode(extension)
+    extendee = get(extension, FIELD_EXTENDEE).decode()
+    name = get(extension, FIELD_NAME).decode()
+    extensions.setdefault(extendee, {})[name] = get(extension, FIELD_NUMBER)
+  options = Options(extensions)
+  if options.bit_offset is None or options.bit_width is None:
+    raise ValueError('missing bit_offset/bit_width options')
+  messages = []
+  for message in get_all(proto, FILE_MESSAGE_TYPE):
+    parse_message(decode(message), options, messages)
+  return get(proto, FILE_NAME).decode(), messages
+
+
+def parse_message(message, options, messages):
+  """Adds the BitMessage for <message> (and its nested ones)."""
+  name = get(message, MESSAGE_NAME).decode()
+  for nested in get_all(message, MESSAGE_NESTED_TYPE):
+    parse_message(decode(nested), options, messages)
+  fields = []
+  plain = []
+  for field in get_all(message, MESSAGE_FIELD):
+    field = decode(field)
+    field_name = get(field, FIELD_NAME).decode()
+    field_options = decode(get(field, FIELD_OPTIONS, b''))
+    offset = get(field_options, options.bit_offset)
+    width = get(field_options, options.bit_width)
+    if offset is None and width is None:
+      plain.append(field_name)
+      continue
+    if offset is None or width is None:
+      raise ValueError('%s.%s: needs both bit_offset and bit_width' %
+                       (name, field_name))
+    field_type, max_width = FIELD_TYPES.get(get(field, FIELD_TYPE),
+                                            (None, 0))
+    if field_type is None or get(field, FIELD_LABEL) == LABEL_REPEATED:
+      raise ValueError('%s.%s: unsupported bit field type' %
+                       (name, field_name))
+    offset = signed(offset, 32)
+    width = signed(width, 32)
+    if offset < 0 or width < 1 or width > max_width:
+      raise ValueError('%s.%s: invalid bit layout' % (name, field_name))
+    fields.append(BitField(field_name, field_type, offset, width))
+  if not fields:
+    return
+  if plain:
+    raise ValueError('%s: fields without a bit layout: %s' %
+                     (name, ', '.join(plain)))
+  markers = []
+  message_options = decode(get(message, MESSAGE_OPTIONS, b''))
+  if options.bit_marker is not None:
+    for marker in get_all(message_options, options.bit_marker):
+      marker = decode(marker)
+      offset = signed(get(marker, MARKER_OFFSET, 0), 32)
+      width = signed(get(marker, MARKER_WIDTH, 0), 32)
+      value = signed(get(marker, MARKER_VALUE, 0))
+      if offset < 0 or width < 1 or width > 64 or value >> width:
+        raise ValueError('%s: invalid marker' % name)
+      markers.append(BitMarker(offset, width, value))
+  # fields and markers must not overlap
+  layout = sorted(fields + markers, key=lambda f: f.offset)
+  for prev, field in zip(layout, layout[1:]):
+    if field.offset < prev.offset + prev.width:
+      raise ValueError('%s: overlapping bits at offset %d' %
+                       (name, field.offset))
+  fields.sort(key=lambda f: f.offset)
+  message = BitMessage(name, fields, markers)
+  if message.size > MAX_WORD_BYTES:
+    raise ValueError('%s: longer than %d bytes' % (name, MAX_WORD_BYTES))
+  messages.append(message)
+
+
+def hex_literal(value):
+  """Returns <value> as a C++ (unsigned) hex literal."""
+  return ('0x%xULL' if value > 0xffffffff else '0x%x') % value
+
+
+def emit_parse(message):
+  """Returns the Parse routine of <message>."""
+  word = 'uint%d_t' % message.word_bits
+  lines = []
+  lines.append('static inline int Parse%sBits(const uint8_t *buf, int len,'
+               % message.name)
+  lines.append('    %s *msg) {' % message.name)
+  lines.append('  if (len < %d) {' % message.size)
+  lines.append('    return -1;')
+  lines.append('  }')
+  loads = ['(%s)buf[%d] << %d' % (word, i, (message.size - 1 - i) * 8)
+           for i in range(message.size - 1)]
+  loads.append('(%s)buf[%d]' % (word, message.size - 1))
+  lines.append('  %s word = %s;' % (word, ' |\n      '.join(loads)))
+  for marker in sorted(message.markers, key=lambda m: m.offset):
+    lines.append('  if (((word >> %d) & %s) != %s) {' %
+                 (message.shift(marker), hex_literal((1 << marker.width) - 1),
+                  hex_literal(marker.value)))
+    lines.append('    return -1;')
+    lines.append('  }')
+  for field in message.fields:
+    value = '(word >> %d) & %s' % (message.shift(field),
+                                  hex_literal((1 << field.width) - 1))
+    if field.field_type == 'bool':
+      value = '(%s) != 0' % value
+    lines.append('  msg->set_%s(%s);' % (field.name, value))
+  lines.append('  return %d;' % message.size)
+  lines.append('}')
+  return '\n'.join(lines)
+
+
+def emit_dump(message):
+  """Returns the Dump routine of <message>."""
+  word = 'uint%d_t' % message.word_bits
+  lines = []
+  lines.append('static inline int Dump%sBits(const %s &msg, uint8_t *buf,'
+               % (message.name, message.name))
+  lines.append('    int len) {')
+  lines.append('  if (len < %d) {' % message.size)
+  lines.append('    return -1;')
+  lines.append('  }')
+  for field in message.fields:
+    lines.append('  if (!msg.has_%s()) {' % field.name)
+    lines.append('    return -1;')
+    lines.append('  }')
+  markers = 0
+  for marker in message.markers:
+    markers |= marker.value << message.shift(marker)
+  lines.append('  %s word = %s;' % (word, hex_literal(markers)))
+  for field in message.fields:
+    lines.append('  word |= ((%s)msg.%s() & %s) << %d;' %
+                 (word, field.name, hex_literal((1 << field.width) - 1),
+                  message.shift(field)))
+  # store the bytes covered by the fields and markers (keeping the
+  # other bits)
+  covered = 0
+  for field in message.fields + message.markers:
+    covered |= ((1 << field.width) - 1) << message.shift(field)
+  for i in range(message.size):
+    shift = (message.size - 1 - i) * 8
+    mask = (covered >> shift) & 0xff
+    if mask == 0:
+      continue
+    if mask == 0xff:
+      lines.append('  buf[%d] = (word >> %d) & 0xff;' % (i, shift))
+    else:
+      lines.append('  buf[%d] = (buf[%d] & 0x%02x) | ((word >> %d) & 0x%02x);'
+                   % (i, i, ~mask & 0xff, shift, mask))
+  lines.append('  return %d;' % message.size)
+  lines.append('}')
+  return '\n'.join(lines)
+
+
+def emit_header(messages, proto_name, header_name):
+  """Returns the C++ header with the routines of <messages>."""
+  guard = re.sub(r'\W', '_', os.path.basename(header_name)).upper() + '_'
+  pb_header = re.sub(r'\.proto$', '.pb.h', os.path.basename(proto_name))
+  out = []
+  out.append('// Generated by tools/bitfield_codec.py from %s. Do not edit.' %
+             os.path.basename(proto_name))
+  out.append('')
+  out.append('#ifndef %s' % guard)
+  out.append('#define %s' % guard)
+  out.append('')
+  out.append('#include <stdint.h>  // for uint8_t, uint32_t, uint64_t')
+  out.append('')
+  out.append('#include "%s"' % pb_header)
+  for message in messages:
+    out.append('')
+    out.append('// %s (%d bytes)' % (message.name, message.size))
+    out.append(emit_parse(message))
+    out.append('')
+    out.append(emit_dump(message))
+  out.append('')
+  out.append('#endif  // %s' % guard)
+  out.append('')
+  return '\n'.join(out)
+
+
+def main(argv):
+  if len(argv) != 3:
+    sys.stderr.write('usage: %s <input.desc> <output.h>\n' % argv[0])
+    return 1
+  with open(argv[1], 'rb') as f:
+    buf = f.read()
+  try:
+    proto_name, messages = parse_descriptor_set(buf)
+  except (ValueError, IndexError) as e:
+    sys.stderr.write('%s: %s\n' % (argv[1], e))
+    return 1
+  with open(argv[2], 'w') as f:
+    f.write(emit_header(messages, proto_name, argv[2]))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv))